@@ -12,6 +12,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include <esp_log.h>
 #include <esp_err.h>
@@ -23,24 +24,175 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+
+struct _camwebsrv_camera_t;
+
+typedef struct
+{
+  struct _camwebsrv_camera_t *pcam;
+  uint8_t *buf;
+  size_t len;
+  size_t size;
+  int64_t tstamp;
+  uint32_t seq;
+  uint16_t refs;
+} _camwebsrv_camera_frame_t;
 
 typedef struct
 {
-  camera_fb_t *fb;
+  camwebsrv_camera_cb_t cb;
+  void *arg;
+} _camwebsrv_camera_sub_t;
+
+typedef struct _camwebsrv_camera_t
+{
+  _camwebsrv_camera_frame_t pool[CAMWEBSRV_CAMERA_FRAME_POOL_SIZE];
+  _camwebsrv_camera_sub_t subs[CAMWEBSRV_CAMERA_SUBSCRIBERS];
+  _camwebsrv_camera_frame_t *frame;
   bool flash;
   bool ov3660;
   int64_t tstamp;
+  uint32_t seq;
+  size_t favg;
   uint8_t fps;
+  camwebsrv_camera_status_t status;
+  uint32_t version;
+  uint32_t sversion;
+  int pvalues[CAMWEBSRV_CAMERA_CTRL_COUNT];
+  int avalues[CAMWEBSRV_CAMERA_CTRL_COUNT];
+  uint32_t pmask;
+  uint32_t amask;
+  uint32_t pbatch;
+  uint32_t abatch;
+  uint32_t aseq;
+  uint8_t skip;
+  int64_t lavg;
+  TaskHandle_t task;
+  volatile bool stop;
+  SemaphoreHandle_t done;
+  EventGroupHandle_t events;
   SemaphoreHandle_t mutex1;
   SemaphoreHandle_t mutex2;
+  SemaphoreHandle_t mutex3;
 } _camwebsrv_camera_t;
 
 static esp_err_t _camwebsrv_camera_init(_camwebsrv_camera_t *pcam);
+static void _camwebsrv_camera_task(void *arg);
+static esp_err_t _camwebsrv_camera_produce(_camwebsrv_camera_t *pcam);
+static _camwebsrv_camera_frame_t *_camwebsrv_camera_frame_alloc(_camwebsrv_camera_t *pcam);
+static void _camwebsrv_camera_frame_publish(_camwebsrv_camera_t *pcam, _camwebsrv_camera_frame_t *pframe);
+static void _camwebsrv_camera_frame_release(_camwebsrv_camera_t *pcam, _camwebsrv_camera_frame_t *pframe);
+
+// sensor-backed controls are all a straight call to the sensor's setter and
+// a read of its cached status; the rest are written out below
+
+#define _CAMWEBSRV_CAMERA_CTRL_SENSOR(n, f) \
+static int _camwebsrv_camera_ctrl_get_##n(_camwebsrv_camera_t *pcam, sensor_t *sensor) \
+{ \
+  return sensor->status.n; \
+} \
+static int _camwebsrv_camera_ctrl_set_##n(_camwebsrv_camera_t *pcam, sensor_t *sensor, int value) \
+{ \
+  return sensor->f(sensor, value); \
+}
+
+#define _CAMWEBSRV_CAMERA_EVENT_FRAME 0x01
+#define _CAMWEBSRV_CAMERA_EVENT_CTRL 0x02
+
+#define _CAMWEBSRV_CAMERA_SENSOR_OV2640 0x01
+#define _CAMWEBSRV_CAMERA_SENSOR_OV3660 0x02
+#define _CAMWEBSRV_CAMERA_SENSOR_ALL    0x03
+
+typedef struct
+{
+  const char *name;
+  uint8_t sensors;
+  int range[2][2];
+  int (*get)(_camwebsrv_camera_t *pcam, sensor_t *sensor);
+  int (*set)(_camwebsrv_camera_t *pcam, sensor_t *sensor, int value);
+} _camwebsrv_camera_ctrl_t;
+
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(ae_level, set_ae_level)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(aec, set_exposure_ctrl)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(aec2, set_aec2)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(aec_value, set_aec_value)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(agc, set_gain_ctrl)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(agc_gain, set_agc_gain)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(awb, set_whitebal)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(awb_gain, set_awb_gain)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(bpc, set_bpc)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(brightness, set_brightness)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(colorbar, set_colorbar)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(contrast, set_contrast)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(dcw, set_dcw)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(denoise, set_denoise)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(gainceiling, set_gainceiling)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(hmirror, set_hmirror)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(lenc, set_lenc)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(quality, set_quality)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(raw_gma, set_raw_gma)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(saturation, set_saturation)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(sharpness, set_sharpness)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(special_effect, set_special_effect)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(vflip, set_vflip)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(wb_mode, set_wb_mode)
+_CAMWEBSRV_CAMERA_CTRL_SENSOR(wpc, set_wpc)
+
+static int _camwebsrv_camera_ctrl_get_flash(_camwebsrv_camera_t *pcam, sensor_t *sensor);
+static int _camwebsrv_camera_ctrl_set_flash(_camwebsrv_camera_t *pcam, sensor_t *sensor, int value);
+static int _camwebsrv_camera_ctrl_get_fps(_camwebsrv_camera_t *pcam, sensor_t *sensor);
+static int _camwebsrv_camera_ctrl_set_fps(_camwebsrv_camera_t *pcam, sensor_t *sensor, int value);
+static int _camwebsrv_camera_ctrl_get_framesize(_camwebsrv_camera_t *pcam, sensor_t *sensor);
+static int _camwebsrv_camera_ctrl_set_framesize(_camwebsrv_camera_t *pcam, sensor_t *sensor, int value);
+static int _camwebsrv_camera_ctrl_cmp(const void *key, const void *elem);
+static esp_err_t _camwebsrv_camera_ctrl_lookup(_camwebsrv_camera_t *pcam, const char *name, int value, const _camwebsrv_camera_ctrl_t **ctrl);
+static void _camwebsrv_camera_ctrl_apply(_camwebsrv_camera_t *pcam, sensor_t *sensor);
+
+// queued changes are kept as one bit per control
+
+_Static_assert(CAMWEBSRV_CAMERA_CTRL_COUNT <= 32, "too many controls for the pending mask");
+
+// indexed by id, which also keeps it sorted by name for bsearch(); ranges
+// are { OV2640, OV3660 }, and match what the sensor pages allow
+
+static const _camwebsrv_camera_ctrl_t _camwebsrv_camera_ctrls[CAMWEBSRV_CAMERA_CTRL_COUNT] =
+{
+  [CAMWEBSRV_CAMERA_CTRL_AE_LEVEL]       = { "ae_level",       _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { -2, 2 }, { -5, 5 } },       _camwebsrv_camera_ctrl_get_ae_level,       _camwebsrv_camera_ctrl_set_ae_level },
+  [CAMWEBSRV_CAMERA_CTRL_AEC]            = { "aec",            _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 1 }, { 0, 1 } },         _camwebsrv_camera_ctrl_get_aec,            _camwebsrv_camera_ctrl_set_aec },
+  [CAMWEBSRV_CAMERA_CTRL_AEC2]           = { "aec2",           _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 1 }, { 0, 1 } },         _camwebsrv_camera_ctrl_get_aec2,           _camwebsrv_camera_ctrl_set_aec2 },
+  [CAMWEBSRV_CAMERA_CTRL_AEC_VALUE]      = { "aec_value",      _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 1200 }, { 0, 1536 } },   _camwebsrv_camera_ctrl_get_aec_value,      _camwebsrv_camera_ctrl_set_aec_value },
+  [CAMWEBSRV_CAMERA_CTRL_AGC]            = { "agc",            _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 1 }, { 0, 1 } },         _camwebsrv_camera_ctrl_get_agc,            _camwebsrv_camera_ctrl_set_agc },
+  [CAMWEBSRV_CAMERA_CTRL_AGC_GAIN]       = { "agc_gain",       _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 30 }, { 0, 64 } },       _camwebsrv_camera_ctrl_get_agc_gain,       _camwebsrv_camera_ctrl_set_agc_gain },
+  [CAMWEBSRV_CAMERA_CTRL_AWB]            = { "awb",            _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 1 }, { 0, 1 } },         _camwebsrv_camera_ctrl_get_awb,            _camwebsrv_camera_ctrl_set_awb },
+  [CAMWEBSRV_CAMERA_CTRL_AWB_GAIN]       = { "awb_gain",       _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 1 }, { 0, 1 } },         _camwebsrv_camera_ctrl_get_awb_gain,       _camwebsrv_camera_ctrl_set_awb_gain },
+  [CAMWEBSRV_CAMERA_CTRL_BPC]            = { "bpc",            _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 1 }, { 0, 1 } },         _camwebsrv_camera_ctrl_get_bpc,            _camwebsrv_camera_ctrl_set_bpc },
+  [CAMWEBSRV_CAMERA_CTRL_BRIGHTNESS]     = { "brightness",     _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { -2, 2 }, { -3, 3 } },       _camwebsrv_camera_ctrl_get_brightness,     _camwebsrv_camera_ctrl_set_brightness },
+  [CAMWEBSRV_CAMERA_CTRL_COLORBAR]       = { "colorbar",       _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 1 }, { 0, 1 } },         _camwebsrv_camera_ctrl_get_colorbar,       _camwebsrv_camera_ctrl_set_colorbar },
+  [CAMWEBSRV_CAMERA_CTRL_CONTRAST]       = { "contrast",       _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { -2, 2 }, { -3, 3 } },       _camwebsrv_camera_ctrl_get_contrast,       _camwebsrv_camera_ctrl_set_contrast },
+  [CAMWEBSRV_CAMERA_CTRL_DCW]            = { "dcw",            _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 1 }, { 0, 1 } },         _camwebsrv_camera_ctrl_get_dcw,            _camwebsrv_camera_ctrl_set_dcw },
+  [CAMWEBSRV_CAMERA_CTRL_DENOISE]        = { "denoise",        _CAMWEBSRV_CAMERA_SENSOR_OV3660, { { 0, 0 }, { 0, 8 } },         _camwebsrv_camera_ctrl_get_denoise,        _camwebsrv_camera_ctrl_set_denoise },
+  [CAMWEBSRV_CAMERA_CTRL_FLASH]          = { "flash",          _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 1 }, { 0, 1 } },         _camwebsrv_camera_ctrl_get_flash,          _camwebsrv_camera_ctrl_set_flash },
+  [CAMWEBSRV_CAMERA_CTRL_FPS]            = { "fps",            _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { CAMWEBSRV_CAMERA_FPS_MIN, CAMWEBSRV_CAMERA_FPS_MAX }, { CAMWEBSRV_CAMERA_FPS_MIN, CAMWEBSRV_CAMERA_FPS_MAX } }, _camwebsrv_camera_ctrl_get_fps, _camwebsrv_camera_ctrl_set_fps },
+  [CAMWEBSRV_CAMERA_CTRL_FRAMESIZE]      = { "framesize",      _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, FRAMESIZE_UXGA }, { 0, FRAMESIZE_QXGA } }, _camwebsrv_camera_ctrl_get_framesize, _camwebsrv_camera_ctrl_set_framesize },
+  [CAMWEBSRV_CAMERA_CTRL_GAINCEILING]    = { "gainceiling",    _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 6 }, { 0, 511 } },       _camwebsrv_camera_ctrl_get_gainceiling,    _camwebsrv_camera_ctrl_set_gainceiling },
+  [CAMWEBSRV_CAMERA_CTRL_HMIRROR]        = { "hmirror",        _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 1 }, { 0, 1 } },         _camwebsrv_camera_ctrl_get_hmirror,        _camwebsrv_camera_ctrl_set_hmirror },
+  [CAMWEBSRV_CAMERA_CTRL_LENC]           = { "lenc",           _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 1 }, { 0, 1 } },         _camwebsrv_camera_ctrl_get_lenc,           _camwebsrv_camera_ctrl_set_lenc },
+  [CAMWEBSRV_CAMERA_CTRL_QUALITY]        = { "quality",        _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 10, 63 }, { 4, 63 } },      _camwebsrv_camera_ctrl_get_quality,        _camwebsrv_camera_ctrl_set_quality },
+  [CAMWEBSRV_CAMERA_CTRL_RAW_GMA]        = { "raw_gma",        _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 1 }, { 0, 1 } },         _camwebsrv_camera_ctrl_get_raw_gma,        _camwebsrv_camera_ctrl_set_raw_gma },
+  [CAMWEBSRV_CAMERA_CTRL_SATURATION]     = { "saturation",     _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { -2, 2 }, { -4, 4 } },       _camwebsrv_camera_ctrl_get_saturation,     _camwebsrv_camera_ctrl_set_saturation },
+  [CAMWEBSRV_CAMERA_CTRL_SHARPNESS]      = { "sharpness",      _CAMWEBSRV_CAMERA_SENSOR_OV3660, { { 0, 0 }, { -3, 3 } },        _camwebsrv_camera_ctrl_get_sharpness,      _camwebsrv_camera_ctrl_set_sharpness },
+  [CAMWEBSRV_CAMERA_CTRL_SPECIAL_EFFECT] = { "special_effect", _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 6 }, { 0, 6 } },         _camwebsrv_camera_ctrl_get_special_effect, _camwebsrv_camera_ctrl_set_special_effect },
+  [CAMWEBSRV_CAMERA_CTRL_VFLIP]          = { "vflip",          _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 1 }, { 0, 1 } },         _camwebsrv_camera_ctrl_get_vflip,          _camwebsrv_camera_ctrl_set_vflip },
+  [CAMWEBSRV_CAMERA_CTRL_WB_MODE]        = { "wb_mode",        _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 4 }, { 0, 4 } },         _camwebsrv_camera_ctrl_get_wb_mode,        _camwebsrv_camera_ctrl_set_wb_mode },
+  [CAMWEBSRV_CAMERA_CTRL_WPC]            = { "wpc",            _CAMWEBSRV_CAMERA_SENSOR_ALL,    { { 0, 1 }, { 0, 1 } },         _camwebsrv_camera_ctrl_get_wpc,            _camwebsrv_camera_ctrl_set_wpc }
+};
 
 esp_err_t camwebsrv_camera_init(camwebsrv_camera_t *cam)
 {
   esp_err_t rv;
   _camwebsrv_camera_t *pcam;
+  uint8_t i;
 
   if (cam == NULL)
   {
@@ -58,11 +210,21 @@ esp_err_t camwebsrv_camera_init(camwebsrv_camera_t *cam)
     return ESP_FAIL;
   }
 
+  pcam->done = xSemaphoreCreateBinary();
+
+  if (pcam->done == NULL)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_init(): xSemaphoreCreateBinary() failed");
+    free(pcam);
+    return ESP_FAIL;
+  }
+
   pcam->mutex1 = xSemaphoreCreateMutex();
 
   if (pcam->mutex1 == NULL)
   {
     ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_init(): xSemaphoreCreateMutex(1) failed");
+    vSemaphoreDelete(pcam->done);
     free(pcam);
     return ESP_FAIL;
   }
@@ -73,13 +235,64 @@ esp_err_t camwebsrv_camera_init(camwebsrv_camera_t *cam)
   {
     ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_init(): xSemaphoreCreateMutex(2) failed");
     vSemaphoreDelete(pcam->mutex1);
+    vSemaphoreDelete(pcam->done);
+    free(pcam);
+    return ESP_FAIL;
+  }
+
+  pcam->mutex3 = xSemaphoreCreateMutex();
+
+  if (pcam->mutex3 == NULL)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_init(): xSemaphoreCreateMutex(3) failed");
+    vSemaphoreDelete(pcam->mutex2);
+    vSemaphoreDelete(pcam->mutex1);
+    vSemaphoreDelete(pcam->done);
+    free(pcam);
+    return ESP_FAIL;
+  }
+
+  // waiters for a fresh frame block on this; the producer sets it whenever
+  // it publishes one
+
+  pcam->events = xEventGroupCreate();
+
+  if (pcam->events == NULL)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_init(): xEventGroupCreate() failed");
+    vSemaphoreDelete(pcam->mutex3);
+    vSemaphoreDelete(pcam->mutex2);
+    vSemaphoreDelete(pcam->mutex1);
+    vSemaphoreDelete(pcam->done);
     free(pcam);
     return ESP_FAIL;
   }
 
-  pcam->fb = NULL;
+  // frame pool buffers are allocated lazily, on first use
+
+  memset(pcam->pool, 0x00, sizeof(pcam->pool));
+
+  for (i = 0; i < CAMWEBSRV_CAMERA_FRAME_POOL_SIZE; i++)
+  {
+    pcam->pool[i].pcam = pcam;
+  }
+
+  memset(pcam->subs, 0x00, sizeof(pcam->subs));
+
+  pcam->frame = NULL;
   pcam->ov3660 = false;
   pcam->tstamp = -1;
+  pcam->seq = 0;
+  pcam->version = 0;
+  pcam->sversion = 0;
+  pcam->pmask = 0;
+  pcam->amask = 0;
+  pcam->pbatch = 0;
+  pcam->abatch = 0;
+  pcam->aseq = 0;
+  pcam->lavg = 0;
+  pcam->task = NULL;
+  pcam->stop = false;
 
   // set flash led gpio
 
@@ -88,8 +301,11 @@ esp_err_t camwebsrv_camera_init(camwebsrv_camera_t *cam)
   if (rv != ESP_OK)
   {
     ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_init(): gpio_set_direction() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    vEventGroupDelete(pcam->events);
+    vSemaphoreDelete(pcam->mutex3);
     vSemaphoreDelete(pcam->mutex2);
     vSemaphoreDelete(pcam->mutex1);
+    vSemaphoreDelete(pcam->done);
     free(pcam);
     return rv;
   }
@@ -101,8 +317,11 @@ esp_err_t camwebsrv_camera_init(camwebsrv_camera_t *cam)
   if (rv != ESP_OK)
   {
     ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_init(): _camwebsrv_camera_init() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    vEventGroupDelete(pcam->events);
+    vSemaphoreDelete(pcam->mutex3);
     vSemaphoreDelete(pcam->mutex2);
     vSemaphoreDelete(pcam->mutex1);
+    vSemaphoreDelete(pcam->done);
     free(pcam);
     return rv;
   }
@@ -115,6 +334,7 @@ esp_err_t camwebsrv_camera_init(camwebsrv_camera_t *cam)
 esp_err_t camwebsrv_camera_destroy(camwebsrv_camera_t *cam)
 {
   _camwebsrv_camera_t *pcam;
+  uint8_t i;
 
   if (cam == NULL)
   {
@@ -128,6 +348,18 @@ esp_err_t camwebsrv_camera_destroy(camwebsrv_camera_t *cam)
     return ESP_OK;
   }
 
+  // stop the producer task, and wait for it to finish its current frame
+
+  if (pcam->task != NULL)
+  {
+    pcam->stop = true;
+
+    xTaskNotifyGive(pcam->task);
+    xSemaphoreTake(pcam->done, portMAX_DELAY);
+
+    pcam->task = NULL;
+  }
+
   if (xSemaphoreTake(pcam->mutex1, portMAX_DELAY) != pdTRUE)
   {
     ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_destroy(): xSemaphoreTake(1) failed");
@@ -140,21 +372,81 @@ esp_err_t camwebsrv_camera_destroy(camwebsrv_camera_t *cam)
     return ESP_FAIL;
   }
 
+  if (xSemaphoreTake(pcam->mutex3, portMAX_DELAY) != pdTRUE)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_destroy(): xSemaphoreTake(3) failed");
+    return ESP_FAIL;
+  }
+
   // we have the mutexes, so clear the caller's reference to this object before giving it back
 
   *cam = NULL;
 
+  // free frame pool; any outstanding references are now invalid
+
+  for (i = 0; i < CAMWEBSRV_CAMERA_FRAME_POOL_SIZE; i++)
+  {
+    if (pcam->pool[i].refs > 0 && &(pcam->pool[i]) != pcam->frame)
+    {
+      ESP_LOGW(CAMWEBSRV_TAG, "CAM camwebsrv_camera_destroy(): frame %u still has %u references", pcam->pool[i].seq, pcam->pool[i].refs);
+    }
+
+    if (pcam->pool[i].buf != NULL)
+    {
+      free(pcam->pool[i].buf);
+    }
+  }
+
   xSemaphoreGive(pcam->mutex1);
   vSemaphoreDelete(pcam->mutex1);
 
   xSemaphoreGive(pcam->mutex2);
   vSemaphoreDelete(pcam->mutex2);
 
+  xSemaphoreGive(pcam->mutex3);
+  vSemaphoreDelete(pcam->mutex3);
+
+  vEventGroupDelete(pcam->events);
+  vSemaphoreDelete(pcam->done);
+
   free(pcam);
 
   return ESP_OK;
 }
 
+esp_err_t camwebsrv_camera_start(camwebsrv_camera_t cam)
+{
+  _camwebsrv_camera_t *pcam;
+
+  if (cam == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  pcam = (_camwebsrv_camera_t *) cam;
+
+  if (pcam->task != NULL)
+  {
+    return ESP_OK;
+  }
+
+  // frames are captured by a task of their own, pinned away from the wifi
+  // stack, so that clients never wait for the sensor
+
+  pcam->stop = false;
+
+  if (xTaskCreatePinnedToCore(_camwebsrv_camera_task, "camera", CAMWEBSRV_CAMERA_TASK_STACK, pcam, CAMWEBSRV_CAMERA_TASK_PRIO, &(pcam->task), CAMWEBSRV_CAMERA_TASK_CORE) != pdPASS)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_start(): xTaskCreatePinnedToCore() failed");
+    pcam->task = NULL;
+    return ESP_FAIL;
+  }
+
+  ESP_LOGI(CAMWEBSRV_TAG, "CAM camwebsrv_camera_start(): started producer on core %u", CAMWEBSRV_CAMERA_TASK_CORE);
+
+  return ESP_OK;
+}
+
 esp_err_t camwebsrv_camera_reset(camwebsrv_camera_t cam)
 {
   _camwebsrv_camera_t *pcam;
@@ -182,14 +474,19 @@ esp_err_t camwebsrv_camera_reset(camwebsrv_camera_t cam)
     return ESP_FAIL;
   }
 
-  // if we're still holding on to a frame, give it back
+  // drop our reference to the last published frame; clients still holding
+  // on to it keep it alive until they dispose of it
 
-  if (pcam->fb != NULL)
+  xSemaphoreTake(pcam->mutex3, portMAX_DELAY);
+
+  if (pcam->frame != NULL)
   {
-    esp_camera_fb_return(pcam->fb);
-    pcam->fb = NULL;
+    _camwebsrv_camera_frame_release(pcam, pcam->frame);
+    pcam->frame = NULL;
   }
 
+  xSemaphoreGive(pcam->mutex3);
+
   // de-init
 
   rv = esp_camera_deinit();
@@ -218,6 +515,16 @@ esp_err_t camwebsrv_camera_reset(camwebsrv_camera_t cam)
 
   pcam->tstamp = -1;
 
+  // anything still queued was meant for the settings we just threw away
+
+  if (pcam->pmask != 0)
+  {
+    pcam->amask &= ~(pcam->pmask);
+    pcam->pmask = 0;
+    pcam->abatch = pcam->pbatch;
+    pcam->aseq = pcam->seq + 1 + CAMWEBSRV_CAMERA_FB_COUNT;
+  }
+
   // unnlock
 
   xSemaphoreGive(pcam->mutex2);
@@ -226,122 +533,321 @@ esp_err_t camwebsrv_camera_reset(camwebsrv_camera_t cam)
   return ESP_OK;
 }
 
-esp_err_t camwebsrv_camera_frame_grab(camwebsrv_camera_t cam, uint8_t **fbuf, size_t *flen, int64_t *tstamp)
+esp_err_t camwebsrv_camera_subscribe(camwebsrv_camera_t cam, camwebsrv_camera_cb_t cb, void *arg)
 {
   _camwebsrv_camera_t *pcam;
-  int64_t now;
+  esp_err_t rv = ESP_ERR_NO_MEM;
+  uint8_t i;
 
-  if (cam == NULL || fbuf == NULL || flen == NULL)
+  if (cam == NULL || cb == NULL)
   {
     return ESP_ERR_INVALID_ARG;
   }
 
   pcam = (_camwebsrv_camera_t *) cam;
 
-  // lock
+  xSemaphoreTake(pcam->mutex3, portMAX_DELAY);
 
-  if (xSemaphoreTake(pcam->mutex2, portMAX_DELAY) != pdTRUE)
+  // subscribing twice is the same as subscribing once
+
+  for (i = 0; i < CAMWEBSRV_CAMERA_SUBSCRIBERS; i++)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_frame_grab(): xSemaphoreTake() failed");
-    return ESP_FAIL;
+    if (pcam->subs[i].cb == cb && pcam->subs[i].arg == arg)
+    {
+      rv = ESP_OK;
+      break;
+    }
+  }
+
+  for (i = 0; i < CAMWEBSRV_CAMERA_SUBSCRIBERS && rv != ESP_OK; i++)
+  {
+    if (pcam->subs[i].cb == NULL)
+    {
+      pcam->subs[i].cb = cb;
+      pcam->subs[i].arg = arg;
+      rv = ESP_OK;
+    }
   }
 
-  // do we need a new frame?
+  xSemaphoreGive(pcam->mutex3);
 
-  now = esp_timer_get_time();
+  return rv;
+}
+
+esp_err_t camwebsrv_camera_unsubscribe(camwebsrv_camera_t cam, camwebsrv_camera_cb_t cb, void *arg)
+{
+  _camwebsrv_camera_t *pcam;
+  uint8_t i;
 
-  if ((now - pcam->tstamp) >= (1000000 / pcam->fps))
+  if (cam == NULL || cb == NULL)
   {
-    sensor_t *sensor = NULL;
-    uint8_t i;
+    return ESP_ERR_INVALID_ARG;
+  }
 
-    // return previous frame
+  pcam = (_camwebsrv_camera_t *) cam;
 
-    if (pcam->fb != NULL)
-    {
-      esp_camera_fb_return(pcam->fb);
+  xSemaphoreTake(pcam->mutex3, portMAX_DELAY);
 
-      pcam->fb = NULL;
-      pcam->tstamp = 0;
+  for (i = 0; i < CAMWEBSRV_CAMERA_SUBSCRIBERS; i++)
+  {
+    if (pcam->subs[i].cb == cb && pcam->subs[i].arg == arg)
+    {
+      pcam->subs[i].cb = NULL;
+      pcam->subs[i].arg = NULL;
     }
+  }
 
-    // get sensor
+  xSemaphoreGive(pcam->mutex3);
 
-    sensor = esp_camera_sensor_get();
+  return ESP_OK;
+}
 
-    if (sensor == NULL)
+esp_err_t camwebsrv_camera_frame_grab(camwebsrv_camera_t cam, int64_t maxage, camwebsrv_camera_frame_t *frame)
+{
+  _camwebsrv_camera_t *pcam;
+  _camwebsrv_camera_frame_t *pframe;
+  int64_t interval;
+  int64_t deadline;
+  int64_t tstart;
+  int64_t wait;
+  int64_t now;
+  TickType_t ticks;
+
+  if (cam == NULL || frame == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  pcam = (_camwebsrv_camera_t *) cam;
+
+  // the caller says how old a frame it is willing to take, in usec; zero
+  // means the camera's own frame interval
+
+  interval = 1000000 / pcam->fps;
+
+  if (maxage <= 0)
+  {
+    maxage = interval;
+  }
+
+  // the producer task publishes a frame every interval, so most callers just
+  // take the current one; only a caller asking for fresher frames than that
+  // waits, and hurries the producer along, but not for more than a couple
+  // of intervals
+
+  tstart = esp_timer_get_time();
+  deadline = tstart + ((maxage < interval) ? (interval * 2) : 0);
+
+  while(true)
+  {
+    now = esp_timer_get_time();
+
+    xSemaphoreTake(pcam->mutex3, portMAX_DELAY);
+
+    // clear the event while holding the lock, so that a frame published
+    // after we've looked at the current one still wakes us up
+
+    xEventGroupClearBits(pcam->events, _CAMWEBSRV_CAMERA_EVENT_FRAME);
+
+    pframe = pcam->frame;
+
+    if (pframe != NULL && (pframe->tstamp > (tstart - maxage) || now >= deadline))
     {
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM (): camwebsrv_camera_frame_grab(): esp_camera_sensor_get() failed");
-      xSemaphoreGive(pcam->mutex2);
-      return ESP_FAIL;
+      // give out a new reference to the current frame
+
+      pframe->refs++;
+      *frame = (camwebsrv_camera_frame_t) pframe;
+
+      xSemaphoreGive(pcam->mutex3);
+
+      return ESP_OK;
     }
 
-    // get frame, but skip the first couple of frames if this is the first grab
+    xSemaphoreGive(pcam->mutex3);
+
+    if (now >= (tstart + (CAMWEBSRV_CAMERA_GRAB_TMOUT_MSEC * 1000)))
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_frame_grab(): no frame after %u msec", CAMWEBSRV_CAMERA_GRAB_TMOUT_MSEC);
+      return ESP_ERR_TIMEOUT;
+    }
 
-    for (i = 0; i < (pcam->tstamp >= 0 ? 1 : CAMWEBSRV_CAMERA_INITIAL_FRAME_SKIP); i++)
+    if (pcam->task != NULL)
     {
-      if (i > 0)
-      {
-        esp_camera_fb_return(pcam->fb);
-        vTaskDelay((1000 / pcam->fps) / portTICK_PERIOD_MS);
-      }
-
-      pcam->fb = esp_camera_fb_get();
-
-      if (pcam->fb == NULL)
-      {
-        ESP_LOGE(CAMWEBSRV_TAG, "CAM (): camwebsrv_camera_frame_grab(): esp_camera_fb_get() failed");
-        xSemaphoreGive(pcam->mutex2);
-        return ESP_FAIL;
-      }
+      xTaskNotifyGive(pcam->task);
     }
 
-    pcam->tstamp = now;
+    // sleep until the next frame is published; with no frame at all, give
+    // the producer until the timeout, otherwise, until the deadline
+
+    wait = ((pframe == NULL) ? (tstart + (CAMWEBSRV_CAMERA_GRAB_TMOUT_MSEC * 1000)) : deadline) - now;
+    ticks = pdMS_TO_TICKS(wait / 1000);
+
+    xEventGroupWaitBits(pcam->events, _CAMWEBSRV_CAMERA_EVENT_FRAME, pdFALSE, pdTRUE, (ticks > 0) ? ticks : 1);
+  }
+}
+
+esp_err_t camwebsrv_camera_frame_current(camwebsrv_camera_t cam, camwebsrv_camera_frame_t *frame)
+{
+  _camwebsrv_camera_t *pcam;
+  _camwebsrv_camera_frame_t *pframe;
+
+  if (cam == NULL || frame == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
   }
 
-  // give out reference to the current frame
+  pcam = (_camwebsrv_camera_t *) cam;
+
+  // whatever was published last, however old; this never waits for the
+  // producer
 
-  *fbuf = pcam->fb->buf;
-  *flen = pcam->fb->len;
+  xSemaphoreTake(pcam->mutex3, portMAX_DELAY);
 
-  if (tstamp != NULL)
+  pframe = pcam->frame;
+
+  if (pframe == NULL)
   {
-    *tstamp = pcam->tstamp;
+    xSemaphoreGive(pcam->mutex3);
+    *frame = NULL;
+    return ESP_ERR_NOT_FOUND;
   }
 
+  pframe->refs++;
+  *frame = (camwebsrv_camera_frame_t) pframe;
+
+  xSemaphoreGive(pcam->mutex3);
+
   return ESP_OK;
 }
 
-esp_err_t camwebsrv_camera_frame_dispose(camwebsrv_camera_t cam)
+esp_err_t camwebsrv_camera_frame_ref(camwebsrv_camera_frame_t frame)
 {
-  _camwebsrv_camera_t *pcam;
+  _camwebsrv_camera_frame_t *pframe;
 
-  if (cam == NULL)
+  if (frame == NULL)
   {
     return ESP_ERR_INVALID_ARG;
   }
 
-  pcam = (_camwebsrv_camera_t *) cam;
+  pframe = (_camwebsrv_camera_frame_t *) frame;
+
+  xSemaphoreTake(pframe->pcam->mutex3, portMAX_DELAY);
+
+  pframe->refs++;
+
+  xSemaphoreGive(pframe->pcam->mutex3);
+
+  return ESP_OK;
+}
 
-  // do we hold the lock?
+esp_err_t camwebsrv_camera_frame_dispose(camwebsrv_camera_frame_t *frame)
+{
+  _camwebsrv_camera_frame_t *pframe;
 
-  if (xSemaphoreGetMutexHolder(pcam->mutex2) != xTaskGetCurrentTaskHandle())
+  if (frame == NULL || *frame == NULL)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_frame_dispose(): frame not held");
-    return ESP_FAIL;
+    return ESP_ERR_INVALID_ARG;
   }
 
-  // unlock
+  pframe = (_camwebsrv_camera_frame_t *) *frame;
 
-  xSemaphoreGive(pcam->mutex2);
+  xSemaphoreTake(pframe->pcam->mutex3, portMAX_DELAY);
+
+  _camwebsrv_camera_frame_release(pframe->pcam, pframe);
+
+  xSemaphoreGive(pframe->pcam->mutex3);
+
+  *frame = NULL;
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_camera_frame_bytes(camwebsrv_camera_frame_t frame, const uint8_t **fbuf, size_t *flen)
+{
+  _camwebsrv_camera_frame_t *pframe;
+
+  if (frame == NULL || fbuf == NULL || flen == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  pframe = (_camwebsrv_camera_frame_t *) frame;
+
+  *fbuf = pframe->buf;
+  *flen = pframe->len;
+
+  return ESP_OK;
+}
+
+int64_t camwebsrv_camera_frame_tstamp(camwebsrv_camera_frame_t frame)
+{
+  if (frame == NULL)
+  {
+    return -1;
+  }
+
+  return ((_camwebsrv_camera_frame_t *) frame)->tstamp;
+}
+
+uint32_t camwebsrv_camera_frame_seq(camwebsrv_camera_frame_t frame)
+{
+  if (frame == NULL)
+  {
+    return 0;
+  }
+
+  return ((_camwebsrv_camera_frame_t *) frame)->seq;
+}
+
+esp_err_t camwebsrv_camera_frame_mtime(camwebsrv_camera_frame_t frame, char *buf, size_t len)
+{
+  struct tm tm;
+  time_t t;
+
+  if (frame == NULL || buf == NULL || len == 0)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // capture times are on the boot clock, so work back from the wall clock by
+  // the frame's age
+
+  t = time(NULL) - (time_t) ((esp_timer_get_time() - ((_camwebsrv_camera_frame_t *) frame)->tstamp) / 1000000);
+
+  if (gmtime_r(&t, &tm) == NULL || strftime(buf, len, "%a, %d %b %Y %H:%M:%S GMT", &tm) == 0)
+  {
+    return ESP_FAIL;
+  }
 
   return ESP_OK;
 }
 
+size_t camwebsrv_camera_frame_avgsize(camwebsrv_camera_t cam)
+{
+  if (cam == NULL)
+  {
+    return 0;
+  }
+
+  return ((_camwebsrv_camera_t *) cam)->favg;
+}
+
+int64_t camwebsrv_camera_frame_latency(camwebsrv_camera_t cam)
+{
+  if (cam == NULL)
+  {
+    return 0;
+  }
+
+  return ((_camwebsrv_camera_t *) cam)->lavg;
+}
+
 esp_err_t camwebsrv_camera_ctrl_set(camwebsrv_camera_t cam, const char *name, int value)
 {
+  const _camwebsrv_camera_ctrl_t *ctrl;
   sensor_t *sensor = NULL;
   _camwebsrv_camera_t *pcam;
+  esp_err_t rv;
 
   if (cam == NULL || name == NULL)
   {
@@ -350,6 +856,15 @@ esp_err_t camwebsrv_camera_ctrl_set(camwebsrv_camera_t cam, const char *name, in
 
   pcam = (_camwebsrv_camera_t *) cam;
 
+  // look it up
+
+  rv = _camwebsrv_camera_ctrl_lookup(pcam, name, value, &ctrl);
+
+  if (rv != ESP_OK)
+  {
+    return rv;
+  }
+
   // lock
 
   if (xSemaphoreTake(pcam->mutex1, portMAX_DELAY) != pdTRUE)
@@ -371,258 +886,155 @@ esp_err_t camwebsrv_camera_ctrl_set(camwebsrv_camera_t cam, const char *name, in
 
   // set stuff
 
-  if (strcmp(name, "aec") == 0)
+  if (ctrl->set(pcam, sensor, value))
   {
-    if (sensor->set_exposure_ctrl(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_exposure_ctrl() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): setter failed", name, value);
+    xSemaphoreGive(pcam->mutex1);
+    return ESP_FAIL;
   }
-  else if (strcmp(name, "aec2") == 0)
-  {
-    if (sensor->set_aec2(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_aec2() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "aec_value") == 0)
-  {
-    if (sensor->set_aec_value(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.aec_value() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "ae_level") == 0)
-  {
-    if (sensor->set_ae_level(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.ae_level() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "agc") == 0)
-  {
-    if (sensor->set_gain_ctrl(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_gain_ctrl() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "agc_gain") == 0)
-  {
-    if (sensor->set_agc_gain(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.agc_gain() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "awb") == 0)
+
+  ESP_LOGI(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d)", name, value);
+
+  // anyone holding on to a status snapshot now has a stale one
+
+  pcam->version++;
+
+  xSemaphoreGive(pcam->mutex1);
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_camera_ctrl_queue(camwebsrv_camera_t cam, camwebsrv_camera_ctrl_change_t *changes, size_t count, uint32_t *batch)
+{
+  const _camwebsrv_camera_ctrl_t *ctrl;
+  _camwebsrv_camera_t *pcam;
+  esp_err_t rv;
+  size_t i;
+
+  if (cam == NULL || changes == NULL || count == 0 || batch == NULL)
   {
-    if (sensor->set_whitebal(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_whitebal() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
+    return ESP_ERR_INVALID_ARG;
   }
-  else if (strcmp(name, "awb_gain") == 0)
+
+  pcam = (_camwebsrv_camera_t *) cam;
+
+  // check all of them before queueing any, so that a bad request changes
+  // nothing
+
+  for (i = 0; i < count; i++)
   {
-    if (sensor->set_awb_gain(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.awb_gain() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
+    rv = _camwebsrv_camera_ctrl_lookup(pcam, changes[i].name, changes[i].value, &ctrl);
+
+    if (rv != ESP_OK)
+    {
+      return rv;
+    }
+
+    changes[i].id = (camwebsrv_camera_ctrl_t) (ctrl - _camwebsrv_camera_ctrls);
+    changes[i].applied = false;
   }
-  else if (strcmp(name, "bpc") == 0)
+
+  // lock
+
+  if (xSemaphoreTake(pcam->mutex1, portMAX_DELAY) != pdTRUE)
   {
-    if (sensor->set_bpc(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_bpc() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_queue(): xSemaphoreTake() failed");
+    return ESP_FAIL;
   }
-  else if (strcmp(name, "brightness") == 0)
+
+  // join the batch that's still waiting, if there is one; only the latest
+  // value for each control is kept
+
+  if (pcam->pmask == 0)
   {
-    if (sensor->set_brightness(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_brightness() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
+    pcam->pbatch++;
   }
-  else if (strcmp(name, "colorbar") == 0)
+
+  for (i = 0; i < count; i++)
   {
-    if (sensor->set_colorbar(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_colorbal() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
+    pcam->pvalues[changes[i].id] = changes[i].value;
+    pcam->pmask |= (1UL << changes[i].id);
   }
-  else if (strcmp(name, "contrast") == 0)
+
+  *batch = pcam->pbatch;
+
+  xSemaphoreGive(pcam->mutex1);
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_camera_ctrl_commit(camwebsrv_camera_t cam, uint32_t batch, camwebsrv_camera_ctrl_change_t *changes, size_t count, uint32_t *seq)
+{
+  _camwebsrv_camera_t *pcam;
+  int64_t interval;
+  int64_t deadline;
+  int64_t wait;
+  int64_t now;
+  TickType_t ticks;
+  size_t i;
+
+  if (cam == NULL || (changes == NULL && count > 0))
   {
-    if (sensor->set_contrast(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_contrast() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
+    return ESP_ERR_INVALID_ARG;
   }
-  else if (strcmp(name, "dcw") == 0)
+
+  pcam = (_camwebsrv_camera_t *) cam;
+
+  // only the producer applies batches, between two frames, and it raises an
+  // event when it has; give it a couple of frame intervals, but no more than
+  // the wait limit, before telling the caller it's still pending
+
+  interval = 1000000 / pcam->fps;
+  wait = interval * 2;
+  wait = (wait < (CAMWEBSRV_CAMERA_CTRL_WAIT_MSEC * 1000)) ? wait : (CAMWEBSRV_CAMERA_CTRL_WAIT_MSEC * 1000);
+  deadline = esp_timer_get_time() + wait;
+
+  while(true)
   {
-    if (sensor->set_dcw(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_dcw() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
+    if (xSemaphoreTake(pcam->mutex1, portMAX_DELAY) != pdTRUE)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_commit(): xSemaphoreTake() failed");
       return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "flash") == 0)
-  {
-    pcam->flash = value != 0;
+    }
 
-    if (gpio_set_level(CAMWEBSRV_PIN_FLASH, pcam->flash) != ESP_OK)
+    if ((int32_t) (pcam->abatch - batch) >= 0)
     {
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): gpio_set_level() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
+      break;
     }
-  }
-  else if (strcmp(name, "fps") == 0)
-  {
-    pcam->fps = (value < CAMWEBSRV_CAMERA_FPS_MIN ? CAMWEBSRV_CAMERA_FPS_MIN : (value > CAMWEBSRV_CAMERA_FPS_MAX ? CAMWEBSRV_CAMERA_FPS_MAX : value));
-  }
-  else if (strcmp(name, "framesize") == 0)
-  {
-    if (sensor->pixformat == PIXFORMAT_JPEG)
+
+    // clear the event while holding the lock, so that a batch applied after
+    // we've looked still wakes us up
+
+    xEventGroupClearBits(pcam->events, _CAMWEBSRV_CAMERA_EVENT_CTRL);
+
+    xSemaphoreGive(pcam->mutex1);
+
+    now = esp_timer_get_time();
+
+    if (now >= deadline)
     {
-      if (sensor->set_framesize(sensor, (framesize_t) value))
-      {
-        ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_framesize() failed", name, value);
-        xSemaphoreGive(pcam->mutex1);
-        return ESP_FAIL;
-      }
+      return ESP_ERR_TIMEOUT;
     }
+
+    ticks = pdMS_TO_TICKS((deadline - now) / 1000);
+
+    xEventGroupWaitBits(pcam->events, _CAMWEBSRV_CAMERA_EVENT_CTRL, pdFALSE, pdTRUE, (ticks > 0) ? ticks : 1);
   }
-  else if (strcmp(name, "gainceiling") == 0)
-  {
-    if (sensor->set_gainceiling(sensor, (gainceiling_t) value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_gainceiling() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "hmirror") == 0)
-  {
-    if (sensor->set_hmirror(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_hmirror() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "lenc") == 0)
-  {
-    if (sensor->set_lenc(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_lenc() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "quality") == 0)
-  {
-    if (sensor->set_quality(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_quality() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "raw_gma") == 0)
-  {
-    if (sensor->set_raw_gma(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_raw_gma() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "saturation") == 0)
-  {
-    if (sensor->set_saturation(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_saturation() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "sharpness") == 0)
-  {
-    if (sensor->set_sharpness(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_sharpness() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "special_effect") == 0)
-  {
-    if (sensor->set_special_effect(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_special_effect() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "vflip") == 0)
-  {
-    if (sensor->set_vflip(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_vflip() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "wb_mode") == 0)
-  {
-    if (sensor->set_wb_mode(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_wb_mode() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
-  }
-  else if (strcmp(name, "wpc") == 0)
+
+  // a later batch may have changed the same control again; report what the
+  // control was last set to
+
+  for (i = 0; i < count; i++)
   {
-    if (sensor->set_wpc(sensor, value))
-    { 
-      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d): sensor.set_wpc() failed", name, value);
-      xSemaphoreGive(pcam->mutex1);
-      return ESP_FAIL;
-    } 
+    changes[i].value = pcam->avalues[changes[i].id];
+    changes[i].applied = (pcam->amask & (1UL << changes[i].id)) != 0;
   }
-  else
+
+  if (seq != NULL)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\"): failed; invalid parameter", name);
-    xSemaphoreGive(pcam->mutex1);
-    return ESP_ERR_INVALID_ARG;
+    *seq = pcam->aseq;
   }
 
-  ESP_LOGI(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_set(\"%s\", %d)", name, value);
-
   xSemaphoreGive(pcam->mutex1);
 
   return ESP_OK;
@@ -630,6 +1042,7 @@ esp_err_t camwebsrv_camera_ctrl_set(camwebsrv_camera_t cam, const char *name, in
 
 int camwebsrv_camera_ctrl_get(camwebsrv_camera_t cam, const char *name)
 {
+  const _camwebsrv_camera_ctrl_t *ctrl;
   sensor_t *sensor = NULL;
   _camwebsrv_camera_t *pcam;
   int rv;
@@ -641,6 +1054,16 @@ int camwebsrv_camera_ctrl_get(camwebsrv_camera_t cam, const char *name)
 
   pcam = (_camwebsrv_camera_t *) cam;
 
+  // look it up
+
+  ctrl = (const _camwebsrv_camera_ctrl_t *) bsearch(name, _camwebsrv_camera_ctrls, CAMWEBSRV_CAMERA_CTRL_COUNT, sizeof(_camwebsrv_camera_ctrl_t), _camwebsrv_camera_ctrl_cmp);
+
+  if (ctrl == NULL)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_get(\"%s\"): failed; invalid parameter", name);
+    return -1;
+  }
+
   // lock
 
   if (xSemaphoreTake(pcam->mutex1, portMAX_DELAY) != pdTRUE)
@@ -662,123 +1085,101 @@ int camwebsrv_camera_ctrl_get(camwebsrv_camera_t cam, const char *name)
 
   // get stuff
 
-  if (strcmp(name, "aec") == 0)
-  {
-    rv = sensor->status.aec;
-  }
-  else if (strcmp(name, "aec2") == 0)
-  {
-    rv = sensor->status.aec2;
-  }
-  else if (strcmp(name, "aec_value") == 0)
-  {
-    rv = sensor->status.aec_value;
-  }
-  else if (strcmp(name, "ae_level") == 0)
-  {
-    rv = sensor->status.ae_level;
-  }
-  else if (strcmp(name, "agc") == 0)
-  {
-    rv = sensor->status.agc;
-  }
-  else if (strcmp(name, "agc_gain") == 0)
-  {
-    rv = sensor->status.agc_gain;
-  }
-  else if (strcmp(name, "awb") == 0)
-  {
-    rv = sensor->status.awb;
-  }
-  else if (strcmp(name, "awb_gain") == 0)
-  {
-    rv = sensor->status.awb_gain;
-  }
-  else if (strcmp(name, "bpc") == 0)
-  {
-    rv = sensor->status.bpc;
-  }
-  else if (strcmp(name, "brightness") == 0)
-  {
-    rv = sensor->status.brightness;
-  }
-  else if (strcmp(name, "colorbar") == 0)
-  {
-    rv = sensor->status.colorbar;
-  }
-  else if (strcmp(name, "contrast") == 0)
-  {
-    rv = sensor->status.contrast;
-  }
-  else if (strcmp(name, "dcw") == 0)
-  {
-    rv = sensor->status.dcw;
-  }
-  else if (strcmp(name, "flash") == 0)
-  {
-    rv = pcam->flash;
-  }
-  else if (strcmp(name, "fps") == 0)
-  {
-    rv = pcam->fps;
-  }
-  else if (strcmp(name, "framesize") == 0)
-  {
-    rv = sensor->status.framesize;
-  }
-  else if (strcmp(name, "gainceiling") == 0)
-  {
-    rv = sensor->status.gainceiling;
-  }
-  else if (strcmp(name, "hmirror") == 0)
-  {
-    rv = sensor->status.hmirror;
-  }
-  else if (strcmp(name, "lenc") == 0)
-  {
-    rv = sensor->status.lenc;
-  }
-  else if (strcmp(name, "quality") == 0)
-  {
-    rv = sensor->status.quality;
-  }
-  else if (strcmp(name, "raw_gma") == 0)
-  {
-    rv = sensor->status.raw_gma;
-  }
-  else if (strcmp(name, "saturation") == 0)
-  {
-    rv = sensor->status.saturation;
-  }
-  else if (strcmp(name, "sharpness") == 0)
-  {
-    rv = sensor->status.sharpness;
-  }
-  else if (strcmp(name, "special_effect") == 0)
+  rv = ctrl->get(pcam, sensor);
+
+  xSemaphoreGive(pcam->mutex1);
+
+  return rv;
+}
+
+esp_err_t camwebsrv_camera_ctrl_info(camwebsrv_camera_t cam, camwebsrv_camera_ctrl_t id, camwebsrv_camera_ctrl_info_t *info)
+{
+  const _camwebsrv_camera_ctrl_t *ctrl;
+  uint8_t s;
+
+  if (cam == NULL || id < 0 || id >= CAMWEBSRV_CAMERA_CTRL_COUNT || info == NULL)
   {
-    rv = sensor->status.special_effect;
+    return ESP_ERR_INVALID_ARG;
   }
-  else if (strcmp(name, "vflip") == 0)
+
+  ctrl = &(_camwebsrv_camera_ctrls[id]);
+  s = ((_camwebsrv_camera_t *) cam)->ov3660 ? 1 : 0;
+
+  info->name = ctrl->name;
+  info->min = ctrl->range[s][0];
+  info->max = ctrl->range[s][1];
+  info->supported = (ctrl->sensors & (1 << s)) != 0;
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_camera_status_get(camwebsrv_camera_t cam, camwebsrv_camera_status_t *status, uint32_t *version)
+{
+  sensor_t *sensor = NULL;
+  _camwebsrv_camera_t *pcam;
+  uint8_t s;
+  int i;
+
+  if (cam == NULL || status == NULL)
   {
-    rv = sensor->status.vflip;
+    return ESP_ERR_INVALID_ARG;
   }
-  else if (strcmp(name, "wb_mode") == 0)
+
+  pcam = (_camwebsrv_camera_t *) cam;
+  s = pcam->ov3660 ? 1 : 0;
+
+  // lock
+
+  if (xSemaphoreTake(pcam->mutex1, portMAX_DELAY) != pdTRUE)
   {
-    rv = sensor->status.wb_mode;
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_status_get(): xSemaphoreTake() failed");
+    return ESP_FAIL;
   }
-  else if (strcmp(name, "wpc") == 0)
+
+  // the sensor's status only changes when we set something, so only re-read
+  // it if something has been set since the last time
+
+  if (pcam->sversion != pcam->version)
   {
-    rv = sensor->status.wpc;
+    sensor = esp_camera_sensor_get();
+
+    if (sensor == NULL)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_status_get(): esp_camera_sensor_get() failed");
+      xSemaphoreGive(pcam->mutex1);
+      return ESP_FAIL;
+    }
+
+    for (i = 0; i < CAMWEBSRV_CAMERA_CTRL_COUNT; i++)
+    {
+      const _camwebsrv_camera_ctrl_t *ctrl = &(_camwebsrv_camera_ctrls[i]);
+
+      pcam->status.values[i] = (ctrl->sensors & (1 << s)) ? ctrl->get(pcam, sensor) : 0;
+    }
+
+    pcam->sversion = pcam->version;
   }
-  else
+
+  memcpy(status, &(pcam->status), sizeof(camwebsrv_camera_status_t));
+
+  if (version != NULL)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "CAM camwebsrv_camera_ctrl_get(\"%s\"): failed; invalid parameter", name);
-    rv = -1;
+    *version = pcam->sversion;
   }
 
   xSemaphoreGive(pcam->mutex1);
 
-  return rv;
+  return ESP_OK;
+}
+
+uint32_t camwebsrv_camera_status_version(camwebsrv_camera_t cam)
+{
+  if (cam == NULL)
+  {
+    return 0;
+  }
+
+  return ((_camwebsrv_camera_t *) cam)->version;
 }
 
 bool camwebsrv_camera_is_ov3660(camwebsrv_camera_t cam)
@@ -843,8 +1244,8 @@ static esp_err_t _camwebsrv_camera_init(_camwebsrv_camera_t *pcam)
   config.frame_size = FRAMESIZE_UXGA;
 
   config.jpeg_quality = 10;
-  config.fb_count = 1;
-  config.grab_mode = CAMERA_GRAB_WHEN_EMPTY;
+  config.fb_count = CAMWEBSRV_CAMERA_FB_COUNT;
+  config.grab_mode = CAMERA_GRAB_LATEST;
 
   rv = esp_camera_init(&config);
 
@@ -890,6 +1291,16 @@ static esp_err_t _camwebsrv_camera_init(_camwebsrv_camera_t *pcam)
     return ESP_FAIL;
   }
 
+  pcam->favg = 0;
+
+  // the first few frames off a freshly initialised sensor are no good
+
+  pcam->skip = CAMWEBSRV_CAMERA_INITIAL_FRAME_SKIP;
+
+  // everything is back to defaults, so any status snapshot is stale
+
+  pcam->version++;
+
   // set fps
 
   pcam->fps = CAMWEBSRV_CAMERA_DEFAULT_FPS;
@@ -906,3 +1317,374 @@ static esp_err_t _camwebsrv_camera_init(_camwebsrv_camera_t *pcam)
 
   return ESP_OK;
 }
+
+static void _camwebsrv_camera_task(void *arg)
+{
+  _camwebsrv_camera_t *pcam;
+  int64_t wait;
+  esp_err_t rv;
+
+  pcam = (_camwebsrv_camera_t *) arg;
+
+  while(!pcam->stop)
+  {
+    // sleep until the next frame is due, or until someone wants one sooner
+
+    wait = (pcam->tstamp < 0) ? 0 : ((pcam->tstamp + (1000000 / pcam->fps)) - esp_timer_get_time());
+
+    if (wait > 0)
+    {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait / 1000));
+    }
+
+    if (pcam->stop)
+    {
+      break;
+    }
+
+    rv = _camwebsrv_camera_produce(pcam);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "CAM _camwebsrv_camera_task(): _camwebsrv_camera_produce() failed: [%d]: %s", rv, esp_err_to_name(rv));
+      vTaskDelay(pdMS_TO_TICKS(CAMWEBSRV_MAIN_MIN_CYCLE_MSEC));
+    }
+  }
+
+  // let whoever stopped us know we're done
+
+  xSemaphoreGive(pcam->done);
+
+  vTaskDelete(NULL);
+}
+
+static esp_err_t _camwebsrv_camera_produce(_camwebsrv_camera_t *pcam)
+{
+  _camwebsrv_camera_frame_t *pframe;
+  camera_fb_t *fb = NULL;
+  sensor_t *sensor = NULL;
+  int64_t tcapture;
+  int64_t now;
+
+  // lock; reset holds this while the driver is re-initialised
+
+  if (xSemaphoreTake(pcam->mutex2, portMAX_DELAY) != pdTRUE)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM _camwebsrv_camera_produce(): xSemaphoreTake() failed");
+    return ESP_FAIL;
+  }
+
+  // get sensor
+
+  sensor = esp_camera_sensor_get();
+
+  if (sensor == NULL)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM _camwebsrv_camera_produce(): esp_camera_sensor_get() failed");
+    xSemaphoreGive(pcam->mutex2);
+    return ESP_FAIL;
+  }
+
+  // the driver keeps capturing into its spare buffers, so this is the newest
+  // frame it has
+
+  fb = esp_camera_fb_get();
+
+  if (fb == NULL)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM _camwebsrv_camera_produce(): esp_camera_fb_get() failed");
+    xSemaphoreGive(pcam->mutex2);
+    return ESP_FAIL;
+  }
+
+  if (pcam->skip > 0)
+  {
+    pcam->skip--;
+    esp_camera_fb_return(fb);
+    xSemaphoreGive(pcam->mutex2);
+    return ESP_OK;
+  }
+
+  // get a free frame from the pool; if there are none, all frames are still
+  // being read, so keep the current one for another interval
+
+  pframe = _camwebsrv_camera_frame_alloc(pcam);
+
+  if (pframe == NULL)
+  {
+    ESP_LOGD(CAMWEBSRV_TAG, "CAM _camwebsrv_camera_produce(): frame pool exhausted; keeping frame %u", pcam->seq);
+    esp_camera_fb_return(fb);
+    pcam->tstamp = esp_timer_get_time();
+    xSemaphoreGive(pcam->mutex2);
+    return ESP_OK;
+  }
+
+  // copy into the pooled frame, growing its buffer if needed, so that the
+  // driver's frame buffer can be given back straight away
+
+  if (pframe->size < fb->len)
+  {
+    uint8_t *tmp;
+
+    tmp = (uint8_t *) realloc(pframe->buf, fb->len);
+
+    if (tmp == NULL)
+    {
+      int e = errno;
+      ESP_LOGE(CAMWEBSRV_TAG, "CAM _camwebsrv_camera_produce(): realloc(%u) failed: [%d]: %s", fb->len, e, strerror(e));
+      esp_camera_fb_return(fb);
+      xSemaphoreGive(pcam->mutex2);
+      return ESP_FAIL;
+    }
+
+    pframe->buf = tmp;
+    pframe->size = fb->len;
+  }
+
+  memcpy(pframe->buf, fb->buf, fb->len);
+
+  // the driver stamps the frame from the same clock when it finishes
+  // capturing it
+
+  tcapture = ((int64_t) fb->timestamp.tv_sec * 1000000) + fb->timestamp.tv_usec;
+
+  pframe->len = fb->len;
+  pframe->tstamp = tcapture;
+
+  // running average of the frame size at the current framesize
+
+  pcam->favg = (pcam->favg == 0) ? fb->len : ((pcam->favg * 7) + fb->len) / 8;
+
+  // apply queued control changes between frames; if the settings lock is
+  // busy, the next frame will do it
+
+  if (pcam->pmask != 0 && xSemaphoreTake(pcam->mutex1, 0) == pdTRUE)
+  {
+    _camwebsrv_camera_ctrl_apply(pcam, sensor);
+    xSemaphoreGive(pcam->mutex1);
+  }
+
+  esp_camera_fb_return(fb);
+
+  // make it the current frame
+
+  _camwebsrv_camera_frame_publish(pcam, pframe);
+
+  // running average of how long frames take from capture to publish
+
+  now = esp_timer_get_time();
+
+  pcam->lavg = (pcam->lavg == 0) ? (now - tcapture) : ((pcam->lavg * 7) + (now - tcapture)) / 8;
+  pcam->tstamp = now;
+
+  xSemaphoreGive(pcam->mutex2);
+
+  return ESP_OK;
+}
+
+static _camwebsrv_camera_frame_t *_camwebsrv_camera_frame_alloc(_camwebsrv_camera_t *pcam)
+{
+  _camwebsrv_camera_frame_t *pframe = NULL;
+  uint8_t i;
+
+  // a frame is free if nobody, including the camera itself, holds a reference
+
+  xSemaphoreTake(pcam->mutex3, portMAX_DELAY);
+
+  for (i = 0; i < CAMWEBSRV_CAMERA_FRAME_POOL_SIZE; i++)
+  {
+    if (pcam->pool[i].refs == 0)
+    {
+      pframe = &(pcam->pool[i]);
+      break;
+    }
+  }
+
+  xSemaphoreGive(pcam->mutex3);
+
+  return pframe;
+}
+
+static void _camwebsrv_camera_frame_publish(_camwebsrv_camera_t *pcam, _camwebsrv_camera_frame_t *pframe)
+{
+  _camwebsrv_camera_sub_t subs[CAMWEBSRV_CAMERA_SUBSCRIBERS];
+  uint8_t i;
+
+  xSemaphoreTake(pcam->mutex3, portMAX_DELAY);
+
+  // the camera holds one reference to the current frame
+
+  pframe->refs = 1;
+  pframe->seq = ++(pcam->seq);
+
+  if (pcam->frame != NULL)
+  {
+    _camwebsrv_camera_frame_release(pcam, pcam->frame);
+  }
+
+  pcam->frame = pframe;
+
+  // wake up anyone waiting for a fresh one
+
+  xEventGroupSetBits(pcam->events, _CAMWEBSRV_CAMERA_EVENT_FRAME);
+
+  memcpy(subs, pcam->subs, sizeof(subs));
+
+  xSemaphoreGive(pcam->mutex3);
+
+  // and anyone who asked to be told, outside the lock
+
+  for (i = 0; i < CAMWEBSRV_CAMERA_SUBSCRIBERS; i++)
+  {
+    if (subs[i].cb != NULL)
+    {
+      subs[i].cb(subs[i].arg);
+    }
+  }
+}
+
+static void _camwebsrv_camera_frame_release(_camwebsrv_camera_t *pcam, _camwebsrv_camera_frame_t *pframe)
+{
+  // caller must hold mutex3; once refs drops to zero, the frame goes back to
+  // the pool, but its buffer is kept for the next grab
+
+  if (pframe->refs == 0)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM _camwebsrv_camera_frame_release(): frame %u has no references", pframe->seq);
+    return;
+  }
+
+  pframe->refs--;
+}
+
+static int _camwebsrv_camera_ctrl_get_flash(_camwebsrv_camera_t *pcam, sensor_t *sensor)
+{
+  return pcam->flash;
+}
+
+static int _camwebsrv_camera_ctrl_set_flash(_camwebsrv_camera_t *pcam, sensor_t *sensor, int value)
+{
+  pcam->flash = value != 0;
+
+  return gpio_set_level(CAMWEBSRV_PIN_FLASH, pcam->flash) != ESP_OK;
+}
+
+static int _camwebsrv_camera_ctrl_get_fps(_camwebsrv_camera_t *pcam, sensor_t *sensor)
+{
+  return pcam->fps;
+}
+
+static int _camwebsrv_camera_ctrl_set_fps(_camwebsrv_camera_t *pcam, sensor_t *sensor, int value)
+{
+  pcam->fps = value;
+
+  return 0;
+}
+
+static int _camwebsrv_camera_ctrl_get_framesize(_camwebsrv_camera_t *pcam, sensor_t *sensor)
+{
+  return sensor->status.framesize;
+}
+
+static int _camwebsrv_camera_ctrl_set_framesize(_camwebsrv_camera_t *pcam, sensor_t *sensor, int value)
+{
+  if (sensor->pixformat != PIXFORMAT_JPEG)
+  {
+    return 0;
+  }
+
+  if (sensor->set_framesize(sensor, (framesize_t) value))
+  {
+    return -1;
+  }
+
+  // frame sizes from before are no use for guessing sizes from now on
+
+  pcam->favg = 0;
+
+  return 0;
+}
+
+static int _camwebsrv_camera_ctrl_cmp(const void *key, const void *elem)
+{
+  return strcmp((const char *) key, ((const _camwebsrv_camera_ctrl_t *) elem)->name);
+}
+
+static esp_err_t _camwebsrv_camera_ctrl_lookup(_camwebsrv_camera_t *pcam, const char *name, int value, const _camwebsrv_camera_ctrl_t **ctrl)
+{
+  const _camwebsrv_camera_ctrl_t *pctrl;
+  uint8_t s;
+
+  if (name == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  pctrl = (const _camwebsrv_camera_ctrl_t *) bsearch(name, _camwebsrv_camera_ctrls, CAMWEBSRV_CAMERA_CTRL_COUNT, sizeof(_camwebsrv_camera_ctrl_t), _camwebsrv_camera_ctrl_cmp);
+
+  if (pctrl == NULL)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM _camwebsrv_camera_ctrl_lookup(\"%s\"): failed; invalid parameter", name);
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  s = pcam->ov3660 ? 1 : 0;
+
+  if (!(pctrl->sensors & (1 << s)))
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM _camwebsrv_camera_ctrl_lookup(\"%s\"): failed; not supported by this sensor", name);
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+
+  if (value < pctrl->range[s][0] || value > pctrl->range[s][1])
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "CAM _camwebsrv_camera_ctrl_lookup(\"%s\", %d): failed; out of range [%d, %d]", name, value, pctrl->range[s][0], pctrl->range[s][1]);
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  *ctrl = pctrl;
+
+  return ESP_OK;
+}
+
+static void _camwebsrv_camera_ctrl_apply(_camwebsrv_camera_t *pcam, sensor_t *sensor)
+{
+  uint32_t bit;
+  int i;
+
+  // caller is the producer, holding both mutex1 and mutex2
+
+  for (i = 0; i < CAMWEBSRV_CAMERA_CTRL_COUNT; i++)
+  {
+    bit = 1UL << i;
+
+    if (!(pcam->pmask & bit))
+    {
+      continue;
+    }
+
+    pcam->avalues[i] = pcam->pvalues[i];
+
+    if (_camwebsrv_camera_ctrls[i].set(pcam, sensor, pcam->pvalues[i]))
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "CAM _camwebsrv_camera_ctrl_apply(\"%s\", %d): setter failed", _camwebsrv_camera_ctrls[i].name, pcam->pvalues[i]);
+      pcam->amask &= ~bit;
+      continue;
+    }
+
+    pcam->amask |= bit;
+  }
+
+  // the frame being published now, and whatever the driver already has in
+  // its other buffers, were captured before this
+
+  pcam->pmask = 0;
+  pcam->abatch = pcam->pbatch;
+  pcam->aseq = pcam->seq + 1 + CAMWEBSRV_CAMERA_FB_COUNT;
+
+  pcam->version++;
+
+  xEventGroupSetBits(pcam->events, _CAMWEBSRV_CAMERA_EVENT_CTRL);
+
+  ESP_LOGI(CAMWEBSRV_TAG, "CAM _camwebsrv_camera_ctrl_apply(): applied batch %u from frame %u", pcam->abatch, pcam->aseq);
+}
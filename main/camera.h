@@ -11,15 +11,96 @@
 
 #include <esp_err.h>
 
+// long enough for an HTTP date
+
+#define CAMWEBSRV_CAMERA_MTIME_LEN 32
+
 typedef void *camwebsrv_camera_t;
+typedef void *camwebsrv_camera_frame_t;
+
+// called by the producer task, right after a frame is published
+
+typedef void (*camwebsrv_camera_cb_t)(void *);
+
+// control ids, in the order strcmp() sorts their names
+
+typedef enum
+{
+  CAMWEBSRV_CAMERA_CTRL_AE_LEVEL = 0,
+  CAMWEBSRV_CAMERA_CTRL_AEC,
+  CAMWEBSRV_CAMERA_CTRL_AEC2,
+  CAMWEBSRV_CAMERA_CTRL_AEC_VALUE,
+  CAMWEBSRV_CAMERA_CTRL_AGC,
+  CAMWEBSRV_CAMERA_CTRL_AGC_GAIN,
+  CAMWEBSRV_CAMERA_CTRL_AWB,
+  CAMWEBSRV_CAMERA_CTRL_AWB_GAIN,
+  CAMWEBSRV_CAMERA_CTRL_BPC,
+  CAMWEBSRV_CAMERA_CTRL_BRIGHTNESS,
+  CAMWEBSRV_CAMERA_CTRL_COLORBAR,
+  CAMWEBSRV_CAMERA_CTRL_CONTRAST,
+  CAMWEBSRV_CAMERA_CTRL_DCW,
+  CAMWEBSRV_CAMERA_CTRL_DENOISE,
+  CAMWEBSRV_CAMERA_CTRL_FLASH,
+  CAMWEBSRV_CAMERA_CTRL_FPS,
+  CAMWEBSRV_CAMERA_CTRL_FRAMESIZE,
+  CAMWEBSRV_CAMERA_CTRL_GAINCEILING,
+  CAMWEBSRV_CAMERA_CTRL_HMIRROR,
+  CAMWEBSRV_CAMERA_CTRL_LENC,
+  CAMWEBSRV_CAMERA_CTRL_QUALITY,
+  CAMWEBSRV_CAMERA_CTRL_RAW_GMA,
+  CAMWEBSRV_CAMERA_CTRL_SATURATION,
+  CAMWEBSRV_CAMERA_CTRL_SHARPNESS,
+  CAMWEBSRV_CAMERA_CTRL_SPECIAL_EFFECT,
+  CAMWEBSRV_CAMERA_CTRL_VFLIP,
+  CAMWEBSRV_CAMERA_CTRL_WB_MODE,
+  CAMWEBSRV_CAMERA_CTRL_WPC,
+  CAMWEBSRV_CAMERA_CTRL_COUNT
+} camwebsrv_camera_ctrl_t;
+
+typedef struct
+{
+  const char *name;
+  int min;
+  int max;
+  bool supported;
+} camwebsrv_camera_ctrl_info_t;
+
+typedef struct
+{
+  const char *name;
+  int value;
+  camwebsrv_camera_ctrl_t id;
+  bool applied;
+} camwebsrv_camera_ctrl_change_t;
+
+typedef struct
+{
+  int values[CAMWEBSRV_CAMERA_CTRL_COUNT];
+} camwebsrv_camera_status_t;
 
 esp_err_t camwebsrv_camera_init(camwebsrv_camera_t *cam);
 esp_err_t camwebsrv_camera_destroy(camwebsrv_camera_t *cam);
+esp_err_t camwebsrv_camera_start(camwebsrv_camera_t cam);
 esp_err_t camwebsrv_camera_reset(camwebsrv_camera_t cam);
-esp_err_t camwebsrv_camera_frame_grab(camwebsrv_camera_t cam, uint8_t **fbuf, size_t *flen, int64_t *tstamp);
-esp_err_t camwebsrv_camera_frame_dispose(camwebsrv_camera_t cam);
+esp_err_t camwebsrv_camera_subscribe(camwebsrv_camera_t cam, camwebsrv_camera_cb_t cb, void *arg);
+esp_err_t camwebsrv_camera_unsubscribe(camwebsrv_camera_t cam, camwebsrv_camera_cb_t cb, void *arg);
+esp_err_t camwebsrv_camera_frame_grab(camwebsrv_camera_t cam, int64_t maxage, camwebsrv_camera_frame_t *frame);
+esp_err_t camwebsrv_camera_frame_current(camwebsrv_camera_t cam, camwebsrv_camera_frame_t *frame);
+esp_err_t camwebsrv_camera_frame_ref(camwebsrv_camera_frame_t frame);
+esp_err_t camwebsrv_camera_frame_dispose(camwebsrv_camera_frame_t *frame);
+esp_err_t camwebsrv_camera_frame_bytes(camwebsrv_camera_frame_t frame, const uint8_t **fbuf, size_t *flen);
+int64_t camwebsrv_camera_frame_tstamp(camwebsrv_camera_frame_t frame);
+uint32_t camwebsrv_camera_frame_seq(camwebsrv_camera_frame_t frame);
+esp_err_t camwebsrv_camera_frame_mtime(camwebsrv_camera_frame_t frame, char *buf, size_t len);
+size_t camwebsrv_camera_frame_avgsize(camwebsrv_camera_t cam);
+int64_t camwebsrv_camera_frame_latency(camwebsrv_camera_t cam);
 esp_err_t camwebsrv_camera_ctrl_set(camwebsrv_camera_t cam, const char *name, int value);
 int camwebsrv_camera_ctrl_get(camwebsrv_camera_t cam, const char *name);
+esp_err_t camwebsrv_camera_ctrl_queue(camwebsrv_camera_t cam, camwebsrv_camera_ctrl_change_t *changes, size_t count, uint32_t *batch);
+esp_err_t camwebsrv_camera_ctrl_commit(camwebsrv_camera_t cam, uint32_t batch, camwebsrv_camera_ctrl_change_t *changes, size_t count, uint32_t *seq);
+esp_err_t camwebsrv_camera_ctrl_info(camwebsrv_camera_t cam, camwebsrv_camera_ctrl_t id, camwebsrv_camera_ctrl_info_t *info);
+esp_err_t camwebsrv_camera_status_get(camwebsrv_camera_t cam, camwebsrv_camera_status_t *status, uint32_t *version);
+uint32_t camwebsrv_camera_status_version(camwebsrv_camera_t cam);
 uint8_t camwebsrv_camera_fps_get(camwebsrv_camera_t cam);
 bool camwebsrv_camera_is_ov3660(camwebsrv_camera_t cam);
 
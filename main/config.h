@@ -10,23 +10,80 @@
 #define CAMWEBSRV_MAIN_REBOOT_DELAY_MSEC 10000
 #define CAMWEBSRV_MAIN_MIN_CYCLE_MSEC 10
 
+#define CAMWEBSRV_SCHED_MAX_ENTRIES 8
+
 #define CAMWEBSRV_CFGMAN_FILENAME "config.cfg"
 #define CAMWEBSRV_CFGMAN_KEY_WIFI_SSID "wifi_ssid"
 #define CAMWEBSRV_CFGMAN_KEY_WIFI_PASS "wifi_pass"
 #define CAMWEBSRV_CFGMAN_KEY_PING_HOST "ping_host"
+#define CAMWEBSRV_CFGMAN_KEY_RATECTL_BYTES "ratectl_bytes"
+#define CAMWEBSRV_CFGMAN_KEY_RATECTL_BITRATE "ratectl_bitrate"
+#define CAMWEBSRV_CFGMAN_KEY_RATECTL_FRAMESIZE "ratectl_framesize"
+#define CAMWEBSRV_CFGMAN_KEY_RTSP_PORT "rtsp_port"
+#define CAMWEBSRV_CFGMAN_KEY_MCAST_GROUP "mcast_group"
+#define CAMWEBSRV_CFGMAN_KEY_MCAST_PORT "mcast_port"
+#define CAMWEBSRV_CFGMAN_KEY_MCAST_FEC "mcast_fec"
+#define CAMWEBSRV_CFGMAN_KEY_CAPTURE_MAXAGE "capture_maxage"
 
 #define CAMWEBSRV_CAMERA_INITIAL_FRAME_SKIP 3
+#define CAMWEBSRV_CAMERA_FRAME_POOL_SIZE 8
 #define CAMWEBSRV_CAMERA_FPS_MIN 1
 #define CAMWEBSRV_CAMERA_FPS_MAX 8
 #define CAMWEBSRV_CAMERA_DEFAULT_FS 10
 #define CAMWEBSRV_CAMERA_DEFAULT_FPS 4
 #define CAMWEBSRV_CAMERA_DEFAULT_FLASH false
+#define CAMWEBSRV_CAMERA_CTRL_WAIT_MSEC 500
+#define CAMWEBSRV_CAMERA_FB_COUNT 2
+#define CAMWEBSRV_CAMERA_SUBSCRIBERS 4
+#define CAMWEBSRV_CAMERA_GRAB_TMOUT_MSEC 3000
+#define CAMWEBSRV_CAMERA_TASK_STACK 3072
+#define CAMWEBSRV_CAMERA_TASK_PRIO 6
+#define CAMWEBSRV_CAMERA_TASK_CORE 1
 
 #define CAMWEBSRV_VBYTES_BSIZE 16
 
-#define CAMWEBSRV_SCLIENTS_BSIZE 8192
-#define CAMWEBSRV_SCLIENTS_SEND_TMOUT 1000
+#define CAMWEBSRV_SCLIENTS_RBUF_SIZE 512
+#define CAMWEBSRV_SCLIENTS_JITTER_DEPTH 3
+#define CAMWEBSRV_SCLIENTS_QUANTUM_BYTES 8192
+#define CAMWEBSRV_SCLIENTS_QUANTUM_USEC 5000
 #define CAMWEBSRV_SCLIENTS_IDLE_TMOUT 3000
+#define CAMWEBSRV_SCLIENTS_SHARDS 2
+#define CAMWEBSRV_SCLIENTS_TASK_STACK 4096
+#define CAMWEBSRV_SCLIENTS_TASK_PRIO 5
+#define CAMWEBSRV_SCLIENTS_MAX_CLIENTS 6
+#define CAMWEBSRV_SCLIENTS_MEM_BUDGET 262144
+#define CAMWEBSRV_SCLIENTS_HEAP_RESERVE 32768
+#define CAMWEBSRV_SCLIENTS_RETRY_AFTER 10
+#define CAMWEBSRV_SCLIENTS_WS_WINDOW 2
+
+#define CAMWEBSRV_RATECTL_PERIOD_MSEC 2000
+#define CAMWEBSRV_RATECTL_HOLD 2
+#define CAMWEBSRV_RATECTL_HYSTERESIS_PCT 15
+#define CAMWEBSRV_RATECTL_HEADROOM_PCT 80
+#define CAMWEBSRV_RATECTL_QUALITY_MIN 10
+#define CAMWEBSRV_RATECTL_QUALITY_MAX 40
+#define CAMWEBSRV_RATECTL_QUALITY_STEP 4
+#define CAMWEBSRV_RATECTL_FRAMESIZE_MIN 5
+
+#define CAMWEBSRV_RTSP_RTP_PORT 5004
+#define CAMWEBSRV_RTSP_MAX_SESSIONS 2
+#define CAMWEBSRV_RTSP_PACKET_LEN 1400
+#define CAMWEBSRV_RTSP_REQ_LEN 1024
+#define CAMWEBSRV_RTSP_QTABLES 8
+#define CAMWEBSRV_RTSP_QTABLE_REFRESH 30
+#define CAMWEBSRV_RTSP_SESSION_TMOUT 60
+#define CAMWEBSRV_RTSP_SEND_RETRIES 3
+#define CAMWEBSRV_RTSP_POLL_MSEC 500
+#define CAMWEBSRV_RTSP_TASK_STACK 4096
+#define CAMWEBSRV_RTSP_TASK_PRIO 5
+
+#define CAMWEBSRV_MCAST_DEFAULT_PORT 5008
+#define CAMWEBSRV_MCAST_PACKET_LEN 1400
+#define CAMWEBSRV_MCAST_TTL 1
+#define CAMWEBSRV_MCAST_FEC_MAX 32
+#define CAMWEBSRV_MCAST_SEND_RETRIES 3
+#define CAMWEBSRV_MCAST_TASK_STACK 3072
+#define CAMWEBSRV_MCAST_TASK_PRIO 5
 
 #define CAMWEBSRV_PING_TIMEOUT_MAX 3
 #define CAMWEBSRV_PING_TIMEOUT_SEND 5000
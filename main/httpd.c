@@ -5,7 +5,10 @@
 #include "config.h"
 #include "httpd.h"
 #include "camera.h"
+#include "ratectl.h"
 #include "sclients.h"
+#include "rtsp.h"
+#include "mcast.h"
 #include "storage.h"
 #include "vbytes.h"
 
@@ -13,10 +16,15 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <limits.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_random.h>
 #include <esp_http_server.h>
 
 #include <freertos/FreeRTOS.h>
@@ -24,6 +32,7 @@
 
 #define _CAMWEBSRV_HTTPD_SERVER_PORT 80
 #define _CAMWEBSRV_HTTPD_CONTROL_PORT 32768
+#define _CAMWEBSRV_HTTPD_MAX_URI_HANDLERS 16
 
 #define _CAMWEBSRV_HTTPD_PATH_ROOT    "/"
 #define _CAMWEBSRV_HTTPD_PATH_STYLE   "/style.css"
@@ -31,73 +40,138 @@
 #define _CAMWEBSRV_HTTPD_PATH_STATUS  "/status"
 #define _CAMWEBSRV_HTTPD_PATH_RESET   "/reset"
 #define _CAMWEBSRV_HTTPD_PATH_CONTROL "/control"
+#define _CAMWEBSRV_HTTPD_PATH_CONTROLS "/controls"
 #define _CAMWEBSRV_HTTPD_PATH_CAPTURE "/capture"
 #define _CAMWEBSRV_HTTPD_PATH_STREAM  "/stream"
+#define _CAMWEBSRV_HTTPD_PATH_LIMITS  "/limits"
+#define _CAMWEBSRV_HTTPD_PATH_CLIENTS "/clients"
+#define _CAMWEBSRV_HTTPD_PATH_WS_STREAM "/ws/stream"
 
-#define _CAMWEBSRV_HTTPD_RESP_STATUS_STR "\
+#define _CAMWEBSRV_HTTPD_RESP_STATUS_CTRL_STR "%s\n  \"%s\": %d"
+
+#define _CAMWEBSRV_HTTPD_RESP_CHANGES_STR "\
+{\n\
+  \"batch\": %u,\n\
+  \"frame\": %u,\n\
+  \"changes\": [\
+"
+
+#define _CAMWEBSRV_HTTPD_RESP_CHANGE_STR "%s\n\
+    {\n\
+      \"name\": \"%s\",\n\
+      \"value\": %d,\n\
+      \"applied\": %s\n\
+    }\
+"
+
+#define _CAMWEBSRV_HTTPD_RESP_CONTROL_STR "%s\n\
+  {\n\
+    \"name\": \"%s\",\n\
+    \"min\": %d,\n\
+    \"max\": %d,\n\
+    \"supported\": %s\n\
+  }\
+"
+
+#define _CAMWEBSRV_HTTPD_RESP_LIMITS_STR "\
 {\n\
-  \"aec\": %u,\n\
-  \"aec2\": %u,\n\
-  \"aec_value\": %u,\n\
-  \"ae_level\": %d,\n\
-  \"agc\": %u,\n\
-  \"agc_gain\": %u,\n\
-  \"awb\": %u,\n\
-  \"awb_gain\": %u,\n\
-  \"bpc\": %u,\n\
-  \"brightness\": %d,\n\
-  \"colorbar\": %u,\n\
-  \"contrast\": %d,\n\
-  \"dcw\": %u,\n\
-  \"flash\": %d,\n\
-  \"fps\": %d,\n\
-  \"framesize\": %u,\n\
-  \"gainceiling\": %u,\n\
-  \"hmirror\": %u,\n\
-  \"lenc\": %u,\n\
-  \"quality\": %u,\n\
-  \"raw_gma\": %u,\n\
-  \"saturation\": %d,\n\
-  \"sharpness\": %d,\n\
-  \"special_effect\": %u,\n\
-  \"vflip\": %u,\n\
-  \"wb_mode\": %u,\n\
-  \"wpc\": %u\n\
+  \"clients\": %u,\n\
+  \"clients_max\": %u,\n\
+  \"frame_avg\": %u,\n\
+  \"frame_latency\": %u,\n\
+  \"heap_free\": %u,\n\
+  \"heap_reserve\": %u,\n\
+  \"mem_budget\": %u,\n\
+  \"mem_used\": %u,\n\
+  \"retry_after\": %u,\n\
+  \"sockbuf_size\": %u,\n\
+  \"sockbuf_used\": %u,\n\
+  \"sockbuf_highwater\": %u,\n\
+  \"quantum_turns\": %u,\n\
+  \"quantum_bytehits\": %u,\n\
+  \"quantum_timehits\": %u,\n\
+  \"ratectl\": %u,\n\
+  \"ratectl_average\": %u,\n\
+  \"ratectl_changes\": %u,\n\
+  \"ratectl_target\": %u\n\
 }\n \
 "
 
+#define _CAMWEBSRV_HTTPD_RESP_CLIENT_STR "%s\n\
+  {\n\
+    \"sockfd\": %d,\n\
+    \"addr\": \"%s\",\n\
+    \"shard\": %u,\n\
+    \"mode\": \"%s\",\n\
+    \"framing\": \"%s\",\n\
+    \"fps_req\": %u,\n\
+    \"fps\": %u.%02u,\n\
+    \"connected\": %u,\n\
+    \"bytes\": %llu,\n\
+    \"frames\": %u,\n\
+    \"dropped\": %u,\n\
+    \"stalls\": %u,\n\
+    \"buffered\": %u\n\
+  }\
+"
+
 #define _CAMWEBSRV_HTTPD_PARAM_LEN 32
+#define _CAMWEBSRV_HTTPD_RETRY_LEN 12
+#define _CAMWEBSRV_HTTPD_WS_MSG_LEN 16
+#define _CAMWEBSRV_HTTPD_WS_CTRL_LEN 125
+#define _CAMWEBSRV_HTTPD_WS_ACK_DIGITS 10
+#define _CAMWEBSRV_HTTPD_ETAG_LEN 24
+#define _CAMWEBSRV_HTTPD_WS_CLOSE_RETRY 1013
 
 typedef struct
 {
   httpd_handle_t handle;
-  SemaphoreHandle_t sema;
   camwebsrv_camera_t cam;
   camwebsrv_sclients_t sclients;
+  camwebsrv_ratectl_t ratectl;
+  camwebsrv_rtsp_t rtsp;
+  camwebsrv_mcast_t mcast;
+  camwebsrv_vbytes_t svb;
+  uint32_t sboot;
+  uint32_t sversion;
+  char setag[_CAMWEBSRV_HTTPD_ETAG_LEN];
+  int64_t cmaxage;
 } _camwebsrv_httpd_t;
 
 typedef struct
 {
   int sockfd;
   _camwebsrv_httpd_t *phttpd;
+  camwebsrv_sclients_params_t params;
 } _camwebsrv_httpd_worker_arg_t;
 
 static esp_err_t _camwebsrv_httpd_handler_static(httpd_req_t *req);
 static esp_err_t _camwebsrv_httpd_handler_status(httpd_req_t *req);
 static esp_err_t _camwebsrv_httpd_handler_reset(httpd_req_t *req);
 static esp_err_t _camwebsrv_httpd_handler_control(httpd_req_t *req);
+static esp_err_t _camwebsrv_httpd_handler_controls(httpd_req_t *req);
 static esp_err_t _camwebsrv_httpd_handler_capture(httpd_req_t *req);
 static esp_err_t _camwebsrv_httpd_handler_stream(httpd_req_t *req);
+static esp_err_t _camwebsrv_httpd_handler_limits(httpd_req_t *req);
+static esp_err_t _camwebsrv_httpd_handler_clients(httpd_req_t *req);
+#if CONFIG_HTTPD_WS_SUPPORT
+static esp_err_t _camwebsrv_httpd_handler_ws_stream(httpd_req_t *req);
+#endif
+static esp_err_t _camwebsrv_httpd_stream_params(httpd_req_t *req, camwebsrv_sclients_params_t *params);
+static esp_err_t _camwebsrv_httpd_status_render(_camwebsrv_httpd_t *phttpd);
+static esp_err_t _camwebsrv_httpd_parse_int(const char *str, int *value);
 static bool _camwebsrv_httpd_static_cb(const char *buf, size_t len, void *arg);
 static void _camwebsrv_httpd_worker(void *arg);
 static void _camwebsrv_httpd_noop(void *arg);
+static void _camwebsrv_httpd_close(httpd_handle_t handle, int sockfd);
 
-esp_err_t camwebsrv_httpd_init(camwebsrv_httpd_t *httpd, SemaphoreHandle_t sema)
+esp_err_t camwebsrv_httpd_init(camwebsrv_httpd_t *httpd, camwebsrv_cfgman_t cfgman)
 {
   _camwebsrv_httpd_t *phttpd;
+  const char *vstr = NULL;
   esp_err_t rv;
 
-  if (httpd == NULL || sema == NULL)
+  if (httpd == NULL || cfgman == NULL)
   {
     return ESP_ERR_INVALID_ARG;
   }
@@ -113,7 +187,30 @@ esp_err_t camwebsrv_httpd_init(camwebsrv_httpd_t *httpd, SemaphoreHandle_t sema)
 
   memset(phttpd, 0x00, sizeof(_camwebsrv_httpd_t));
 
-  phttpd->sema = sema;
+  // the camera's status version starts over on every boot, so /status tags
+  // also carry a per-boot id
+
+  phttpd->sboot = esp_random();
+
+  // how old a frame /capture may hand out; blank means the camera's frame
+  // interval
+
+  rv = camwebsrv_cfgman_get(cfgman, CAMWEBSRV_CFGMAN_KEY_CAPTURE_MAXAGE, &vstr);
+
+  if (rv == ESP_OK && vstr != NULL && strlen(vstr) > 0)
+  {
+    char *end = NULL;
+    long maxage = strtol(vstr, &end, 10);
+
+    if (end == NULL || *end != '\0' || maxage < 0)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD camwebsrv_httpd_init(): invalid %s: %s", CAMWEBSRV_CFGMAN_KEY_CAPTURE_MAXAGE, vstr);
+      free(phttpd);
+      return ESP_ERR_INVALID_ARG;
+    }
+
+    phttpd->cmaxage = (int64_t) maxage * 1000;
+  }
 
   rv = camwebsrv_camera_init(&(phttpd->cam));
 
@@ -134,6 +231,42 @@ esp_err_t camwebsrv_httpd_init(camwebsrv_httpd_t *httpd, SemaphoreHandle_t sema)
     return ESP_FAIL;
   }
 
+  rv = camwebsrv_ratectl_init(&(phttpd->ratectl), cfgman, phttpd->cam, phttpd->sclients);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD camwebsrv_httpd_init(): camwebsrv_ratectl_init() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    camwebsrv_sclients_destroy(&(phttpd->sclients), NULL);
+    camwebsrv_camera_destroy(&(phttpd->cam));
+    free(phttpd);
+    return ESP_FAIL;
+  }
+
+  rv = camwebsrv_rtsp_init(&(phttpd->rtsp), cfgman, phttpd->cam);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD camwebsrv_httpd_init(): camwebsrv_rtsp_init() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    camwebsrv_ratectl_destroy(&(phttpd->ratectl));
+    camwebsrv_sclients_destroy(&(phttpd->sclients), NULL);
+    camwebsrv_camera_destroy(&(phttpd->cam));
+    free(phttpd);
+    return ESP_FAIL;
+  }
+
+  rv = camwebsrv_mcast_init(&(phttpd->mcast), cfgman, phttpd->cam);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD camwebsrv_httpd_init(): camwebsrv_mcast_init() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    camwebsrv_rtsp_destroy(&(phttpd->rtsp));
+    camwebsrv_ratectl_destroy(&(phttpd->ratectl));
+    camwebsrv_sclients_destroy(&(phttpd->sclients), NULL);
+    camwebsrv_camera_destroy(&(phttpd->cam));
+    free(phttpd);
+    return ESP_FAIL;
+  }
+
   *httpd = (camwebsrv_httpd_t) phttpd;
 
   return ESP_OK;
@@ -151,6 +284,27 @@ esp_err_t camwebsrv_httpd_destroy(camwebsrv_httpd_t *httpd)
 
   phttpd = (_camwebsrv_httpd_t *) *httpd;
 
+  rv = camwebsrv_mcast_destroy(&(phttpd->mcast));
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD camwebsrv_httpd_destroy(): camwebsrv_mcast_destroy() failed: [%d]: %s", rv, esp_err_to_name(rv));
+  }
+
+  rv = camwebsrv_rtsp_destroy(&(phttpd->rtsp));
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD camwebsrv_httpd_destroy(): camwebsrv_rtsp_destroy() failed: [%d]: %s", rv, esp_err_to_name(rv));
+  }
+
+  rv = camwebsrv_ratectl_destroy(&(phttpd->ratectl));
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD camwebsrv_httpd_destroy(): camwebsrv_ratectl_destroy() failed: [%d]: %s", rv, esp_err_to_name(rv));
+  }
+
   rv = camwebsrv_sclients_destroy(&(phttpd->sclients), phttpd->handle);
 
   if (rv != ESP_OK)
@@ -165,6 +319,11 @@ esp_err_t camwebsrv_httpd_destroy(camwebsrv_httpd_t *httpd)
     ESP_LOGE(CAMWEBSRV_TAG, "HTTPD camwebsrv_httpd_destroy(): camwebsrv_camera_destroy() failed: [%d]: %s", rv, esp_err_to_name(rv));
   }
 
+  if (phttpd->svb != NULL)
+  {
+    camwebsrv_vbytes_destroy(&(phttpd->svb));
+  }
+
   if (phttpd->handle != NULL)
   {
     rv = httpd_stop(phttpd->handle);
@@ -200,8 +359,20 @@ esp_err_t camwebsrv_httpd_start(camwebsrv_httpd_t httpd)
 
   c.server_port = _CAMWEBSRV_HTTPD_SERVER_PORT;
   c.ctrl_port = _CAMWEBSRV_HTTPD_CONTROL_PORT;
+  c.max_uri_handlers = _CAMWEBSRV_HTTPD_MAX_URI_HANDLERS;
   c.global_user_ctx = (void *) phttpd;
   c.global_user_ctx_free_fn = _camwebsrv_httpd_noop;
+  c.close_fn = _camwebsrv_httpd_close;
+
+  // start producing frames before anyone can ask for one
+
+  rv = camwebsrv_camera_start(phttpd->cam);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD camwebsrv_httpd_start(): camwebsrv_camera_start() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
 
   rv = httpd_start(&(phttpd->handle), &c);
 
@@ -271,6 +442,16 @@ esp_err_t camwebsrv_httpd_start(camwebsrv_httpd_t httpd)
 
   httpd_register_uri_handler(phttpd->handle, &uri);
 
+  // register controls
+
+  memset(&uri, 0x00, sizeof(uri));
+
+  uri.uri     = _CAMWEBSRV_HTTPD_PATH_CONTROLS;
+  uri.method  = HTTP_GET;
+  uri.handler = _camwebsrv_httpd_handler_controls;
+
+  httpd_register_uri_handler(phttpd->handle, &uri);
+
   // register capture
 
   memset(&uri, 0x00, sizeof(uri));
@@ -291,12 +472,76 @@ esp_err_t camwebsrv_httpd_start(camwebsrv_httpd_t httpd)
 
   httpd_register_uri_handler(phttpd->handle, &uri);
 
+  // register limits
+
+  memset(&uri, 0x00, sizeof(uri));
+
+  uri.uri     = _CAMWEBSRV_HTTPD_PATH_LIMITS;
+  uri.method  = HTTP_GET;
+  uri.handler = _camwebsrv_httpd_handler_limits;
+
+  httpd_register_uri_handler(phttpd->handle, &uri);
+
+  // register clients
+
+  memset(&uri, 0x00, sizeof(uri));
+
+  uri.uri     = _CAMWEBSRV_HTTPD_PATH_CLIENTS;
+  uri.method  = HTTP_GET;
+  uri.handler = _camwebsrv_httpd_handler_clients;
+
+  httpd_register_uri_handler(phttpd->handle, &uri);
+
+#if CONFIG_HTTPD_WS_SUPPORT
+  // register websocket stream
+
+  memset(&uri, 0x00, sizeof(uri));
+
+  uri.uri          = _CAMWEBSRV_HTTPD_PATH_WS_STREAM;
+  uri.method       = HTTP_GET;
+  uri.handler      = _camwebsrv_httpd_handler_ws_stream;
+  uri.is_websocket = true;
+  uri.handle_ws_control_frames = true;
+
+  httpd_register_uri_handler(phttpd->handle, &uri);
+#endif
+
   ESP_LOGI(CAMWEBSRV_TAG, "HTTPD camwebsrv_httpd_start(): started server on port %d", _CAMWEBSRV_HTTPD_SERVER_PORT);
 
+  // start the stream sender tasks
+
+  rv = camwebsrv_sclients_start(phttpd->sclients, phttpd->cam, phttpd->handle);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD camwebsrv_httpd_start(): camwebsrv_sclients_start() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  // and the RTSP server, which feeds off the same camera
+
+  rv = camwebsrv_rtsp_start(phttpd->rtsp);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD camwebsrv_httpd_start(): camwebsrv_rtsp_start() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  // and the multicast sender
+
+  rv = camwebsrv_mcast_start(phttpd->mcast);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD camwebsrv_httpd_start(): camwebsrv_mcast_start() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
+
   return ESP_OK;
 }
 
-esp_err_t camwebsrv_httpd_process(camwebsrv_httpd_t httpd, uint16_t *nextevent)
+esp_err_t camwebsrv_httpd_process(camwebsrv_httpd_t httpd, camwebsrv_sched_t sched)
 {
   _camwebsrv_httpd_t *phttpd;
   esp_err_t rv;
@@ -308,11 +553,14 @@ esp_err_t camwebsrv_httpd_process(camwebsrv_httpd_t httpd, uint16_t *nextevent)
 
   phttpd = (_camwebsrv_httpd_t *) httpd;
 
-  rv = camwebsrv_sclients_process(phttpd->sclients, phttpd->cam, phttpd->handle, nextevent);
+  // the stream clients look after themselves, so all that's left to do here
+  // is to keep the frames they get at a size they can cope with
+
+  rv = camwebsrv_ratectl_process(phttpd->ratectl, sched);
 
   if (rv != ESP_OK)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD camwebsrv_httpd_process(): camwebsrv_sclients_process() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD camwebsrv_httpd_process(): camwebsrv_ratectl_process() failed: [%d]: %s", rv, esp_err_to_name(rv));
     return rv;
   }
 
@@ -363,88 +611,74 @@ static esp_err_t _camwebsrv_httpd_handler_status(httpd_req_t *req)
 {
   esp_err_t rv = ESP_OK;
   _camwebsrv_httpd_t *phttpd;
-  camwebsrv_vbytes_t vb;
+  char inm[_CAMWEBSRV_HTTPD_ETAG_LEN];
   const uint8_t *buf;
+  size_t len = 0;
 
   phttpd = (_camwebsrv_httpd_t *) httpd_get_global_user_ctx(req->handle);
 
+  // only render the response again if a camera setting has changed
+
+  if (phttpd->setag[0] == '\0' || phttpd->sversion != camwebsrv_camera_status_version(phttpd->cam))
+  {
+    rv = _camwebsrv_httpd_status_render(phttpd);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_status(): _camwebsrv_httpd_status_render() failed: [%d]: %s", rv, esp_err_to_name(rv));
+      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+      return rv;
+    }
+  }
+
   // response type/header status
 
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  httpd_resp_set_hdr(req, "ETag", phttpd->setag);
   httpd_resp_set_type(req, "application/json");
-  httpd_resp_set_status(req, "200 OK");
-
-  // initialise and compose response buffer
 
-  rv = camwebsrv_vbytes_init(&vb);
+  // if the client already has this version, tell it so
 
-  if (rv != ESP_OK)
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", inm, sizeof(inm)) == ESP_OK && strcmp(inm, phttpd->setag) == 0)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_status(): camwebsrv_vbytes_init() failed: [%d]: %s", rv, esp_err_to_name(rv));
-    return rv;
-  }
+    httpd_resp_set_status(req, "304 Not Modified");
 
-  rv = camwebsrv_vbytes_set_str(
-    vb,
-    _CAMWEBSRV_HTTPD_RESP_STATUS_STR,
-    camwebsrv_camera_ctrl_get(phttpd->cam, "aec"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "aec2"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "aec_value"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "ae_level"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "agc"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "agc_gain"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "awb"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "awb_gain"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "bpc"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "brightness"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "colorbar"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "contrast"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "dcw"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "flash"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "fps"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "framesize"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "gainceiling"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "hmirror"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "lenc"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "quality"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "raw_gma"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "saturation"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "sharpness"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "special_effect"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "vflip"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "wb_mode"),
-    camwebsrv_camera_ctrl_get(phttpd->cam, "wpc")
-  );
+    rv = httpd_resp_send(req, NULL, 0);
 
-  if (rv != ESP_OK)
-  {
-    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_status(): camwebsrv_vbytes_set_str() failed: [%d]: %s", rv, esp_err_to_name(rv));
-    camwebsrv_vbytes_destroy(&vb);
-    return rv;
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_status(): httpd_resp_send() failed: [%d]: %s", rv, esp_err_to_name(rv));
+      return rv;
+    }
+
+    ESP_LOGI(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_status(%d): served %s; not modified", httpd_req_to_sockfd(req), req->uri);
+
+    return ESP_OK;
   }
 
-  rv  = camwebsrv_vbytes_get_bytes(vb, &buf, NULL);
+  httpd_resp_set_status(req, "200 OK");
+
+  rv = camwebsrv_vbytes_get_bytes(phttpd->svb, &buf, &len);
 
   if (rv != ESP_OK)
   {
     ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_status(): camwebsrv_vbytes_get_bytes() failed: [%d]: %s", rv, esp_err_to_name(rv));
-    camwebsrv_vbytes_destroy(&vb);
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
     return rv;
   }
 
   // send response
 
-  rv = httpd_resp_sendstr(req, (char *) buf);
+  rv = httpd_resp_send(req, (const char *) buf, len);
 
   if (rv != ESP_OK)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_status(): httpd_resp_sendstr() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_status(): httpd_resp_send() failed: [%d]: %s", rv, esp_err_to_name(rv));
     httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
     return rv;
   }
 
-  camwebsrv_vbytes_destroy(&vb);
-
   ESP_LOGI(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_status(%d): served %s", httpd_req_to_sockfd(req), req->uri);
 
   return ESP_OK;
@@ -505,19 +739,24 @@ static esp_err_t _camwebsrv_httpd_handler_control(httpd_req_t *req)
 {
   esp_err_t rv;
   size_t len;
+  size_t count = 0;
+  size_t i;
   char *buf;
-  char bvar[_CAMWEBSRV_HTTPD_PARAM_LEN];
-  char bval[_CAMWEBSRV_HTTPD_PARAM_LEN];
+  char *tok;
+  char *save = NULL;
+  char *var = NULL;
+  char *val = NULL;
+  uint32_t batch = 0;
+  uint32_t seq = 0;
+  bool applied = true;
+  bool pending = false;
+  camwebsrv_camera_ctrl_change_t changes[CAMWEBSRV_CAMERA_CTRL_COUNT];
+  camwebsrv_vbytes_t vb;
+  const uint8_t *rbuf;
   _camwebsrv_httpd_t *phttpd;
 
   phttpd = (_camwebsrv_httpd_t *) httpd_get_global_user_ctx(req->handle);
 
-  // response type/header status
-
-  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  httpd_resp_set_type(req, "text/plain");
-  httpd_resp_set_status(req, "200 OK");
-
   // how long is the query string?
 
   len = httpd_req_get_url_query_len(req) + 1;
@@ -542,8 +781,6 @@ static esp_err_t _camwebsrv_httpd_handler_control(httpd_req_t *req)
   }
 
   memset(buf, 0x00, len + 1);
-  memset(bvar, 0x00, sizeof(bvar));
-  memset(bval, 0x00, sizeof(bval));
 
   // retrieve query string
 
@@ -557,43 +794,89 @@ static esp_err_t _camwebsrv_httpd_handler_control(httpd_req_t *req)
     return rv;
   }
 
-  // get variable name from query string
-
-  rv = httpd_query_key_value(buf, "var", bvar, sizeof(bvar) - 1);
+  // split it into name=value pairs, in place; the old var=name&val=value
+  // form is still taken as one more pair
 
-  if (rv != ESP_OK)
+  for (tok = strtok_r(buf, "&", &save); tok != NULL; tok = strtok_r(NULL, "&", &save))
   {
-    free(buf);
-    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_control(): httpd_query_key_value(\"var\") failed: [%d]: %s", rv, esp_err_to_name(rv));
-    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, NULL);
-    return rv;
+    char *eq = strchr(tok, '=');
+
+    if (eq == NULL)
+    {
+      continue;
+    }
+
+    *eq = '\0';
+
+    if (strcmp(tok, "var") == 0)
+    {
+      var = eq + 1;
+    }
+    else if (strcmp(tok, "val") == 0)
+    {
+      val = eq + 1;
+    }
+    else
+    {
+      if (count >= CAMWEBSRV_CAMERA_CTRL_COUNT || _camwebsrv_httpd_parse_int(eq + 1, &(changes[count].value)) != ESP_OK)
+      {
+        ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_control(): failed; too many controls or invalid value for \"%s\"", tok);
+        free(buf);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, NULL);
+        return ESP_ERR_INVALID_ARG;
+      }
+
+      changes[count].name = tok;
+      count++;
+    }
   }
 
-  // get variable value from query string
+  if (var != NULL && val != NULL)
+  {
+    if (count >= CAMWEBSRV_CAMERA_CTRL_COUNT || _camwebsrv_httpd_parse_int(val, &(changes[count].value)) != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_control(): failed; too many controls or invalid value for \"%s\"", var);
+      free(buf);
+      httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, NULL);
+      return ESP_ERR_INVALID_ARG;
+    }
 
-  rv = httpd_query_key_value(buf, "val", bval, sizeof(bval) - 1);
+    changes[count].name = var;
+    count++;
+  }
 
-  if (rv != ESP_OK)
+  if (count == 0)
   {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_control(): failed; no controls in query string");
     free(buf);
-    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_control(): httpd_query_key_value(\"val\") failed: [%d]: %s", rv, esp_err_to_name(rv));
     httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, NULL);
-    return rv;
+    return ESP_ERR_INVALID_ARG;
   }
 
-  // we don't need the query string buffer anymore
+  // queue the lot, then wait a little for the camera to apply them between
+  // frames; if it hasn't by then, they stay queued, and the response only
+  // carries the batch they went into
 
-  free(buf);
+  rv = camwebsrv_camera_ctrl_queue(phttpd->cam, changes, count, &batch);
 
-  // set camera variable
+  if (rv == ESP_OK)
+  {
+    rv = camwebsrv_camera_ctrl_commit(phttpd->cam, batch, changes, count, &seq);
 
-  rv = camwebsrv_camera_ctrl_set(phttpd->cam, bvar, atoi(bval));
+    if (rv == ESP_ERR_TIMEOUT)
+    {
+      pending = true;
+      rv = ESP_OK;
+    }
+  }
 
   if (rv != ESP_OK)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_control(): camwebsrv_camera_ctrl_set(\"%s\", %s) failed", bvar, bval);
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_control(): camwebsrv_camera_ctrl_queue/commit() failed: [%d]: %s", rv, esp_err_to_name(rv));
+
+    free(buf);
 
-    if (rv == ESP_ERR_INVALID_ARG)
+    if (rv == ESP_ERR_INVALID_ARG || rv == ESP_ERR_NOT_SUPPORTED)
     {
       httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, NULL);
     }
@@ -605,95 +888,1068 @@ static esp_err_t _camwebsrv_httpd_handler_control(httpd_req_t *req)
     return rv;
   }
 
-  // send response
+  // compose response; the names still point into the query string buffer
 
-  rv = httpd_resp_send(req, NULL, 0);
+  rv = camwebsrv_vbytes_init(&vb);
 
   if (rv != ESP_OK)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_control(): httpd_resp_send() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_control(): camwebsrv_vbytes_init() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    free(buf);
     httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
     return rv;
   }
 
-  ESP_LOGI(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_control(%d): served %s", httpd_req_to_sockfd(req), req->uri);
-
-  return ESP_OK;
-}
+  rv = camwebsrv_vbytes_set_str(vb, _CAMWEBSRV_HTTPD_RESP_CHANGES_STR, batch, seq);
 
-static esp_err_t _camwebsrv_httpd_handler_capture(httpd_req_t *req)
-{
-  esp_err_t rv;
-  uint8_t *fbuf = NULL;
-  size_t flen = 0;
-  _camwebsrv_httpd_t *phttpd;
+  for (i = 0; i < count && rv == ESP_OK; i++)
+  {
+    applied = applied && changes[i].applied;
+
+    rv = camwebsrv_vbytes_append_str(
+      vb,
+      _CAMWEBSRV_HTTPD_RESP_CHANGE_STR,
+      (i > 0) ? "," : "",
+      changes[i].name,
+      changes[i].value,
+      changes[i].applied ? "true" : "false"
+    );
+  }
 
-  phttpd = (_camwebsrv_httpd_t *) httpd_get_global_user_ctx(req->handle);
+  if (rv == ESP_OK)
+  {
+    rv = camwebsrv_vbytes_append_str(vb, "\n  ]\n}\n");
+  }
 
-  // response type/header status
+  free(buf);
 
-  httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
-  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  httpd_resp_set_type(req, "image/jpeg");
-  httpd_resp_set_status(req, "200 OK");
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_control(): camwebsrv_vbytes_append_str() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    camwebsrv_vbytes_destroy(&vb);
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    return rv;
+  }
 
-  rv = camwebsrv_camera_frame_grab(phttpd->cam, &fbuf, &flen, NULL);
+  rv = camwebsrv_vbytes_get_bytes(vb, &rbuf, NULL);
 
   if (rv != ESP_OK)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_capture(): camwebsrv_camera_frame_grab() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_control(): camwebsrv_vbytes_get_bytes() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    camwebsrv_vbytes_destroy(&vb);
     httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
     return rv;
   }
 
-  rv = httpd_resp_send(req, (const char *) fbuf, (ssize_t) flen);
+  // response type/header status; a value the sensor refused is the
+  // client's to fix, not ours, and a batch still waiting for the camera
+  // has only been accepted
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_status(req, pending ? "202 Accepted" : (applied ? "200 OK" : "409 Conflict"));
+
+  // send response
+
+  rv = httpd_resp_sendstr(req, (char *) rbuf);
 
-  camwebsrv_camera_frame_dispose(phttpd->cam);
+  camwebsrv_vbytes_destroy(&vb);
 
   if (rv != ESP_OK)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_capture(): httpd_resp_send() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_control(): httpd_resp_sendstr() failed: [%d]: %s", rv, esp_err_to_name(rv));
     httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
     return rv;
   }
 
-  ESP_LOGI(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_capture(%d): served %s", httpd_req_to_sockfd(req), req->uri);
+  ESP_LOGI(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_control(%d): served %s; %u changes from frame %u", httpd_req_to_sockfd(req), req->uri, count, seq);
 
   return ESP_OK;
 }
 
-static esp_err_t _camwebsrv_httpd_handler_stream(httpd_req_t *req)
+static esp_err_t _camwebsrv_httpd_handler_controls(httpd_req_t *req)
 {
-  esp_err_t rv;
+  esp_err_t rv = ESP_OK;
   _camwebsrv_httpd_t *phttpd;
-  _camwebsrv_httpd_worker_arg_t *parg;
+  camwebsrv_camera_ctrl_info_t info;
+  camwebsrv_vbytes_t vb;
+  const uint8_t *buf;
+  int i;
 
   phttpd = (_camwebsrv_httpd_t *) httpd_get_global_user_ctx(req->handle);
 
-  parg = (_camwebsrv_httpd_worker_arg_t *) malloc(sizeof(_camwebsrv_httpd_worker_arg_t));
+  // response type/header status
 
-  if (parg == NULL)
-  {
-    int e = errno;
-    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_stream(): malloc() failed: [%d]: %s", e, strerror(e));
-    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
-    return ESP_FAIL;
-  }
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_status(req, "200 OK");
 
-  parg->phttpd = phttpd;
-  parg->sockfd = httpd_req_to_sockfd(req);
+  // initialise and compose response buffer
 
-  rv = httpd_queue_work(req->handle, _camwebsrv_httpd_worker, parg);
+  rv = camwebsrv_vbytes_init(&vb);
 
   if (rv != ESP_OK)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_stream(): httpd_queue_work() failed: [%d]: %s", rv, esp_err_to_name(rv));
-    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
-    free(parg);
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_controls(): camwebsrv_vbytes_init() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  rv = camwebsrv_vbytes_set_str(vb, "[");
+
+  for (i = 0; i < CAMWEBSRV_CAMERA_CTRL_COUNT && rv == ESP_OK; i++)
+  {
+    rv = camwebsrv_camera_ctrl_info(phttpd->cam, (camwebsrv_camera_ctrl_t) i, &info);
+
+    if (rv != ESP_OK)
+    {
+      break;
+    }
+
+    rv = camwebsrv_vbytes_append_str(
+      vb,
+      _CAMWEBSRV_HTTPD_RESP_CONTROL_STR,
+      (i > 0) ? "," : "",
+      info.name,
+      info.min,
+      info.max,
+      info.supported ? "true" : "false"
+    );
+  }
+
+  if (rv == ESP_OK)
+  {
+    rv = camwebsrv_vbytes_append_str(vb, "\n]\n");
+  }
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_controls(): camwebsrv_vbytes_append_str() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    camwebsrv_vbytes_destroy(&vb);
+    return rv;
+  }
+
+  rv  = camwebsrv_vbytes_get_bytes(vb, &buf, NULL);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_controls(): camwebsrv_vbytes_get_bytes() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    camwebsrv_vbytes_destroy(&vb);
+    return rv;
+  }
+
+  // send response
+
+  rv = httpd_resp_sendstr(req, (char *) buf);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_controls(): httpd_resp_sendstr() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    camwebsrv_vbytes_destroy(&vb);
+    return rv;
+  }
+
+  camwebsrv_vbytes_destroy(&vb);
+
+  ESP_LOGI(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_controls(%d): served %s", httpd_req_to_sockfd(req), req->uri);
+
+  return ESP_OK;
+}
+
+static esp_err_t _camwebsrv_httpd_handler_capture(httpd_req_t *req)
+{
+  esp_err_t rv;
+  camwebsrv_camera_frame_t frame = NULL;
+  int64_t maxage;
+  int64_t treq;
+  int64_t ttl;
+  bool fresh = false;
+  char query[_CAMWEBSRV_HTTPD_PARAM_LEN];
+  char bval[_CAMWEBSRV_HTTPD_PARAM_LEN];
+  char etag[_CAMWEBSRV_HTTPD_ETAG_LEN];
+  char inm[_CAMWEBSRV_HTTPD_ETAG_LEN];
+  char cc[_CAMWEBSRV_HTTPD_PARAM_LEN];
+  char mtime[CAMWEBSRV_CAMERA_MTIME_LEN];
+  _camwebsrv_httpd_t *phttpd;
+  _camwebsrv_httpd_worker_arg_t *parg;
+
+  phttpd = (_camwebsrv_httpd_t *) httpd_get_global_user_ctx(req->handle);
+
+  treq = esp_timer_get_time();
+
+  // requests within the max age share the same frame; ?fresh=1 asks for one
+  // captured after the request came in
+
+  rv = httpd_req_get_url_query_str(req, query, sizeof(query));
+
+  if ((rv == ESP_OK || rv == ESP_ERR_HTTPD_RESULT_TRUNC) && httpd_query_key_value(query, "fresh", bval, sizeof(bval)) == ESP_OK)
+  {
+    fresh = (atoi(bval) != 0);
+  }
+
+  if (fresh)
+  {
+    maxage = 1;
+  }
+  else
+  {
+    uint8_t fps = camwebsrv_camera_fps_get(phttpd->cam);
+
+    maxage = (phttpd->cmaxage > 0) ? phttpd->cmaxage : (1000000 / ((fps > 0) ? fps : 1));
+  }
+
+  // a poller that already has the last published frame gets a 304; the tag
+  // is this boot's id and the frame's sequence number, and we only look at
+  // what is already there rather than wait on the camera from this task
+
+  if (!fresh && httpd_req_get_hdr_value_str(req, "If-None-Match", inm, sizeof(inm)) == ESP_OK)
+  {
+    rv = camwebsrv_camera_frame_current(phttpd->cam, &frame);
+
+    if (rv != ESP_OK && rv != ESP_ERR_NOT_FOUND)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_capture(): camwebsrv_camera_frame_current() failed: [%d]: %s", rv, esp_err_to_name(rv));
+      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+      return rv;
+    }
+
+    if (frame != NULL)
+    {
+      snprintf(etag, sizeof(etag), "\"%08x-%u\"", (unsigned int) phttpd->sboot, (unsigned int) camwebsrv_camera_frame_seq(frame));
+    }
+
+    if (frame != NULL && strcmp(inm, etag) == 0)
+    {
+      ttl = maxage - (esp_timer_get_time() - camwebsrv_camera_frame_tstamp(frame));
+      snprintf(cc, sizeof(cc), "max-age=%u", (unsigned int) ((ttl > 0) ? ttl / 1000000 : 0));
+
+      if (camwebsrv_camera_frame_mtime(frame, mtime, sizeof(mtime)) != ESP_OK)
+      {
+        mtime[0] = '\0';
+      }
+
+      camwebsrv_camera_frame_dispose(&frame);
+
+      httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+      httpd_resp_set_hdr(req, "Cache-Control", cc);
+      httpd_resp_set_hdr(req, "ETag", etag);
+
+      if (mtime[0] != '\0')
+      {
+        httpd_resp_set_hdr(req, "Last-Modified", mtime);
+      }
+
+      httpd_resp_set_status(req, "304 Not Modified");
+
+      rv = httpd_resp_send(req, NULL, 0);
+
+      if (rv != ESP_OK)
+      {
+        ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_capture(): httpd_resp_send() failed: [%d]: %s", rv, esp_err_to_name(rv));
+        return rv;
+      }
+
+      ESP_LOGI(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_capture(%d): served %s; not modified", httpd_req_to_sockfd(req), req->uri);
+
+      return ESP_OK;
+    }
+
+    if (frame != NULL)
+    {
+      camwebsrv_camera_frame_dispose(&frame);
+    }
+  }
+
+  // hand the socket over to the stream sender tasks as a one-shot client, so
+  // that a slow client doesn't hold up this task while the frame goes out;
+  // it waits there, parked, until a frame captured no earlier than the max
+  // age before this request has been published
+
+  parg = (_camwebsrv_httpd_worker_arg_t *) malloc(sizeof(_camwebsrv_httpd_worker_arg_t));
+
+  if (parg == NULL)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_capture(): malloc() failed: [%d]: %s", e, strerror(e));
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    return ESP_FAIL;
+  }
+
+  parg->phttpd = phttpd;
+  parg->sockfd = httpd_req_to_sockfd(req);
+
+  camwebsrv_sclients_params_init(&(parg->params));
+
+  parg->params.framing = CAMWEBSRV_SCLIENTS_FRAMING_ONESHOT;
+  parg->params.maxage = maxage;
+  parg->params.tmin = treq - maxage;
+  parg->params.tagid = phttpd->sboot;
+
+  // with no room for it there, turn it away the same way /stream does,
+  // rather than tie up this task sending it from here
+
+  rv = camwebsrv_sclients_admit(phttpd->sclients, &(parg->params));
+
+  if (rv == ESP_OK)
+  {
+    rv = httpd_queue_work(req->handle, _camwebsrv_httpd_worker, parg);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_capture(): httpd_queue_work() failed: [%d]: %s", rv, esp_err_to_name(rv));
+      rv = ESP_ERR_NO_MEM;
+    }
+  }
+
+  if (rv == ESP_ERR_NO_MEM)
+  {
+    char retry[_CAMWEBSRV_HTTPD_RETRY_LEN];
+
+    snprintf(retry, sizeof(retry), "%u", CAMWEBSRV_SCLIENTS_RETRY_AFTER);
+
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "Retry-After", retry);
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_sendstr(req, "Too many stream clients; try again later\n");
+
+    ESP_LOGW(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_capture(%d): refused %s", httpd_req_to_sockfd(req), req->uri);
+
+    free(parg);
+    return ESP_OK;
+  }
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_capture(): camwebsrv_sclients_admit() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    free(parg);
+    return ESP_FAIL;
+  }
+
+  ESP_LOGI(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_capture(%d): served %s", httpd_req_to_sockfd(req), req->uri);
+
+  return ESP_OK;
+}
+
+static esp_err_t _camwebsrv_httpd_handler_stream(httpd_req_t *req)
+{
+  esp_err_t rv;
+  _camwebsrv_httpd_t *phttpd;
+  _camwebsrv_httpd_worker_arg_t *parg;
+
+  phttpd = (_camwebsrv_httpd_t *) httpd_get_global_user_ctx(req->handle);
+
+  parg = (_camwebsrv_httpd_worker_arg_t *) malloc(sizeof(_camwebsrv_httpd_worker_arg_t));
+
+  if (parg == NULL)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_stream(): malloc() failed: [%d]: %s", e, strerror(e));
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    return ESP_FAIL;
+  }
+
+  parg->phttpd = phttpd;
+  parg->sockfd = httpd_req_to_sockfd(req);
+
+  // per-client stream options from the query string
+
+  rv = _camwebsrv_httpd_stream_params(req, &(parg->params));
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_stream(): _camwebsrv_httpd_stream_params() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    httpd_resp_send_err(req, rv == ESP_ERR_NO_MEM ? HTTPD_500_INTERNAL_SERVER_ERROR : HTTPD_400_BAD_REQUEST, NULL);
+    free(parg);
+    return ESP_FAIL;
+  }
+
+  // turn the client away if there's no room for it; the error handlers don't
+  // do 503, so it's done by hand
+
+  rv = camwebsrv_sclients_admit(phttpd->sclients, &(parg->params));
+
+  if (rv == ESP_ERR_NO_MEM)
+  {
+    char retry[_CAMWEBSRV_HTTPD_RETRY_LEN];
+
+    snprintf(retry, sizeof(retry), "%u", CAMWEBSRV_SCLIENTS_RETRY_AFTER);
+
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "Retry-After", retry);
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_sendstr(req, "Too many stream clients; try again later\n");
+
+    ESP_LOGW(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_stream(%d): refused %s", httpd_req_to_sockfd(req), req->uri);
+
+    free(parg);
+    return ESP_OK;
+  }
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_stream(): camwebsrv_sclients_admit() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    free(parg);
+    return ESP_FAIL;
+  }
+
+  rv = httpd_queue_work(req->handle, _camwebsrv_httpd_worker, parg);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_stream(): httpd_queue_work() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    free(parg);
     return ESP_FAIL;
   }
 
-  ESP_LOGI(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_stream(%d): served %s", httpd_req_to_sockfd(req), req->uri);
+  ESP_LOGI(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_stream(%d): served %s", httpd_req_to_sockfd(req), req->uri);
+
+  return ESP_OK;
+}
+
+static esp_err_t _camwebsrv_httpd_handler_limits(httpd_req_t *req)
+{
+  esp_err_t rv = ESP_OK;
+  _camwebsrv_httpd_t *phttpd;
+  camwebsrv_sclients_limits_t limits;
+  camwebsrv_vbytes_t vb;
+  const uint8_t *buf;
+  size_t sbused = 0;
+  size_t sbhwm = 0;
+  uint32_t qturns = 0;
+  uint32_t qbytehits = 0;
+  uint32_t qtimehits = 0;
+  camwebsrv_ratectl_stats_t rcstats;
+
+  phttpd = (_camwebsrv_httpd_t *) httpd_get_global_user_ctx(req->handle);
+
+  // get current limits
+
+  rv = camwebsrv_sclients_limits(phttpd->sclients, &limits);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_limits(): camwebsrv_sclients_limits() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    return rv;
+  }
+
+  // and how much of the stream clients' socket buffers is in use
+
+  rv = camwebsrv_sclients_sockbuf_stats(phttpd->sclients, &sbused, &sbhwm);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_limits(): camwebsrv_sclients_sockbuf_stats() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    return rv;
+  }
+
+  // and how often their turns were cut short by the send quantum
+
+  rv = camwebsrv_sclients_quantum_stats(phttpd->sclients, &qturns, &qbytehits, &qtimehits);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_limits(): camwebsrv_sclients_quantum_stats() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    return rv;
+  }
+
+  // and what rate control is doing about the frame size
+
+  memset(&rcstats, 0x00, sizeof(rcstats));
+
+  camwebsrv_ratectl_stats(phttpd->ratectl, &rcstats);
+
+  // response type/header status
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_status(req, "200 OK");
+
+  // initialise and compose response buffer
+
+  rv = camwebsrv_vbytes_init(&vb);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_limits(): camwebsrv_vbytes_init() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  rv = camwebsrv_vbytes_set_str(
+    vb,
+    _CAMWEBSRV_HTTPD_RESP_LIMITS_STR,
+    limits.clients,
+    limits.clients_max,
+    limits.fsize,
+    (unsigned int) camwebsrv_camera_frame_latency(phttpd->cam),
+    limits.heap,
+    limits.reserve,
+    limits.budget,
+    limits.used,
+    CAMWEBSRV_SCLIENTS_RETRY_AFTER,
+    CAMWEBSRV_SCLIENTS_RBUF_SIZE,
+    sbused,
+    sbhwm,
+    qturns,
+    qbytehits,
+    qtimehits,
+    rcstats.enabled,
+    rcstats.average,
+    rcstats.changes,
+    rcstats.target
+  );
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_limits(): camwebsrv_vbytes_set_str() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    camwebsrv_vbytes_destroy(&vb);
+    return rv;
+  }
+
+  rv  = camwebsrv_vbytes_get_bytes(vb, &buf, NULL);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_limits(): camwebsrv_vbytes_get_bytes() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    camwebsrv_vbytes_destroy(&vb);
+    return rv;
+  }
+
+  // send response
+
+  rv = httpd_resp_sendstr(req, (char *) buf);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_limits(): httpd_resp_sendstr() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    camwebsrv_vbytes_destroy(&vb);
+    return rv;
+  }
+
+  camwebsrv_vbytes_destroy(&vb);
+
+  ESP_LOGI(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_limits(%d): served %s", httpd_req_to_sockfd(req), req->uri);
+
+  return ESP_OK;
+}
+
+static esp_err_t _camwebsrv_httpd_handler_clients(httpd_req_t *req)
+{
+  esp_err_t rv = ESP_OK;
+  _camwebsrv_httpd_t *phttpd;
+  camwebsrv_sclients_info_t *info;
+  camwebsrv_vbytes_t vb;
+  const uint8_t *buf;
+  size_t count = 0;
+  size_t i;
+  int64_t tnow;
+
+  phttpd = (_camwebsrv_httpd_t *) httpd_get_global_user_ctx(req->handle);
+
+  // take a copy of the sessions first, so that the stream isn't held up
+  // while we render them
+
+  info = (camwebsrv_sclients_info_t *) malloc(sizeof(camwebsrv_sclients_info_t) * CAMWEBSRV_SCLIENTS_MAX_CLIENTS);
+
+  if (info == NULL)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_clients(): malloc() failed: [%d]: %s", e, strerror(e));
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    return ESP_FAIL;
+  }
+
+  rv = camwebsrv_sclients_snapshot(phttpd->sclients, info, CAMWEBSRV_SCLIENTS_MAX_CLIENTS, &count);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_clients(): camwebsrv_sclients_snapshot() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    free(info);
+    return rv;
+  }
+
+  tnow = esp_timer_get_time();
+
+  // response type/header status
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_status(req, "200 OK");
+
+  // initialise and compose response buffer
+
+  rv = camwebsrv_vbytes_init(&vb);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_clients(): camwebsrv_vbytes_init() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    free(info);
+    return rv;
+  }
+
+  rv = camwebsrv_vbytes_set_str(vb, "[");
+
+  for (i = 0; i < count && rv == ESP_OK; i++)
+  {
+    int64_t tconn = tnow - info[i].tconnect;
+    uint32_t fps100 = (tconn > 0) ? (uint32_t) (((int64_t) info[i].frames * 100000000) / tconn) : 0;
+
+    rv = camwebsrv_vbytes_append_str(
+      vb,
+      _CAMWEBSRV_HTTPD_RESP_CLIENT_STR,
+      (i > 0) ? "," : "",
+      info[i].sockfd,
+      info[i].addr,
+      info[i].shard,
+      info[i].mode == CAMWEBSRV_SCLIENTS_MODE_SMOOTH ? "smooth" : "latency",
+      info[i].framing == CAMWEBSRV_SCLIENTS_FRAMING_WS ? "ws" : (info[i].framing == CAMWEBSRV_SCLIENTS_FRAMING_ONESHOT ? "oneshot" : (info[i].framing == CAMWEBSRV_SCLIENTS_FRAMING_RAW ? "raw" : "chunked")),
+      info[i].fps,
+      fps100 / 100,
+      fps100 % 100,
+      (uint32_t) (tconn / 1000000),
+      (unsigned long long) info[i].bytes,
+      info[i].frames,
+      info[i].dropped,
+      info[i].stalls,
+      info[i].buffered
+    );
+  }
+
+  if (rv == ESP_OK)
+  {
+    rv = camwebsrv_vbytes_append_str(vb, "\n]\n");
+  }
+
+  free(info);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_clients(): camwebsrv_vbytes_append_str() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    camwebsrv_vbytes_destroy(&vb);
+    return rv;
+  }
+
+  rv  = camwebsrv_vbytes_get_bytes(vb, &buf, NULL);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_clients(): camwebsrv_vbytes_get_bytes() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    camwebsrv_vbytes_destroy(&vb);
+    return rv;
+  }
+
+  // send response
+
+  rv = httpd_resp_sendstr(req, (char *) buf);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_clients(): httpd_resp_sendstr() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    camwebsrv_vbytes_destroy(&vb);
+    return rv;
+  }
+
+  camwebsrv_vbytes_destroy(&vb);
+
+  ESP_LOGI(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_clients(%d): served %s", httpd_req_to_sockfd(req), req->uri);
+
+  return ESP_OK;
+}
+
+#if CONFIG_HTTPD_WS_SUPPORT
+static esp_err_t _camwebsrv_httpd_handler_ws_stream(httpd_req_t *req)
+{
+  esp_err_t rv;
+  _camwebsrv_httpd_t *phttpd;
+  camwebsrv_sclients_params_t params;
+  httpd_ws_frame_t pkt;
+  uint8_t buf[_CAMWEBSRV_HTTPD_WS_CTRL_LEN + 1];
+  uint32_t seq;
+  uint16_t code;
+  size_t i;
+
+  phttpd = (_camwebsrv_httpd_t *) httpd_get_global_user_ctx(req->handle);
+
+  // the server has already done the handshake by the time we get the GET, so
+  // from here on, the socket belongs to the stream
+
+  if (req->method == HTTP_GET)
+  {
+    rv = _camwebsrv_httpd_stream_params(req, &params);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_ws_stream(): _camwebsrv_httpd_stream_params() failed: [%d]: %s", rv, esp_err_to_name(rv));
+      return ESP_FAIL;
+    }
+
+    params.framing = CAMWEBSRV_SCLIENTS_FRAMING_WS;
+
+    // too late for a 503, so turn the client away with a "try again later"
+    // close instead
+
+    rv = camwebsrv_sclients_admit(phttpd->sclients, &params);
+
+    if (rv == ESP_ERR_NO_MEM)
+    {
+      memset(&pkt, 0x00, sizeof(pkt));
+
+      buf[0] = (uint8_t) (_CAMWEBSRV_HTTPD_WS_CLOSE_RETRY >> 8);
+      buf[1] = (uint8_t) _CAMWEBSRV_HTTPD_WS_CLOSE_RETRY;
+
+      pkt.type = HTTPD_WS_TYPE_CLOSE;
+      pkt.final = true;
+      pkt.payload = buf;
+      pkt.len = 2;
+
+      httpd_ws_send_frame(req, &pkt);
+
+      ESP_LOGW(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_ws_stream(%d): refused %s", httpd_req_to_sockfd(req), req->uri);
+
+      return ESP_FAIL;
+    }
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_ws_stream(): camwebsrv_sclients_admit() failed: [%d]: %s", rv, esp_err_to_name(rv));
+      return ESP_FAIL;
+    }
+
+    rv = camwebsrv_sclients_add(phttpd->sclients, httpd_req_to_sockfd(req), &params);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_ws_stream(): camwebsrv_sclients_add() failed: [%d]: %s", rv, esp_err_to_name(rv));
+      return ESP_FAIL;
+    }
+
+    ESP_LOGI(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_ws_stream(%d): served %s", httpd_req_to_sockfd(req), req->uri);
+
+    return ESP_OK;
+  }
+
+  // anything else is a message from the client; besides pings and closes,
+  // the only one we expect is an ack, either 4 bytes of big endian sequence
+  // number, or the same in decimal text
+
+  memset(&pkt, 0x00, sizeof(pkt));
+  memset(buf, 0x00, sizeof(buf));
+
+  rv = httpd_ws_recv_frame(req, &pkt, 0);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_ws_stream(): httpd_ws_recv_frame() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  if (pkt.len > ((pkt.type == HTTPD_WS_TYPE_PING || pkt.type == HTTPD_WS_TYPE_CLOSE) ? _CAMWEBSRV_HTTPD_WS_CTRL_LEN : _CAMWEBSRV_HTTPD_WS_MSG_LEN))
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_ws_stream(%d): message too long: %u bytes", httpd_req_to_sockfd(req), pkt.len);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  pkt.payload = buf;
+
+  rv = httpd_ws_recv_frame(req, &pkt, _CAMWEBSRV_HTTPD_WS_CTRL_LEN);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_ws_stream(): httpd_ws_recv_frame() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  // the stream's own sender answers pings and closes, so that its frames and
+  // ours never interleave on the socket; only a socket that isn't streaming
+  // yet is answered from here
+
+  if (pkt.type == HTTPD_WS_TYPE_PING)
+  {
+    rv = camwebsrv_sclients_ping(phttpd->sclients, httpd_req_to_sockfd(req), buf, pkt.len);
+
+    if (rv == ESP_ERR_NOT_FOUND)
+    {
+      pkt.type = HTTPD_WS_TYPE_PONG;
+      pkt.final = true;
+
+      rv = httpd_ws_send_frame(req, &pkt);
+    }
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_ws_stream(%d): pong failed: [%d]: %s", httpd_req_to_sockfd(req), rv, esp_err_to_name(rv));
+    }
+
+    return rv;
+  }
+
+  if (pkt.type == HTTPD_WS_TYPE_CLOSE)
+  {
+    code = (pkt.len >= 2) ? (uint16_t) (((uint16_t) buf[0] << 8) | buf[1]) : 0;
+
+    rv = camwebsrv_sclients_bye(phttpd->sclients, httpd_req_to_sockfd(req), code);
+
+    if (rv == ESP_ERR_NOT_FOUND)
+    {
+      pkt.final = true;
+      pkt.len = (pkt.len >= 2) ? 2 : 0;
+
+      httpd_ws_send_frame(req, &pkt);
+
+      return ESP_FAIL;
+    }
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_ws_stream(): camwebsrv_sclients_bye() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    }
+
+    return rv;
+  }
+
+  if (pkt.type == HTTPD_WS_TYPE_BINARY && pkt.len == 4)
+  {
+    seq = ((uint32_t) buf[0] << 24) | ((uint32_t) buf[1] << 16) | ((uint32_t) buf[2] << 8) | (uint32_t) buf[3];
+  }
+  else if (pkt.type == HTTPD_WS_TYPE_TEXT && pkt.len > 0)
+  {
+    // no more digits than a uint32_t has, and no more than it holds
+
+    if (pkt.len > _CAMWEBSRV_HTTPD_WS_ACK_DIGITS)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_ws_stream(%d): ack too long: %u bytes", httpd_req_to_sockfd(req), pkt.len);
+      return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (i = 0, seq = 0; i < pkt.len; i++)
+    {
+      if (buf[i] < '0' || buf[i] > '9' || seq > ((UINT32_MAX - (buf[i] - '0')) / 10))
+      {
+        ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_ws_stream(%d): invalid ack \"%s\"", httpd_req_to_sockfd(req), (char *) buf);
+        return ESP_ERR_INVALID_ARG;
+      }
+
+      seq = (seq * 10) + (buf[i] - '0');
+    }
+  }
+  else
+  {
+    ESP_LOGW(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_ws_stream(%d): ignoring message type %d, %u bytes", httpd_req_to_sockfd(req), pkt.type, pkt.len);
+    return ESP_OK;
+  }
+
+  rv = camwebsrv_sclients_ack(phttpd->sclients, httpd_req_to_sockfd(req), seq);
+
+  if (rv != ESP_OK && rv != ESP_ERR_NOT_FOUND)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_handler_ws_stream(): camwebsrv_sclients_ack() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  return ESP_OK;
+}
+#endif
+
+static esp_err_t _camwebsrv_httpd_status_render(_camwebsrv_httpd_t *phttpd)
+{
+  esp_err_t rv;
+  camwebsrv_camera_status_t cs;
+  camwebsrv_camera_ctrl_info_t info;
+  uint32_t version = 0;
+  const char *sep = "";
+  size_t i;
+
+  // nothing is cached until this render has succeeded
+
+  phttpd->setag[0] = '\0';
+
+  rv = camwebsrv_camera_status_get(phttpd->cam, &cs, &version);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_status_render(): camwebsrv_camera_status_get() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  if (phttpd->svb == NULL)
+  {
+    rv = camwebsrv_vbytes_init(&(phttpd->svb));
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_status_render(): camwebsrv_vbytes_init() failed: [%d]: %s", rv, esp_err_to_name(rv));
+      return rv;
+    }
+  }
+
+  // one line per control this sensor has
+
+  rv = camwebsrv_vbytes_set_str(phttpd->svb, "{");
+
+  for (i = 0; i < CAMWEBSRV_CAMERA_CTRL_COUNT && rv == ESP_OK; i++)
+  {
+    if (camwebsrv_camera_ctrl_info(phttpd->cam, (camwebsrv_camera_ctrl_t) i, &info) != ESP_OK || !info.supported)
+    {
+      continue;
+    }
+
+    rv = camwebsrv_vbytes_append_str(phttpd->svb, _CAMWEBSRV_HTTPD_RESP_STATUS_CTRL_STR, sep, info.name, cs.values[i]);
+
+    sep = ",";
+  }
+
+  if (rv == ESP_OK)
+  {
+    rv = camwebsrv_vbytes_append_str(phttpd->svb, "\n}\n");
+  }
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_status_render(): camwebsrv_vbytes_append_str() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  // the body only changes with the settings, so their version is the tag
+
+  snprintf(phttpd->setag, sizeof(phttpd->setag), "\"%08x-%u\"", (unsigned int) phttpd->sboot, (unsigned int) version);
+
+  phttpd->sversion = version;
+
+  return ESP_OK;
+}
+
+static esp_err_t _camwebsrv_httpd_parse_int(const char *str, int *value)
+{
+  char *end = NULL;
+  long l;
+
+  // the whole string has to be a number, and fit in an int
+
+  errno = 0;
+
+  l = strtol(str, &end, 10);
+
+  if (end == str || *end != '\0' || errno == ERANGE || l < INT_MIN || l > INT_MAX)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  *value = (int) l;
+
+  return ESP_OK;
+}
+
+static esp_err_t _camwebsrv_httpd_stream_params(httpd_req_t *req, camwebsrv_sclients_params_t *params)
+{
+  esp_err_t rv;
+  size_t len;
+  char *buf;
+  char bval[_CAMWEBSRV_HTTPD_PARAM_LEN];
+
+  camwebsrv_sclients_params_init(params);
+
+  // no query string means defaults
+
+  len = httpd_req_get_url_query_len(req);
+
+  if (len == 0)
+  {
+    return ESP_OK;
+  }
+
+  buf = (char *) malloc(len + 1);
+
+  if (buf == NULL)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_stream_params(): malloc() failed: [%d]: %s", e, strerror(e));
+    return ESP_ERR_NO_MEM;
+  }
+
+  memset(buf, 0x00, len + 1);
+
+  rv = httpd_req_get_url_query_str(req, buf, len + 1);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_stream_params(): httpd_req_get_url_query_str() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    free(buf);
+    return rv;
+  }
+
+  // mode: latency (default) or smooth
+
+  memset(bval, 0x00, sizeof(bval));
+
+  if (httpd_query_key_value(buf, "mode", bval, sizeof(bval) - 1) == ESP_OK)
+  {
+    if (strcmp(bval, "latency") == 0)
+    {
+      params->mode = CAMWEBSRV_SCLIENTS_MODE_LATENCY;
+    }
+    else if (strcmp(bval, "smooth") == 0)
+    {
+      params->mode = CAMWEBSRV_SCLIENTS_MODE_SMOOTH;
+    }
+    else
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_stream_params(): unsupported mode \"%s\"", bval);
+      free(buf);
+      return ESP_ERR_INVALID_ARG;
+    }
+  }
+
+  // framing: chunked (default) or raw
+
+  memset(bval, 0x00, sizeof(bval));
+
+  if (httpd_query_key_value(buf, "framing", bval, sizeof(bval) - 1) == ESP_OK)
+  {
+    if (strcmp(bval, "chunked") == 0)
+    {
+      params->framing = CAMWEBSRV_SCLIENTS_FRAMING_CHUNKED;
+    }
+    else if (strcmp(bval, "raw") == 0)
+    {
+      params->framing = CAMWEBSRV_SCLIENTS_FRAMING_RAW;
+    }
+    else
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_stream_params(): unsupported framing \"%s\"", bval);
+      free(buf);
+      return ESP_ERR_INVALID_ARG;
+    }
+  }
+
+  // fps: this client's own frame rate; if not given, follow the camera's
+
+  memset(bval, 0x00, sizeof(bval));
+
+  if (httpd_query_key_value(buf, "fps", bval, sizeof(bval) - 1) == ESP_OK)
+  {
+    int fps;
+
+    if (_camwebsrv_httpd_parse_int(bval, &fps) != ESP_OK || fps < CAMWEBSRV_CAMERA_FPS_MIN || fps > CAMWEBSRV_CAMERA_FPS_MAX)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "HTTPD _camwebsrv_httpd_stream_params(): unsupported fps \"%s\"", bval);
+      free(buf);
+      return ESP_ERR_INVALID_ARG;
+    }
+
+    params->fps = (uint8_t) fps;
+  }
+
+  free(buf);
 
   return ESP_OK;
 }
@@ -721,7 +1977,7 @@ static void _camwebsrv_httpd_worker(void *arg)
 
   parg = (_camwebsrv_httpd_worker_arg_t *) arg;
 
-  rv = camwebsrv_sclients_add(parg->phttpd->sclients, parg->sockfd);
+  rv = camwebsrv_sclients_add(parg->phttpd->sclients, parg->sockfd, &(parg->params));
 
   if (rv != ESP_OK)
   {
@@ -729,13 +1985,29 @@ static void _camwebsrv_httpd_worker(void *arg)
     httpd_sess_trigger_close(parg->phttpd->handle, parg->sockfd);
   }
 
-  // trigger new event
-  
-  xSemaphoreGive(parg->phttpd->sema);
-
   free(parg);
 }
 
 static void _camwebsrv_httpd_noop(void *arg)
 {
 }
+
+static void _camwebsrv_httpd_close(httpd_handle_t handle, int sockfd)
+{
+  _camwebsrv_httpd_t *phttpd;
+
+  phttpd = (_camwebsrv_httpd_t *) httpd_get_global_user_ctx(handle);
+
+  // if it was a stream client, its sender task drops it on its next pass,
+  // and closes the socket after that; this only posts a note, so it never
+  // waits on the stream
+
+  if (phttpd != NULL && camwebsrv_sclients_close(phttpd->sclients, sockfd) == ESP_OK)
+  {
+    return;
+  }
+
+  // with a close_fn set, closing the socket is up to us
+
+  close(sockfd);
+}
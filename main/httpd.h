@@ -5,18 +5,18 @@
 #ifndef _CAMWEBSRV_HTTPD_H
 #define _CAMWEBSRV_HTTPD_H
 
+#include "cfgman.h"
+#include "sched.h"
+
 #include <stdint.h>
 
 #include <esp_err.h>
 
-#include <freertos/FreeRTOS.h>
-#include <freertos/semphr.h>
-
 typedef void *camwebsrv_httpd_t;
 
-esp_err_t camwebsrv_httpd_init(camwebsrv_httpd_t *httpd, SemaphoreHandle_t sema);
+esp_err_t camwebsrv_httpd_init(camwebsrv_httpd_t *httpd, camwebsrv_cfgman_t cfgman);
 esp_err_t camwebsrv_httpd_destroy(camwebsrv_httpd_t *httpd);
 esp_err_t camwebsrv_httpd_start(camwebsrv_httpd_t httpd);
-esp_err_t camwebsrv_httpd_process(camwebsrv_httpd_t httpd, uint16_t *nextevent);
+esp_err_t camwebsrv_httpd_process(camwebsrv_httpd_t httpd, camwebsrv_sched_t sched);
 
 #endif
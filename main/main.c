@@ -6,6 +6,7 @@
 #include "cfgman.h"
 #include "httpd.h"
 #include "ping.h"
+#include "sched.h"
 #include "storage.h"
 #include "wifi.h"
 
@@ -17,16 +18,15 @@
 #include <nvs_flash.h>
 
 #include <freertos/FreeRTOS.h>
-#include <freertos/semphr.h>
 #include <freertos/task.h>
 
 void app_main()
 {
   esp_err_t rv;
-  SemaphoreHandle_t sema;
   camwebsrv_cfgman_t cfgman = NULL;
   camwebsrv_httpd_t httpd = NULL;
   camwebsrv_ping_t ping = NULL;
+  camwebsrv_sched_t sched = NULL;
   camwebsrv_wifi_t wifi = NULL;
 
   // initialise NVS
@@ -92,6 +92,16 @@ void app_main()
     goto camwebsrv_main_error;
   }
 
+  // initialise the scheduler the loop below sleeps on
+
+  rv = camwebsrv_sched_init(&sched);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "MAIN app_main(): camwebsrv_sched_init() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    goto camwebsrv_main_error;
+  }
+
   // initialise wifi
 
   rv = camwebsrv_wifi_init(&wifi, cfgman);
@@ -112,19 +122,9 @@ void app_main()
     goto camwebsrv_main_error;
   }
 
-  // initialise sema
-
-  sema = xSemaphoreCreateBinary();
-
-  if (sema == NULL)
-  {
-    ESP_LOGE(CAMWEBSRV_TAG, "MAIN app_main(): xSemaphoreCreateBinary() failed: [%d]: %s", rv, esp_err_to_name(rv));
-    goto camwebsrv_main_error;
-  }
-
   // initialise web server
 
-  rv = camwebsrv_httpd_init(&httpd, sema);
+  rv = camwebsrv_httpd_init(&httpd, cfgman);
 
   if (rv != ESP_OK)
   {
@@ -142,15 +142,16 @@ void app_main()
     goto camwebsrv_main_error;
   }
 
-  // process stream requests indefinitely
+  // the stream clients are served by their own tasks, so all that's left
+  // here is to run the ping state machine and the web server's periodic
+  // work, which includes the rate controller, indefinitely; each registers
+  // its next deadline with the scheduler
 
   while(1)
   {
-    uint16_t nextevent = UINT16_MAX;
-
     // ping
 
-    rv = camwebsrv_ping_process(ping, &nextevent);
+    rv = camwebsrv_ping_process(ping, sched);
 
     if (rv != ESP_OK)
     {
@@ -158,9 +159,9 @@ void app_main()
       goto camwebsrv_main_error;
     }
 
-    // httpd
+    // web server
 
-    rv = camwebsrv_httpd_process(httpd, &nextevent);
+    rv = camwebsrv_httpd_process(httpd, sched);
 
     if (rv != ESP_OK)
     {
@@ -168,9 +169,15 @@ void app_main()
       goto camwebsrv_main_error;
     }
 
-    // block until there is actually something to do
+    // sleep until the earliest deadline
 
-    xSemaphoreTake(sema, (nextevent == UINT16_MAX) ? portMAX_DELAY : pdMS_TO_TICKS(nextevent));
+    rv = camwebsrv_sched_wait(sched);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGW(CAMWEBSRV_TAG, "MAIN app_main(): camwebsrv_sched_wait() failed: [%d]: %s", rv, esp_err_to_name(rv));
+      vTaskDelay(pdMS_TO_TICKS(CAMWEBSRV_MAIN_MIN_CYCLE_MSEC));
+    }
   }
 
   camwebsrv_main_error:
@@ -0,0 +1,449 @@
+// 2026-10-16 mcast.c
+// Copyright (C) 2023 Vino Fernando Crescini  <vfcrescini@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "config.h"
+#include "mcast.h"
+#include "udp.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <lwip/inet.h>
+#include <lwip/sockets.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+// every datagram starts with this header, all big endian:
+//
+//   0  magic "CM"
+//   2  version
+//   3  flags; bit 0: last fragment of the frame, bit 1: parity
+//   4  frame sequence number
+//   8  fragment index; for parity, the index of the group's first fragment
+//  10  fragment count
+//  12  frame length
+//  16  FEC group size; zero if FEC is off
+//  17  reserved
+//  18  payload length
+
+#define _CAMWEBSRV_MCAST_HDR_LEN 20
+#define _CAMWEBSRV_MCAST_VERSION 1
+#define _CAMWEBSRV_MCAST_FLAG_LAST 0x01
+#define _CAMWEBSRV_MCAST_FLAG_PARITY 0x02
+#define _CAMWEBSRV_MCAST_PAYLOAD_LEN (CAMWEBSRV_MCAST_PACKET_LEN - _CAMWEBSRV_MCAST_HDR_LEN)
+
+typedef struct
+{
+  camwebsrv_camera_t cam;
+  SemaphoreHandle_t done;
+  TaskHandle_t task;
+  volatile bool stop;
+  bool enabled;
+  int sock;
+  struct sockaddr_in addr;
+  uint8_t fec;
+  uint32_t fseq;
+  uint32_t frames;
+  uint8_t pkt[CAMWEBSRV_MCAST_PACKET_LEN];
+  uint8_t parity[CAMWEBSRV_MCAST_PACKET_LEN];
+} _camwebsrv_mcast_t;
+
+static void _camwebsrv_mcast_task(void *arg);
+static esp_err_t _camwebsrv_mcast_process(_camwebsrv_mcast_t *pmcast, uint16_t *nextevent);
+static esp_err_t _camwebsrv_mcast_frame_send(_camwebsrv_mcast_t *pmcast, camwebsrv_camera_frame_t frame);
+static void _camwebsrv_mcast_header(uint8_t *p, uint8_t flags, uint32_t fseq, uint16_t frag, uint16_t nfrags, uint32_t flen, uint8_t fec, uint16_t plen);
+
+esp_err_t camwebsrv_mcast_init(camwebsrv_mcast_t *mcast, camwebsrv_cfgman_t cfgman, camwebsrv_camera_t cam)
+{
+  _camwebsrv_mcast_t *pmcast;
+  const char *gstr = NULL;
+  const char *vstr = NULL;
+  struct in_addr group;
+  esp_err_t rv;
+  long port = CAMWEBSRV_MCAST_DEFAULT_PORT;
+  long fec = 0;
+
+  if (mcast == NULL || cfgman == NULL || cam == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  memset(&group, 0x00, sizeof(group));
+
+  // get group; a missing or blank group disables multicast
+
+  rv = camwebsrv_cfgman_get(cfgman, CAMWEBSRV_CFGMAN_KEY_MCAST_GROUP, &gstr);
+
+  if (rv != ESP_OK && rv != ESP_ERR_NOT_FOUND)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "MCAST camwebsrv_mcast_init(): camwebsrv_cfgman_get(%s) failed: [%d]: %s", CAMWEBSRV_CFGMAN_KEY_MCAST_GROUP, rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  if (rv == ESP_OK && gstr != NULL && strlen(gstr) > 0)
+  {
+    if (inet_aton(gstr, &group) == 0 || !IN_MULTICAST(ntohl(group.s_addr)))
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "MCAST camwebsrv_mcast_init(): invalid %s: %s", CAMWEBSRV_CFGMAN_KEY_MCAST_GROUP, gstr);
+      return ESP_ERR_INVALID_ARG;
+    }
+
+    // port and FEC group size are optional
+
+    rv = camwebsrv_cfgman_get(cfgman, CAMWEBSRV_CFGMAN_KEY_MCAST_PORT, &vstr);
+
+    if (rv == ESP_OK && vstr != NULL && strlen(vstr) > 0)
+    {
+      char *end = NULL;
+
+      port = strtol(vstr, &end, 10);
+
+      if (end == NULL || *end != '\0' || port <= 0 || port > 65535)
+      {
+        ESP_LOGE(CAMWEBSRV_TAG, "MCAST camwebsrv_mcast_init(): invalid %s: %s", CAMWEBSRV_CFGMAN_KEY_MCAST_PORT, vstr);
+        return ESP_ERR_INVALID_ARG;
+      }
+    }
+
+    rv = camwebsrv_cfgman_get(cfgman, CAMWEBSRV_CFGMAN_KEY_MCAST_FEC, &vstr);
+
+    if (rv == ESP_OK && vstr != NULL && strlen(vstr) > 0)
+    {
+      char *end = NULL;
+
+      fec = strtol(vstr, &end, 10);
+
+      if (end == NULL || *end != '\0' || fec < 0 || fec > CAMWEBSRV_MCAST_FEC_MAX)
+      {
+        ESP_LOGE(CAMWEBSRV_TAG, "MCAST camwebsrv_mcast_init(): invalid %s: %s", CAMWEBSRV_CFGMAN_KEY_MCAST_FEC, vstr);
+        return ESP_ERR_INVALID_ARG;
+      }
+    }
+  }
+
+  // allocate space for new structure
+
+  pmcast = (_camwebsrv_mcast_t *) malloc(sizeof(_camwebsrv_mcast_t));
+
+  if (pmcast == NULL)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "MCAST camwebsrv_mcast_init(): malloc() failed: [%d]: %s", e, strerror(e));
+    return ESP_ERR_NO_MEM;
+  }
+
+  memset(pmcast, 0x00, sizeof(_camwebsrv_mcast_t));
+
+  pmcast->done = xSemaphoreCreateBinary();
+
+  if (pmcast->done == NULL)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "MCAST camwebsrv_mcast_init(): xSemaphoreCreateBinary() failed");
+    free(pmcast);
+    return ESP_FAIL;
+  }
+
+  pmcast->cam = cam;
+  pmcast->task = NULL;
+  pmcast->stop = false;
+  pmcast->sock = -1;
+  pmcast->fec = (uint8_t) fec;
+  pmcast->enabled = (group.s_addr != 0);
+  pmcast->addr.sin_family = AF_INET;
+  pmcast->addr.sin_addr = group;
+  pmcast->addr.sin_port = htons((uint16_t) port);
+
+  if (pmcast->enabled)
+  {
+    ESP_LOGI(CAMWEBSRV_TAG, "MCAST camwebsrv_mcast_init(): enabled; using %s:%ld, FEC group %u", inet_ntoa(group), port, pmcast->fec);
+  }
+  else
+  {
+    ESP_LOGI(CAMWEBSRV_TAG, "MCAST camwebsrv_mcast_init(): disabled");
+  }
+
+  *mcast = (camwebsrv_mcast_t) pmcast;
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_mcast_destroy(camwebsrv_mcast_t *mcast)
+{
+  _camwebsrv_mcast_t *pmcast;
+
+  if (mcast == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  pmcast = (_camwebsrv_mcast_t *) *mcast;
+
+  // stop the sender task, and wait for it to finish its current frame
+
+  if (pmcast->task != NULL)
+  {
+    pmcast->stop = true;
+
+    xSemaphoreTake(pmcast->done, portMAX_DELAY);
+
+    pmcast->task = NULL;
+  }
+
+  if (pmcast->sock >= 0)
+  {
+    close(pmcast->sock);
+  }
+
+  vSemaphoreDelete(pmcast->done);
+
+  free(pmcast);
+
+  *mcast = NULL;
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_mcast_start(camwebsrv_mcast_t mcast)
+{
+  _camwebsrv_mcast_t *pmcast;
+  uint8_t ttl = CAMWEBSRV_MCAST_TTL;
+
+  if (mcast == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  pmcast = (_camwebsrv_mcast_t *) mcast;
+
+  if (!pmcast->enabled || pmcast->task != NULL)
+  {
+    return ESP_OK;
+  }
+
+  pmcast->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+  if (pmcast->sock < 0)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "MCAST camwebsrv_mcast_start(): socket() failed: [%d]: %s", e, strerror(e));
+    return ESP_FAIL;
+  }
+
+  if (fcntl(pmcast->sock, F_SETFL, O_NONBLOCK) == -1)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "MCAST camwebsrv_mcast_start(): fcntl() failed: [%d]: %s", e, strerror(e));
+    close(pmcast->sock);
+    pmcast->sock = -1;
+    return ESP_FAIL;
+  }
+
+  // keep it on the local network; not fatal if the stack won't let us
+
+  if (setsockopt(pmcast->sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) != 0)
+  {
+    int e = errno;
+    ESP_LOGW(CAMWEBSRV_TAG, "MCAST camwebsrv_mcast_start(): setsockopt(IP_MULTICAST_TTL) failed: [%d]: %s", e, strerror(e));
+  }
+
+  pmcast->stop = false;
+
+  if (xTaskCreate(_camwebsrv_mcast_task, "mcast", CAMWEBSRV_MCAST_TASK_STACK, pmcast, CAMWEBSRV_MCAST_TASK_PRIO, &(pmcast->task)) != pdPASS)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "MCAST camwebsrv_mcast_start(): xTaskCreate() failed");
+    close(pmcast->sock);
+    pmcast->sock = -1;
+    pmcast->task = NULL;
+    return ESP_FAIL;
+  }
+
+  ESP_LOGI(CAMWEBSRV_TAG, "MCAST camwebsrv_mcast_start(): started sending to %s:%u", inet_ntoa(pmcast->addr.sin_addr), ntohs(pmcast->addr.sin_port));
+
+  return ESP_OK;
+}
+
+static void _camwebsrv_mcast_task(void *arg)
+{
+  _camwebsrv_mcast_t *pmcast;
+  esp_err_t rv;
+
+  pmcast = (_camwebsrv_mcast_t *) arg;
+
+  while(!pmcast->stop)
+  {
+    uint16_t nextevent = CAMWEBSRV_MAIN_MIN_CYCLE_MSEC;
+
+    rv = _camwebsrv_mcast_process(pmcast, &nextevent);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "MCAST _camwebsrv_mcast_task(): _camwebsrv_mcast_process() failed: [%d]: %s", rv, esp_err_to_name(rv));
+      nextevent = CAMWEBSRV_MAIN_MIN_CYCLE_MSEC;
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(nextevent > 0 ? nextevent : 1));
+  }
+
+  // let whoever stopped us know we're done
+
+  xSemaphoreGive(pmcast->done);
+
+  vTaskDelete(NULL);
+}
+
+static esp_err_t _camwebsrv_mcast_process(_camwebsrv_mcast_t *pmcast, uint16_t *nextevent)
+{
+  esp_err_t rv;
+  camwebsrv_camera_frame_t frame = NULL;
+  int64_t interval;
+  int64_t tstart;
+  int64_t tspent;
+
+  tstart = esp_timer_get_time();
+  interval = 1000000 / camwebsrv_camera_fps_get(pmcast->cam);
+
+  // the camera hands out its current frame if it is fresh enough, so the
+  // group doesn't cost any more grabs than the HTTP streams already do
+
+  rv = camwebsrv_camera_frame_grab(pmcast->cam, interval, &frame);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "MCAST _camwebsrv_mcast_process(): camwebsrv_camera_frame_grab() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  if (pmcast->frames == 0 || camwebsrv_camera_frame_seq(frame) != pmcast->fseq)
+  {
+    pmcast->fseq = camwebsrv_camera_frame_seq(frame);
+    pmcast->frames++;
+
+    rv = _camwebsrv_mcast_frame_send(pmcast, frame);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGD(CAMWEBSRV_TAG, "MCAST _camwebsrv_mcast_process(): dropped frame %u", pmcast->fseq);
+    }
+  }
+
+  camwebsrv_camera_frame_dispose(&frame);
+
+  // sleep for whatever is left of the frame interval
+
+  tspent = esp_timer_get_time() - tstart;
+
+  *nextevent = (tspent >= interval) ? 0 : (uint16_t) ((interval - tspent) / 1000);
+
+  return ESP_OK;
+}
+
+static esp_err_t _camwebsrv_mcast_frame_send(_camwebsrv_mcast_t *pmcast, camwebsrv_camera_frame_t frame)
+{
+  esp_err_t rv;
+  const uint8_t *fbuf = NULL;
+  size_t flen = 0;
+  uint16_t nfrags;
+  uint16_t frag;
+  uint16_t plen;
+  uint16_t pmax = 0;
+  uint16_t j;
+
+  rv = camwebsrv_camera_frame_bytes(frame, &fbuf, &flen);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "MCAST _camwebsrv_mcast_frame_send(): camwebsrv_camera_frame_bytes() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  nfrags = (flen + _CAMWEBSRV_MCAST_PAYLOAD_LEN - 1) / _CAMWEBSRV_MCAST_PAYLOAD_LEN;
+
+  // every fragment but the last is full, so a receiver can work out the
+  // length of any fragment it has to rebuild from parity
+
+  for (frag = 0; frag < nfrags; frag++)
+  {
+    size_t offset = (size_t) frag * _CAMWEBSRV_MCAST_PAYLOAD_LEN;
+
+    plen = (flen - offset < _CAMWEBSRV_MCAST_PAYLOAD_LEN) ? (flen - offset) : _CAMWEBSRV_MCAST_PAYLOAD_LEN;
+
+    _camwebsrv_mcast_header(pmcast->pkt, (frag == nfrags - 1) ? _CAMWEBSRV_MCAST_FLAG_LAST : 0, pmcast->fseq, frag, nfrags, flen, pmcast->fec, plen);
+
+    memcpy(pmcast->pkt + _CAMWEBSRV_MCAST_HDR_LEN, fbuf + offset, plen);
+
+    rv = camwebsrv_udp_sendto(pmcast->sock, pmcast->pkt, _CAMWEBSRV_MCAST_HDR_LEN + plen, (struct sockaddr *) &(pmcast->addr), sizeof(pmcast->addr), CAMWEBSRV_MCAST_SEND_RETRIES);
+
+    if (rv != ESP_OK)
+    {
+      return rv;
+    }
+
+    if (pmcast->fec == 0)
+    {
+      continue;
+    }
+
+    // XOR parity over each group of fec fragments, which lets a receiver
+    // rebuild any one fragment lost from the group
+
+    if (frag % pmcast->fec == 0)
+    {
+      memset(pmcast->parity + _CAMWEBSRV_MCAST_HDR_LEN, 0x00, _CAMWEBSRV_MCAST_PAYLOAD_LEN);
+      pmax = 0;
+    }
+
+    for (j = 0; j < plen; j++)
+    {
+      pmcast->parity[_CAMWEBSRV_MCAST_HDR_LEN + j] ^= fbuf[offset + j];
+    }
+
+    pmax = (plen > pmax) ? plen : pmax;
+
+    if ((frag % pmcast->fec) == (pmcast->fec - 1) || frag == nfrags - 1)
+    {
+      _camwebsrv_mcast_header(pmcast->parity, _CAMWEBSRV_MCAST_FLAG_PARITY, pmcast->fseq, frag - (frag % pmcast->fec), nfrags, flen, pmcast->fec, pmax);
+
+      rv = camwebsrv_udp_sendto(pmcast->sock, pmcast->parity, _CAMWEBSRV_MCAST_HDR_LEN + pmax, (struct sockaddr *) &(pmcast->addr), sizeof(pmcast->addr), CAMWEBSRV_MCAST_SEND_RETRIES);
+
+      if (rv != ESP_OK)
+      {
+        return rv;
+      }
+    }
+  }
+
+  return ESP_OK;
+}
+
+static void _camwebsrv_mcast_header(uint8_t *p, uint8_t flags, uint32_t fseq, uint16_t frag, uint16_t nfrags, uint32_t flen, uint8_t fec, uint16_t plen)
+{
+  *p++ = 'C';
+  *p++ = 'M';
+  *p++ = _CAMWEBSRV_MCAST_VERSION;
+  *p++ = flags;
+  *p++ = (uint8_t) (fseq >> 24);
+  *p++ = (uint8_t) (fseq >> 16);
+  *p++ = (uint8_t) (fseq >> 8);
+  *p++ = (uint8_t) fseq;
+  *p++ = (uint8_t) (frag >> 8);
+  *p++ = (uint8_t) frag;
+  *p++ = (uint8_t) (nfrags >> 8);
+  *p++ = (uint8_t) nfrags;
+  *p++ = (uint8_t) (flen >> 24);
+  *p++ = (uint8_t) (flen >> 16);
+  *p++ = (uint8_t) (flen >> 8);
+  *p++ = (uint8_t) flen;
+  *p++ = fec;
+  *p++ = 0;
+  *p++ = (uint8_t) (plen >> 8);
+  *p++ = (uint8_t) plen;
+}
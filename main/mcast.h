@@ -0,0 +1,19 @@
+// 2026-10-16 mcast.h
+// Copyright (C) 2023 Vino Fernando Crescini  <vfcrescini@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _CAMWEBSRV_MCAST_H
+#define _CAMWEBSRV_MCAST_H
+
+#include "cfgman.h"
+#include "camera.h"
+
+#include <esp_err.h>
+
+typedef void *camwebsrv_mcast_t;
+
+esp_err_t camwebsrv_mcast_init(camwebsrv_mcast_t *mcast, camwebsrv_cfgman_t cfgman, camwebsrv_camera_t cam);
+esp_err_t camwebsrv_mcast_destroy(camwebsrv_mcast_t *mcast);
+esp_err_t camwebsrv_mcast_start(camwebsrv_mcast_t mcast);
+
+#endif
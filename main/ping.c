@@ -175,7 +175,7 @@ esp_err_t camwebsrv_ping_destroy(camwebsrv_ping_t *ping)
   return ESP_OK;
 }
 
-esp_err_t camwebsrv_ping_process(camwebsrv_ping_t ping, uint16_t *nextevent)
+esp_err_t camwebsrv_ping_process(camwebsrv_ping_t ping, camwebsrv_sched_t sched)
 {
   esp_err_t rv;
   _camwebsrv_ping_t *pping;
@@ -201,9 +201,9 @@ esp_err_t camwebsrv_ping_process(camwebsrv_ping_t ping, uint16_t *nextevent)
 
   if (pping->teventnext > 0 && tnow < pping->teventnext)
   {
-    if (nextevent != NULL)
+    if (sched != NULL)
     {
-      *nextevent = pping->teventnext - tnow;
+      camwebsrv_sched_at(sched, pping, pping->teventnext * 1000);
     }
 
     return ESP_OK;
@@ -261,9 +261,9 @@ esp_err_t camwebsrv_ping_process(camwebsrv_ping_t ping, uint16_t *nextevent)
 
           pping->teventnext = tnow + CAMWEBSRV_PING_WAIT_INTERVAL;
           
-          if (nextevent != NULL && *nextevent > (pping->teventnext - tnow))
+          if (sched != NULL)
           {
-            *nextevent = pping->teventnext - tnow;
+            camwebsrv_sched_at(sched, pping, pping->teventnext * 1000);
           }
 
           return ESP_OK;
@@ -337,9 +337,9 @@ esp_err_t camwebsrv_ping_process(camwebsrv_ping_t ping, uint16_t *nextevent)
         {
           pping->teventnext = tnow + CAMWEBSRV_PING_WAIT_INTERVAL;
 
-          if (nextevent != NULL && *nextevent > (pping->teventnext - tnow))
+          if (sched != NULL)
           {
-            *nextevent = pping->teventnext - tnow;
+            camwebsrv_sched_at(sched, pping, pping->teventnext * 1000);
           }
 
           return ESP_OK;
@@ -357,9 +357,9 @@ esp_err_t camwebsrv_ping_process(camwebsrv_ping_t ping, uint16_t *nextevent)
 
         if (tnow < pping->teventnext)
         {
-          if (nextevent != NULL && *nextevent > (pping->teventnext - tnow))
+          if (sched != NULL)
           {
-            *nextevent = pping->teventnext - tnow;
+            camwebsrv_sched_at(sched, pping, pping->teventnext * 1000);
           }
 
           return ESP_OK;
@@ -6,6 +6,7 @@
 #define _CAMWEBSRV_PING_H
 
 #include "cfgman.h"
+#include "sched.h"
 
 #include <esp_err.h>
 
@@ -13,6 +14,6 @@ typedef void *camwebsrv_ping_t;
 
 esp_err_t camwebsrv_ping_init(camwebsrv_ping_t *ping, camwebsrv_cfgman_t cfgman);
 esp_err_t camwebsrv_ping_destroy(camwebsrv_ping_t *ping);
-esp_err_t camwebsrv_ping_process(camwebsrv_ping_t ping, uint16_t *nextevent);
+esp_err_t camwebsrv_ping_process(camwebsrv_ping_t ping, camwebsrv_sched_t sched);
 
 #endif
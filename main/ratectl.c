@@ -0,0 +1,445 @@
+// 2026-10-16 ratectl.c
+// Copyright (C) 2023 Vino Fernando Crescini  <vfcrescini@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "config.h"
+#include "ratectl.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+typedef struct
+{
+  camwebsrv_camera_t cam;
+  camwebsrv_sclients_t sclients;
+  uint32_t bytes;
+  uint32_t bitrate;
+  bool framesize;
+  bool enabled;
+  int quality;
+  int fsize;
+  int fsmax;
+  uint32_t target;
+  uint32_t average;
+  uint32_t changes;
+  uint8_t over;
+  uint8_t under;
+  int64_t teventlast;
+} _camwebsrv_ratectl_t;
+
+static esp_err_t _camwebsrv_ratectl_get_uint(camwebsrv_cfgman_t cfgman, const char *kstr, uint32_t *value);
+static esp_err_t _camwebsrv_ratectl_step(_camwebsrv_ratectl_t *pratectl, bool up);
+
+esp_err_t camwebsrv_ratectl_init(camwebsrv_ratectl_t *ratectl, camwebsrv_cfgman_t cfgman, camwebsrv_camera_t cam, camwebsrv_sclients_t sclients)
+{
+  esp_err_t rv;
+  _camwebsrv_ratectl_t *pratectl;
+  uint32_t bytes = 0;
+  uint32_t bitrate = 0;
+  uint32_t framesize = 0;
+
+  if (ratectl == NULL || cfgman == NULL || cam == NULL || sclients == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // get targets; with neither set, the controller stays out of the way
+
+  rv = _camwebsrv_ratectl_get_uint(cfgman, CAMWEBSRV_CFGMAN_KEY_RATECTL_BYTES, &bytes);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "RATECTL camwebsrv_ratectl_init(): _camwebsrv_ratectl_get_uint(%s) failed: [%d]: %s", CAMWEBSRV_CFGMAN_KEY_RATECTL_BYTES, rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  rv = _camwebsrv_ratectl_get_uint(cfgman, CAMWEBSRV_CFGMAN_KEY_RATECTL_BITRATE, &bitrate);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "RATECTL camwebsrv_ratectl_init(): _camwebsrv_ratectl_get_uint(%s) failed: [%d]: %s", CAMWEBSRV_CFGMAN_KEY_RATECTL_BITRATE, rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  rv = _camwebsrv_ratectl_get_uint(cfgman, CAMWEBSRV_CFGMAN_KEY_RATECTL_FRAMESIZE, &framesize);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "RATECTL camwebsrv_ratectl_init(): _camwebsrv_ratectl_get_uint(%s) failed: [%d]: %s", CAMWEBSRV_CFGMAN_KEY_RATECTL_FRAMESIZE, rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  // allocate space for new structure
+
+  pratectl = (_camwebsrv_ratectl_t *) malloc(sizeof(_camwebsrv_ratectl_t));
+
+  if (pratectl == NULL)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "RATECTL camwebsrv_ratectl_init(): malloc() failed: [%d]: %s", e, strerror(e));
+    return ESP_ERR_NO_MEM;
+  }
+
+  // initialise structure
+
+  memset(pratectl, 0x00, sizeof(_camwebsrv_ratectl_t));
+
+  pratectl->cam = cam;
+  pratectl->sclients = sclients;
+  pratectl->bytes = bytes;
+  pratectl->bitrate = bitrate;
+  pratectl->framesize = (framesize != 0);
+  pratectl->enabled = (bytes > 0 || bitrate > 0);
+  pratectl->quality = -1;
+  pratectl->fsize = -1;
+  pratectl->fsmax = -1;
+
+  if (pratectl->enabled)
+  {
+    ESP_LOGI(CAMWEBSRV_TAG, "RATECTL camwebsrv_ratectl_init(): enabled; frame size: %u bytes; bitrate: %u bps; framesize control: %s", bytes, bitrate, pratectl->framesize ? "on" : "off");
+  }
+  else
+  {
+    ESP_LOGI(CAMWEBSRV_TAG, "RATECTL camwebsrv_ratectl_init(): disabled");
+  }
+
+  *ratectl = (camwebsrv_ratectl_t) pratectl;
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_ratectl_destroy(camwebsrv_ratectl_t *ratectl)
+{
+  if (ratectl == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  free(*ratectl);
+
+  *ratectl = NULL;
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_ratectl_process(camwebsrv_ratectl_t ratectl, camwebsrv_sched_t sched)
+{
+  esp_err_t rv;
+  _camwebsrv_ratectl_t *pratectl;
+  camwebsrv_sclients_rate_t rate;
+  int64_t tnow;
+  int64_t period;
+  uint32_t sample;
+  uint32_t target;
+  uint32_t band;
+  uint8_t fps;
+  int quality;
+  int fsize;
+
+  if (ratectl == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  pratectl = (_camwebsrv_ratectl_t *) ratectl;
+
+  // are we enabled?
+
+  if (!pratectl->enabled)
+  {
+    return ESP_OK;
+  }
+
+  // is it time for another look?
+
+  tnow = esp_timer_get_time() / 1000;
+
+  if (pratectl->teventlast > 0 && tnow < (pratectl->teventlast + CAMWEBSRV_RATECTL_PERIOD_MSEC))
+  {
+    if (sched != NULL)
+    {
+      camwebsrv_sched_at(sched, pratectl, (pratectl->teventlast + CAMWEBSRV_RATECTL_PERIOD_MSEC) * 1000);
+    }
+
+    return ESP_OK;
+  }
+
+  period = (pratectl->teventlast > 0) ? (tnow - pratectl->teventlast) : 0;
+
+  pratectl->teventlast = tnow;
+
+  if (sched != NULL)
+  {
+    camwebsrv_sched_at(sched, pratectl, (tnow + CAMWEBSRV_RATECTL_PERIOD_MSEC) * 1000);
+  }
+
+  // what did the stream clients get through since last time? this also
+  // starts the next measurement period
+
+  rv = camwebsrv_sclients_rate_stats(pratectl->sclients, &rate);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "RATECTL camwebsrv_ratectl_process(): camwebsrv_sclients_rate_stats() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  // changes made through /control become the new starting point, and the
+  // framesize picked there becomes the largest we'll go back up to
+
+  quality = camwebsrv_camera_ctrl_get(pratectl->cam, "quality");
+  fsize = camwebsrv_camera_ctrl_get(pratectl->cam, "framesize");
+
+  if (quality < 0 || fsize < 0)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "RATECTL camwebsrv_ratectl_process(): camwebsrv_camera_ctrl_get() failed");
+    return ESP_FAIL;
+  }
+
+  if (quality != pratectl->quality || fsize != pratectl->fsize)
+  {
+    if (fsize != pratectl->fsize)
+    {
+      pratectl->fsmax = fsize;
+    }
+
+    pratectl->quality = quality;
+    pratectl->fsize = fsize;
+    pratectl->average = 0;
+    pratectl->over = 0;
+    pratectl->under = 0;
+
+    ESP_LOGD(CAMWEBSRV_TAG, "RATECTL camwebsrv_ratectl_process(): starting from quality %d, framesize %d", quality, fsize);
+  }
+
+  // nothing to go by if nobody is watching, or on the very first pass
+
+  if (period == 0 || rate.clients == 0 || rate.frames == 0)
+  {
+    return ESP_OK;
+  }
+
+  // smooth out the frame size a bit, since it changes with the scene
+
+  sample = rate.fbytes / rate.frames;
+
+  pratectl->average = (pratectl->average == 0) ? sample : ((pratectl->average * 3) + sample) / 4;
+
+  // work out how big a frame can be, from the configured targets
+
+  fps = camwebsrv_camera_fps_get(pratectl->cam);
+
+  target = pratectl->bytes;
+
+  if (pratectl->bitrate > 0 && fps > 0)
+  {
+    uint32_t t = pratectl->bitrate / 8 / fps;
+
+    if (target == 0 || t < target)
+    {
+      target = t;
+    }
+  }
+
+  // if a client had to wait on its socket and still has something left to
+  // send, the link is the limit, so what the slowest of those actually got
+  // through sets the ceiling
+
+  if (rate.stalls > 0 && rate.backlog > 0 && rate.slowest != UINT32_MAX && fps > 0)
+  {
+    uint32_t t = (uint32_t) ((((uint64_t) rate.slowest * 1000) / period / fps) * CAMWEBSRV_RATECTL_HEADROOM_PCT / 100);
+
+    if (t < target)
+    {
+      target = t;
+    }
+  }
+
+  pratectl->target = target;
+
+  // only act if we've been outside the band for a while
+
+  band = (target * CAMWEBSRV_RATECTL_HYSTERESIS_PCT) / 100;
+
+  if (pratectl->average > (target + band))
+  {
+    pratectl->over++;
+    pratectl->under = 0;
+  }
+  else if (pratectl->average < (target - band))
+  {
+    pratectl->under++;
+    pratectl->over = 0;
+  }
+  else
+  {
+    pratectl->over = 0;
+    pratectl->under = 0;
+  }
+
+  ESP_LOGD(CAMWEBSRV_TAG, "RATECTL camwebsrv_ratectl_process(): clients: %u; frame: %u bytes; average: %u bytes; target: %u bytes; stalls: %u; backlog: %u bytes", rate.clients, sample, pratectl->average, target, rate.stalls, rate.backlog);
+
+  if (pratectl->over >= CAMWEBSRV_RATECTL_HOLD)
+  {
+    return _camwebsrv_ratectl_step(pratectl, false);
+  }
+
+  if (pratectl->under >= CAMWEBSRV_RATECTL_HOLD)
+  {
+    return _camwebsrv_ratectl_step(pratectl, true);
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_ratectl_stats(camwebsrv_ratectl_t ratectl, camwebsrv_ratectl_stats_t *stats)
+{
+  _camwebsrv_ratectl_t *pratectl;
+
+  if (ratectl == NULL || stats == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  pratectl = (_camwebsrv_ratectl_t *) ratectl;
+
+  stats->enabled = pratectl->enabled;
+  stats->target = pratectl->target;
+  stats->average = pratectl->average;
+  stats->changes = pratectl->changes;
+
+  return ESP_OK;
+}
+
+static esp_err_t _camwebsrv_ratectl_get_uint(camwebsrv_cfgman_t cfgman, const char *kstr, uint32_t *value)
+{
+  esp_err_t rv;
+  const char *vstr = NULL;
+  char *end = NULL;
+  long l;
+
+  *value = 0;
+
+  rv = camwebsrv_cfgman_get(cfgman, kstr, &vstr);
+
+  // missing or blank means off
+
+  if (rv == ESP_ERR_NOT_FOUND || (rv == ESP_OK && (vstr == NULL || strlen(vstr) == 0)))
+  {
+    return ESP_OK;
+  }
+
+  if (rv != ESP_OK)
+  {
+    return rv;
+  }
+
+  l = strtol(vstr, &end, 10);
+
+  if (*end != '\0' || l < 0)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "RATECTL _camwebsrv_ratectl_get_uint(%s): invalid value \"%s\"", kstr, vstr);
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  *value = (uint32_t) l;
+
+  return ESP_OK;
+}
+
+static esp_err_t _camwebsrv_ratectl_step(_camwebsrv_ratectl_t *pratectl, bool up)
+{
+  esp_err_t rv;
+  camwebsrv_camera_ctrl_change_t change;
+  uint32_t batch;
+  const char *name = NULL;
+  int from = 0;
+  int to = 0;
+
+  pratectl->over = 0;
+  pratectl->under = 0;
+
+  // going down, give up quality first, then resolution; going up, undo it
+  // in reverse
+
+  if (up)
+  {
+    if (pratectl->framesize && pratectl->fsize < pratectl->fsmax)
+    {
+      name = "framesize";
+      from = pratectl->fsize;
+      to = pratectl->fsize + 1;
+    }
+    else if (pratectl->quality > CAMWEBSRV_RATECTL_QUALITY_MIN)
+    {
+      name = "quality";
+      from = pratectl->quality;
+      to = pratectl->quality - CAMWEBSRV_RATECTL_QUALITY_STEP;
+      to = (to < CAMWEBSRV_RATECTL_QUALITY_MIN) ? CAMWEBSRV_RATECTL_QUALITY_MIN : to;
+    }
+  }
+  else
+  {
+    if (pratectl->quality < CAMWEBSRV_RATECTL_QUALITY_MAX)
+    {
+      name = "quality";
+      from = pratectl->quality;
+      to = pratectl->quality + CAMWEBSRV_RATECTL_QUALITY_STEP;
+      to = (to > CAMWEBSRV_RATECTL_QUALITY_MAX) ? CAMWEBSRV_RATECTL_QUALITY_MAX : to;
+    }
+    else if (pratectl->framesize && pratectl->fsize > CAMWEBSRV_RATECTL_FRAMESIZE_MIN)
+    {
+      name = "framesize";
+      from = pratectl->fsize;
+      to = pratectl->fsize - 1;
+    }
+  }
+
+  // already as far as the bounds allow?
+
+  if (name == NULL)
+  {
+    ESP_LOGD(CAMWEBSRV_TAG, "RATECTL _camwebsrv_ratectl_step(): average %u bytes, target %u bytes; already at the %s bound", pratectl->average, pratectl->target, up ? "upper" : "lower");
+    return ESP_OK;
+  }
+
+  // queue it for the producer to apply between two frames; nothing here
+  // needs to know when that happens, so don't wait for it
+
+  memset(&change, 0x00, sizeof(change));
+
+  change.name = name;
+  change.value = to;
+
+  rv = camwebsrv_camera_ctrl_queue(pratectl->cam, &change, 1, &batch);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "RATECTL _camwebsrv_ratectl_step(): camwebsrv_camera_ctrl_queue(\"%s\", %d) failed: [%d]: %s", name, to, rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  if (strcmp(name, "quality") == 0)
+  {
+    pratectl->quality = to;
+  }
+  else
+  {
+    pratectl->fsize = to;
+  }
+
+  // frames from here on will look different, so start averaging afresh
+
+  pratectl->average = 0;
+  pratectl->changes++;
+
+  ESP_LOGI(CAMWEBSRV_TAG, "RATECTL _camwebsrv_ratectl_step(): target %u bytes; %s %d -> %d", pratectl->target, name, from, to);
+
+  return ESP_OK;
+}
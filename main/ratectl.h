@@ -0,0 +1,33 @@
+// 2026-10-16 ratectl.h
+// Copyright (C) 2023 Vino Fernando Crescini  <vfcrescini@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _CAMWEBSRV_RATECTL_H
+#define _CAMWEBSRV_RATECTL_H
+
+#include "cfgman.h"
+#include "camera.h"
+#include "sclients.h"
+#include "sched.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <esp_err.h>
+
+typedef void *camwebsrv_ratectl_t;
+
+typedef struct
+{
+  bool enabled;
+  uint32_t target;
+  uint32_t average;
+  uint32_t changes;
+} camwebsrv_ratectl_stats_t;
+
+esp_err_t camwebsrv_ratectl_init(camwebsrv_ratectl_t *ratectl, camwebsrv_cfgman_t cfgman, camwebsrv_camera_t cam, camwebsrv_sclients_t sclients);
+esp_err_t camwebsrv_ratectl_destroy(camwebsrv_ratectl_t *ratectl);
+esp_err_t camwebsrv_ratectl_process(camwebsrv_ratectl_t ratectl, camwebsrv_sched_t sched);
+esp_err_t camwebsrv_ratectl_stats(camwebsrv_ratectl_t ratectl, camwebsrv_ratectl_stats_t *stats);
+
+#endif
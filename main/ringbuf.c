@@ -0,0 +1,225 @@
+// 2026-10-16 ringbuf.c
+// Copyright (C) 2023 Vino Fernando Crescini  <vfcrescini@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "config.h"
+#include "ringbuf.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <esp_log.h>
+#include <esp_err.h>
+
+typedef struct
+{
+  uint8_t *buf;
+  size_t capacity;
+  size_t head;
+  size_t len;
+  size_t hwm;
+} _camwebsrv_ringbuf_t;
+
+esp_err_t camwebsrv_ringbuf_init(camwebsrv_ringbuf_t *rb, size_t capacity)
+{
+  _camwebsrv_ringbuf_t *prb;
+
+  if (rb == NULL || capacity == 0)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  prb = (_camwebsrv_ringbuf_t *) malloc(sizeof(_camwebsrv_ringbuf_t));
+
+  if (prb == NULL)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "RINGBUF camwebsrv_ringbuf_init(): malloc() failed: [%d]: %s", e, strerror(e));
+    return ESP_FAIL;
+  }
+
+  // the byte array is allocated once, and never grows
+
+  prb->buf = (uint8_t *) malloc(capacity * sizeof(uint8_t));
+
+  if (prb->buf == NULL)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "RINGBUF camwebsrv_ringbuf_init(): malloc(%u) failed: [%d]: %s", capacity, e, strerror(e));
+    free(prb);
+    return ESP_FAIL;
+  }
+
+  prb->capacity = capacity;
+  prb->head = 0;
+  prb->len = 0;
+  prb->hwm = 0;
+
+  *rb = prb;
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_ringbuf_destroy(camwebsrv_ringbuf_t *rb)
+{
+  _camwebsrv_ringbuf_t *prb;
+
+  if (rb == NULL || *rb == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  prb = (_camwebsrv_ringbuf_t *) *rb;
+
+  free(prb->buf);
+  free(prb);
+
+  *rb = NULL;
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_ringbuf_write(camwebsrv_ringbuf_t rb, const uint8_t *bytes, size_t len)
+{
+  _camwebsrv_ringbuf_t *prb;
+  size_t tail;
+  size_t part;
+
+  if (rb == NULL || (bytes == NULL && len != 0))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  prb = (_camwebsrv_ringbuf_t *) rb;
+
+  // all or nothing; never overwrite unread data
+
+  if (len > (prb->capacity - prb->len))
+  {
+    ESP_LOGW(CAMWEBSRV_TAG, "RINGBUF camwebsrv_ringbuf_write(): %u bytes won't fit; %u of %u used", len, prb->len, prb->capacity);
+    return ESP_ERR_NO_MEM;
+  }
+
+  // copy up to the end of the array, then wrap around for the rest
+
+  tail = (prb->head + prb->len) % prb->capacity;
+  part = (len < (prb->capacity - tail)) ? len : (prb->capacity - tail);
+
+  memcpy(prb->buf + tail, bytes, part);
+  memcpy(prb->buf, bytes + part, len - part);
+
+  prb->len = prb->len + len;
+
+  if (prb->len > prb->hwm)
+  {
+    prb->hwm = prb->len;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_ringbuf_peek(camwebsrv_ringbuf_t rb, const uint8_t **bytes1, size_t *len1, const uint8_t **bytes2, size_t *len2)
+{
+  _camwebsrv_ringbuf_t *prb;
+
+  if (rb == NULL || bytes1 == NULL || len1 == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  prb = (_camwebsrv_ringbuf_t *) rb;
+
+  // first run starts at the read index, and ends at the end of the array or
+  // at the end of the unread data, whichever comes first
+
+  *bytes1 = prb->buf + prb->head;
+  *len1 = (prb->len < (prb->capacity - prb->head)) ? prb->len : (prb->capacity - prb->head);
+
+  // second run, if requested, is whatever wrapped around to the start of the
+  // array
+
+  if (bytes2 != NULL && len2 != NULL)
+  {
+    *bytes2 = prb->buf;
+    *len2 = prb->len - *len1;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_ringbuf_consume(camwebsrv_ringbuf_t rb, size_t len)
+{
+  _camwebsrv_ringbuf_t *prb;
+
+  if (rb == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  prb = (_camwebsrv_ringbuf_t *) rb;
+
+  if (len > prb->len)
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  // just move the read index
+
+  prb->head = (prb->head + len) % prb->capacity;
+  prb->len = prb->len - len;
+
+  if (prb->len == 0)
+  {
+    prb->head = 0;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_ringbuf_clear(camwebsrv_ringbuf_t rb)
+{
+  _camwebsrv_ringbuf_t *prb;
+
+  if (rb == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  prb = (_camwebsrv_ringbuf_t *) rb;
+
+  prb->head = 0;
+  prb->len = 0;
+
+  return ESP_OK;
+}
+
+size_t camwebsrv_ringbuf_length(camwebsrv_ringbuf_t rb)
+{
+  if (rb == NULL)
+  {
+    return 0;
+  }
+
+  return ((_camwebsrv_ringbuf_t *) rb)->len;
+}
+
+size_t camwebsrv_ringbuf_capacity(camwebsrv_ringbuf_t rb)
+{
+  if (rb == NULL)
+  {
+    return 0;
+  }
+
+  return ((_camwebsrv_ringbuf_t *) rb)->capacity;
+}
+
+size_t camwebsrv_ringbuf_highwater(camwebsrv_ringbuf_t rb)
+{
+  if (rb == NULL)
+  {
+    return 0;
+  }
+
+  return ((_camwebsrv_ringbuf_t *) rb)->hwm;
+}
@@ -0,0 +1,25 @@
+// 2026-10-16 ringbuf.h
+// Copyright (C) 2023 Vino Fernando Crescini  <vfcrescini@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _CAMWEBSRV_RINGBUF_H
+#define _CAMWEBSRV_RINGBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+
+typedef void *camwebsrv_ringbuf_t;
+
+esp_err_t camwebsrv_ringbuf_init(camwebsrv_ringbuf_t *rb, size_t capacity);
+esp_err_t camwebsrv_ringbuf_destroy(camwebsrv_ringbuf_t *rb);
+esp_err_t camwebsrv_ringbuf_write(camwebsrv_ringbuf_t rb, const uint8_t *bytes, size_t len);
+esp_err_t camwebsrv_ringbuf_peek(camwebsrv_ringbuf_t rb, const uint8_t **bytes1, size_t *len1, const uint8_t **bytes2, size_t *len2);
+esp_err_t camwebsrv_ringbuf_consume(camwebsrv_ringbuf_t rb, size_t len);
+esp_err_t camwebsrv_ringbuf_clear(camwebsrv_ringbuf_t rb);
+size_t camwebsrv_ringbuf_length(camwebsrv_ringbuf_t rb);
+size_t camwebsrv_ringbuf_capacity(camwebsrv_ringbuf_t rb);
+size_t camwebsrv_ringbuf_highwater(camwebsrv_ringbuf_t rb);
+
+#endif
@@ -0,0 +1,1400 @@
+// 2026-10-16 rtsp.c
+// Copyright (C) 2023 Vino Fernando Crescini  <vfcrescini@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "config.h"
+#include "rtsp.h"
+#include "udp.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <lwip/inet.h>
+#include <lwip/sockets.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_idf_version.h>
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
+#include <esp_random.h>
+#else
+#include <esp_system.h>
+#endif
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+// RTP/JPEG, RFC 2435
+
+#define _CAMWEBSRV_RTSP_RTP_PT 26
+#define _CAMWEBSRV_RTSP_RTP_CLOCK 90000
+#define _CAMWEBSRV_RTSP_QT_LEN 64
+#define _CAMWEBSRV_RTSP_QT_Q_BASE 128
+#define _CAMWEBSRV_RTSP_DIM_MAX 2040
+
+#define _CAMWEBSRV_RTSP_RESP_LEN 768
+#define _CAMWEBSRV_RTSP_METHOD_LEN 16
+#define _CAMWEBSRV_RTSP_URL_LEN 128
+#define _CAMWEBSRV_RTSP_HDR_VAL_LEN 128
+
+#define _CAMWEBSRV_RTSP_RESP_HDR_STR "RTSP/1.0 %d %s\r\nCSeq: %u\r\n"
+#define _CAMWEBSRV_RTSP_RESP_SESSION_STR "Session: %08X;timeout=%u\r\n"
+#define _CAMWEBSRV_RTSP_RESP_PUBLIC_STR "Public: OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, GET_PARAMETER\r\n"
+#define _CAMWEBSRV_RTSP_RESP_TRANSPORT_STR "Transport: RTP/AVP;unicast;client_port=%u-%u;server_port=%u-%u;ssrc=%08X\r\n"
+#define _CAMWEBSRV_RTSP_RESP_DESCRIBE_STR "Content-Base: %s/\r\nContent-Type: application/sdp\r\nContent-Length: %d\r\n"
+#define _CAMWEBSRV_RTSP_RESP_SDP_STR "\
+v=0\r\n\
+o=- %u 1 IN IP4 %s\r\n\
+s=esp32-cam-websrv\r\n\
+c=IN IP4 0.0.0.0\r\n\
+t=0 0\r\n\
+m=video 0 RTP/AVP 26\r\n\
+a=control:track0\r\n"
+
+typedef enum
+{
+  _CAMWEBSRV_RTSP_STATE_INIT,
+  _CAMWEBSRV_RTSP_STATE_READY,
+  _CAMWEBSRV_RTSP_STATE_PLAYING
+} _camwebsrv_rtsp_state_t;
+
+typedef struct
+{
+  int sock;
+  struct sockaddr_in addr;
+  _camwebsrv_rtsp_state_t state;
+  char rbuf[CAMWEBSRV_RTSP_REQ_LEN + 1];
+  size_t rlen;
+  uint32_t id;
+  uint32_t ssrc;
+  uint16_t rtpseq;
+  uint32_t qsent;
+  uint16_t qframes;
+  int64_t tactive;
+  bool active;
+} _camwebsrv_rtsp_session_t;
+
+typedef struct
+{
+  uint8_t tables[_CAMWEBSRV_RTSP_QT_LEN * 2];
+  uint32_t tused;
+  bool valid;
+} _camwebsrv_rtsp_qtable_t;
+
+typedef struct
+{
+  const uint8_t *scan;
+  size_t slen;
+  const uint8_t *qt[2];
+  uint16_t width;
+  uint16_t height;
+  uint16_t dri;
+  uint8_t type;
+} _camwebsrv_rtsp_jpeg_t;
+
+typedef struct
+{
+  camwebsrv_camera_t cam;
+  SemaphoreHandle_t done;
+  TaskHandle_t task;
+  volatile bool stop;
+  bool enabled;
+  uint16_t port;
+  int lsock;
+  int usock;
+  int csock;
+  uint32_t fseq;
+  uint32_t frames;
+  int64_t tframelast;
+  _camwebsrv_rtsp_session_t sessions[CAMWEBSRV_RTSP_MAX_SESSIONS];
+  _camwebsrv_rtsp_qtable_t qtables[CAMWEBSRV_RTSP_QTABLES];
+  uint8_t pkt[CAMWEBSRV_RTSP_PACKET_LEN];
+  char resp[_CAMWEBSRV_RTSP_RESP_LEN];
+} _camwebsrv_rtsp_t;
+
+static void _camwebsrv_rtsp_task(void *arg);
+static esp_err_t _camwebsrv_rtsp_process(_camwebsrv_rtsp_t *prtsp, uint16_t *nextevent);
+static esp_err_t _camwebsrv_rtsp_poll(_camwebsrv_rtsp_t *prtsp, uint16_t timeout);
+static esp_err_t _camwebsrv_rtsp_accept(_camwebsrv_rtsp_t *prtsp);
+static esp_err_t _camwebsrv_rtsp_rtcp(_camwebsrv_rtsp_t *prtsp);
+static esp_err_t _camwebsrv_rtsp_frame_send(_camwebsrv_rtsp_t *prtsp, camwebsrv_camera_frame_t frame);
+static esp_err_t _camwebsrv_rtsp_jpeg_parse(const uint8_t *fbuf, size_t flen, _camwebsrv_rtsp_jpeg_t *jpeg);
+static uint8_t _camwebsrv_rtsp_qtable_get(_camwebsrv_rtsp_t *prtsp, const _camwebsrv_rtsp_jpeg_t *jpeg);
+static esp_err_t _camwebsrv_rtsp_session_read(_camwebsrv_rtsp_t *prtsp, _camwebsrv_rtsp_session_t *psess);
+static esp_err_t _camwebsrv_rtsp_session_request(_camwebsrv_rtsp_t *prtsp, _camwebsrv_rtsp_session_t *psess, char *req);
+static esp_err_t _camwebsrv_rtsp_session_reply(_camwebsrv_rtsp_session_t *psess, const char *buf, size_t len);
+static esp_err_t _camwebsrv_rtsp_session_send(_camwebsrv_rtsp_t *prtsp, _camwebsrv_rtsp_session_t *psess, const _camwebsrv_rtsp_jpeg_t *jpeg, uint8_t qindex, uint32_t tstamp);
+static void _camwebsrv_rtsp_session_close(_camwebsrv_rtsp_session_t *psess);
+static bool _camwebsrv_rtsp_header(const char *req, const char *name, char *val, size_t len);
+
+esp_err_t camwebsrv_rtsp_init(camwebsrv_rtsp_t *rtsp, camwebsrv_cfgman_t cfgman, camwebsrv_camera_t cam)
+{
+  _camwebsrv_rtsp_t *prtsp;
+  const char *vstr = NULL;
+  esp_err_t rv;
+  long port = 0;
+  uint8_t i;
+
+  if (rtsp == NULL || cfgman == NULL || cam == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // get port; a missing or blank port disables the server
+
+  rv = camwebsrv_cfgman_get(cfgman, CAMWEBSRV_CFGMAN_KEY_RTSP_PORT, &vstr);
+
+  if (rv != ESP_OK && rv != ESP_ERR_NOT_FOUND)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "RTSP camwebsrv_rtsp_init(): camwebsrv_cfgman_get(%s) failed: [%d]: %s", CAMWEBSRV_CFGMAN_KEY_RTSP_PORT, rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  if (rv == ESP_OK && vstr != NULL && strlen(vstr) > 0)
+  {
+    char *end = NULL;
+
+    port = strtol(vstr, &end, 10);
+
+    if (end == NULL || *end != '\0' || port <= 0 || port > 65535)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "RTSP camwebsrv_rtsp_init(): invalid %s: %s", CAMWEBSRV_CFGMAN_KEY_RTSP_PORT, vstr);
+      return ESP_ERR_INVALID_ARG;
+    }
+  }
+
+  // allocate space for new structure
+
+  prtsp = (_camwebsrv_rtsp_t *) malloc(sizeof(_camwebsrv_rtsp_t));
+
+  if (prtsp == NULL)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "RTSP camwebsrv_rtsp_init(): malloc() failed: [%d]: %s", e, strerror(e));
+    return ESP_ERR_NO_MEM;
+  }
+
+  memset(prtsp, 0x00, sizeof(_camwebsrv_rtsp_t));
+
+  prtsp->done = xSemaphoreCreateBinary();
+
+  if (prtsp->done == NULL)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "RTSP camwebsrv_rtsp_init(): xSemaphoreCreateBinary() failed");
+    free(prtsp);
+    return ESP_FAIL;
+  }
+
+  prtsp->cam = cam;
+  prtsp->task = NULL;
+  prtsp->stop = false;
+  prtsp->port = (uint16_t) port;
+  prtsp->enabled = (port > 0);
+  prtsp->lsock = -1;
+  prtsp->usock = -1;
+  prtsp->csock = -1;
+
+  for (i = 0; i < CAMWEBSRV_RTSP_MAX_SESSIONS; i++)
+  {
+    prtsp->sessions[i].sock = -1;
+    prtsp->sessions[i].active = false;
+  }
+
+  if (prtsp->enabled)
+  {
+    ESP_LOGI(CAMWEBSRV_TAG, "RTSP camwebsrv_rtsp_init(): enabled; port %u", prtsp->port);
+  }
+  else
+  {
+    ESP_LOGI(CAMWEBSRV_TAG, "RTSP camwebsrv_rtsp_init(): disabled");
+  }
+
+  *rtsp = (camwebsrv_rtsp_t) prtsp;
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_rtsp_destroy(camwebsrv_rtsp_t *rtsp)
+{
+  _camwebsrv_rtsp_t *prtsp;
+  uint8_t i;
+
+  if (rtsp == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  prtsp = (_camwebsrv_rtsp_t *) *rtsp;
+
+  // stop the server task; it never blocks for longer than the poll interval
+
+  if (prtsp->task != NULL)
+  {
+    prtsp->stop = true;
+
+    xSemaphoreTake(prtsp->done, portMAX_DELAY);
+
+    prtsp->task = NULL;
+  }
+
+  for (i = 0; i < CAMWEBSRV_RTSP_MAX_SESSIONS; i++)
+  {
+    _camwebsrv_rtsp_session_close(&(prtsp->sessions[i]));
+  }
+
+  if (prtsp->lsock >= 0)
+  {
+    close(prtsp->lsock);
+  }
+
+  if (prtsp->usock >= 0)
+  {
+    close(prtsp->usock);
+  }
+
+  if (prtsp->csock >= 0)
+  {
+    close(prtsp->csock);
+  }
+
+  vSemaphoreDelete(prtsp->done);
+
+  free(prtsp);
+
+  *rtsp = NULL;
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_rtsp_start(camwebsrv_rtsp_t rtsp)
+{
+  _camwebsrv_rtsp_t *prtsp;
+  struct sockaddr_in addr;
+  int opt = 1;
+
+  if (rtsp == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  prtsp = (_camwebsrv_rtsp_t *) rtsp;
+
+  if (!prtsp->enabled || prtsp->task != NULL)
+  {
+    return ESP_OK;
+  }
+
+  // control connections
+
+  prtsp->lsock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+  if (prtsp->lsock < 0)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "RTSP camwebsrv_rtsp_start(): socket() failed: [%d]: %s", e, strerror(e));
+    return ESP_FAIL;
+  }
+
+  setsockopt(prtsp->lsock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+  memset(&addr, 0x00, sizeof(addr));
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(prtsp->port);
+
+  if (bind(prtsp->lsock, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(prtsp->lsock, CAMWEBSRV_RTSP_MAX_SESSIONS) != 0)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "RTSP camwebsrv_rtsp_start(): bind()/listen(%u) failed: [%d]: %s", prtsp->port, e, strerror(e));
+    close(prtsp->lsock);
+    prtsp->lsock = -1;
+    return ESP_FAIL;
+  }
+
+  // one datagram socket carries the RTP packets for every session
+
+  prtsp->usock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+  if (prtsp->usock < 0)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "RTSP camwebsrv_rtsp_start(): socket() failed: [%d]: %s", e, strerror(e));
+    close(prtsp->lsock);
+    prtsp->lsock = -1;
+    return ESP_FAIL;
+  }
+
+  addr.sin_port = htons(CAMWEBSRV_RTSP_RTP_PORT);
+
+  if (bind(prtsp->usock, (struct sockaddr *) &addr, sizeof(addr)) != 0 || fcntl(prtsp->usock, F_SETFL, O_NONBLOCK) == -1)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "RTSP camwebsrv_rtsp_start(): bind()/fcntl(%u) failed: [%d]: %s", CAMWEBSRV_RTSP_RTP_PORT, e, strerror(e));
+    close(prtsp->usock);
+    close(prtsp->lsock);
+    prtsp->usock = -1;
+    prtsp->lsock = -1;
+    return ESP_FAIL;
+  }
+
+  // receiver reports come in on the port above; we don't need what's in
+  // them, but they show that a client is still there
+
+  prtsp->csock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+  addr.sin_port = htons(CAMWEBSRV_RTSP_RTP_PORT + 1);
+
+  if (prtsp->csock < 0 || bind(prtsp->csock, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "RTSP camwebsrv_rtsp_start(): socket()/bind(%u) failed: [%d]: %s", CAMWEBSRV_RTSP_RTP_PORT + 1, e, strerror(e));
+    if (prtsp->csock >= 0)
+    {
+      close(prtsp->csock);
+    }
+    close(prtsp->usock);
+    close(prtsp->lsock);
+    prtsp->csock = -1;
+    prtsp->usock = -1;
+    prtsp->lsock = -1;
+    return ESP_FAIL;
+  }
+
+  prtsp->stop = false;
+
+  if (xTaskCreate(_camwebsrv_rtsp_task, "rtsp", CAMWEBSRV_RTSP_TASK_STACK, prtsp, CAMWEBSRV_RTSP_TASK_PRIO, &(prtsp->task)) != pdPASS)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "RTSP camwebsrv_rtsp_start(): xTaskCreate() failed");
+    close(prtsp->csock);
+    close(prtsp->usock);
+    close(prtsp->lsock);
+    prtsp->csock = -1;
+    prtsp->usock = -1;
+    prtsp->lsock = -1;
+    prtsp->task = NULL;
+    return ESP_FAIL;
+  }
+
+  ESP_LOGI(CAMWEBSRV_TAG, "RTSP camwebsrv_rtsp_start(): started server on port %u", prtsp->port);
+
+  return ESP_OK;
+}
+
+static void _camwebsrv_rtsp_task(void *arg)
+{
+  _camwebsrv_rtsp_t *prtsp;
+  esp_err_t rv;
+
+  prtsp = (_camwebsrv_rtsp_t *) arg;
+
+  while(!prtsp->stop)
+  {
+    uint16_t nextevent = CAMWEBSRV_RTSP_POLL_MSEC;
+
+    // send out a frame if one is due
+
+    rv = _camwebsrv_rtsp_process(prtsp, &nextevent);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_task(): _camwebsrv_rtsp_process() failed: [%d]: %s", rv, esp_err_to_name(rv));
+      nextevent = CAMWEBSRV_MAIN_MIN_CYCLE_MSEC;
+    }
+
+    // then serve requests until the next one is
+
+    rv = _camwebsrv_rtsp_poll(prtsp, nextevent);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_task(): _camwebsrv_rtsp_poll() failed: [%d]: %s", rv, esp_err_to_name(rv));
+      vTaskDelay(pdMS_TO_TICKS(CAMWEBSRV_MAIN_MIN_CYCLE_MSEC));
+    }
+  }
+
+  // let whoever stopped us know we're done
+
+  xSemaphoreGive(prtsp->done);
+
+  vTaskDelete(NULL);
+}
+
+static esp_err_t _camwebsrv_rtsp_process(_camwebsrv_rtsp_t *prtsp, uint16_t *nextevent)
+{
+  esp_err_t rv;
+  camwebsrv_camera_frame_t frame = NULL;
+  int64_t interval;
+  int64_t tnow;
+  bool playing = false;
+  uint8_t i;
+
+  tnow = esp_timer_get_time();
+
+  // drop sessions whose client has gone quiet; clients are expected to send
+  // a keep alive within the session timeout
+
+  for (i = 0; i < CAMWEBSRV_RTSP_MAX_SESSIONS; i++)
+  {
+    _camwebsrv_rtsp_session_t *psess = &(prtsp->sessions[i]);
+
+    if (!psess->active)
+    {
+      continue;
+    }
+
+    if (tnow - psess->tactive > ((int64_t) CAMWEBSRV_RTSP_SESSION_TMOUT * 1000000))
+    {
+      ESP_LOGI(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_process(%d): session timed out", psess->sock);
+      _camwebsrv_rtsp_session_close(psess);
+      continue;
+    }
+
+    if (psess->state == _CAMWEBSRV_RTSP_STATE_PLAYING)
+    {
+      playing = true;
+    }
+  }
+
+  if (!playing)
+  {
+    return ESP_OK;
+  }
+
+  // is a frame due?
+
+  interval = 1000000 / camwebsrv_camera_fps_get(prtsp->cam);
+
+  if (tnow - prtsp->tframelast < interval)
+  {
+    *nextevent = (uint16_t) ((prtsp->tframelast + interval - tnow) / 1000);
+    return ESP_OK;
+  }
+
+  prtsp->tframelast = tnow;
+
+  *nextevent = (uint16_t) (interval / 1000);
+
+  // the camera hands out its current frame if it is fresh enough, so RTSP and
+  // HTTP viewers running at the same rate share the same grabs
+
+  rv = camwebsrv_camera_frame_grab(prtsp->cam, interval, &frame);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_process(): camwebsrv_camera_frame_grab() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  if (prtsp->frames == 0 || camwebsrv_camera_frame_seq(frame) != prtsp->fseq)
+  {
+    prtsp->fseq = camwebsrv_camera_frame_seq(frame);
+
+    rv = _camwebsrv_rtsp_frame_send(prtsp, frame);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_process(): _camwebsrv_rtsp_frame_send() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    }
+  }
+
+  camwebsrv_camera_frame_dispose(&frame);
+
+  return rv;
+}
+
+static esp_err_t _camwebsrv_rtsp_poll(_camwebsrv_rtsp_t *prtsp, uint16_t timeout)
+{
+  struct timeval tv;
+  fd_set rfds;
+  int maxfd;
+  int rv;
+  uint8_t i;
+
+  FD_ZERO(&rfds);
+
+  FD_SET(prtsp->lsock, &rfds);
+  FD_SET(prtsp->csock, &rfds);
+  maxfd = (prtsp->lsock > prtsp->csock) ? prtsp->lsock : prtsp->csock;
+
+  for (i = 0; i < CAMWEBSRV_RTSP_MAX_SESSIONS; i++)
+  {
+    if (prtsp->sessions[i].active)
+    {
+      FD_SET(prtsp->sessions[i].sock, &rfds);
+
+      if (prtsp->sessions[i].sock > maxfd)
+      {
+        maxfd = prtsp->sessions[i].sock;
+      }
+    }
+  }
+
+  // never block for longer than the poll interval, so that a stop request
+  // is noticed
+
+  if (timeout > CAMWEBSRV_RTSP_POLL_MSEC)
+  {
+    timeout = CAMWEBSRV_RTSP_POLL_MSEC;
+  }
+
+  tv.tv_sec = timeout / 1000;
+  tv.tv_usec = (timeout % 1000) * 1000;
+
+  rv = select(maxfd + 1, &rfds, NULL, NULL, &tv);
+
+  if (rv < 0)
+  {
+    int e = errno;
+
+    if (e == EINTR)
+    {
+      return ESP_OK;
+    }
+
+    ESP_LOGE(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_poll(): select() failed: [%d]: %s", e, strerror(e));
+    return ESP_FAIL;
+  }
+
+  if (rv == 0)
+  {
+    return ESP_OK;
+  }
+
+  // requests on existing connections first, then new connections
+
+  for (i = 0; i < CAMWEBSRV_RTSP_MAX_SESSIONS; i++)
+  {
+    _camwebsrv_rtsp_session_t *psess = &(prtsp->sessions[i]);
+
+    if (psess->active && FD_ISSET(psess->sock, &rfds))
+    {
+      if (_camwebsrv_rtsp_session_read(prtsp, psess) != ESP_OK)
+      {
+        _camwebsrv_rtsp_session_close(psess);
+      }
+    }
+  }
+
+  if (FD_ISSET(prtsp->csock, &rfds))
+  {
+    _camwebsrv_rtsp_rtcp(prtsp);
+  }
+
+  if (FD_ISSET(prtsp->lsock, &rfds))
+  {
+    return _camwebsrv_rtsp_accept(prtsp);
+  }
+
+  return ESP_OK;
+}
+
+static esp_err_t _camwebsrv_rtsp_accept(_camwebsrv_rtsp_t *prtsp)
+{
+  _camwebsrv_rtsp_session_t *psess = NULL;
+  int sock;
+  uint8_t i;
+
+  sock = accept(prtsp->lsock, NULL, NULL);
+
+  if (sock < 0)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_accept(): accept() failed: [%d]: %s", e, strerror(e));
+    return ESP_FAIL;
+  }
+
+  for (i = 0; i < CAMWEBSRV_RTSP_MAX_SESSIONS && psess == NULL; i++)
+  {
+    if (!prtsp->sessions[i].active)
+    {
+      psess = &(prtsp->sessions[i]);
+    }
+  }
+
+  if (psess == NULL)
+  {
+    ESP_LOGW(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_accept(%d): refused; already at %u sessions", sock, CAMWEBSRV_RTSP_MAX_SESSIONS);
+    close(sock);
+    return ESP_OK;
+  }
+
+  if (fcntl(sock, F_SETFL, O_NONBLOCK) == -1)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_accept(%d): fcntl() failed: [%d]: %s", sock, e, strerror(e));
+    close(sock);
+    return ESP_FAIL;
+  }
+
+  memset(psess, 0x00, sizeof(_camwebsrv_rtsp_session_t));
+
+  psess->sock = sock;
+  psess->state = _CAMWEBSRV_RTSP_STATE_INIT;
+  psess->tactive = esp_timer_get_time();
+  psess->active = true;
+
+  ESP_LOGI(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_accept(%d): connected", sock);
+
+  return ESP_OK;
+}
+
+static esp_err_t _camwebsrv_rtsp_rtcp(_camwebsrv_rtsp_t *prtsp)
+{
+  struct sockaddr_in addr;
+  socklen_t alen = sizeof(addr);
+  uint8_t b[64];
+  uint8_t i;
+
+  // a receiver report counts as a keep alive for whichever session sends RTP
+  // to where it came from
+
+  while(recvfrom(prtsp->csock, b, sizeof(b), MSG_DONTWAIT, (struct sockaddr *) &addr, &alen) >= 0)
+  {
+    for (i = 0; i < CAMWEBSRV_RTSP_MAX_SESSIONS; i++)
+    {
+      _camwebsrv_rtsp_session_t *psess = &(prtsp->sessions[i]);
+
+      if (psess->active && psess->state != _CAMWEBSRV_RTSP_STATE_INIT && psess->addr.sin_addr.s_addr == addr.sin_addr.s_addr && ntohs(psess->addr.sin_port) + 1 == ntohs(addr.sin_port))
+      {
+        psess->tactive = esp_timer_get_time();
+      }
+    }
+
+    alen = sizeof(addr);
+  }
+
+  return ESP_OK;
+}
+
+static esp_err_t _camwebsrv_rtsp_frame_send(_camwebsrv_rtsp_t *prtsp, camwebsrv_camera_frame_t frame)
+{
+  _camwebsrv_rtsp_jpeg_t jpeg;
+  const uint8_t *fbuf = NULL;
+  size_t flen = 0;
+  uint32_t tstamp;
+  uint8_t qindex;
+  esp_err_t rv;
+  uint8_t i;
+
+  rv = camwebsrv_camera_frame_bytes(frame, &fbuf, &flen);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_frame_send(): camwebsrv_camera_frame_bytes() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  // the frame is split up once, and the same pieces go out to every session
+
+  rv = _camwebsrv_rtsp_jpeg_parse(fbuf, flen, &jpeg);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGW(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_frame_send(): skipping frame %u: _camwebsrv_rtsp_jpeg_parse() failed: [%d]: %s", camwebsrv_camera_frame_seq(frame), rv, esp_err_to_name(rv));
+    return ESP_OK;
+  }
+
+  prtsp->frames++;
+
+  qindex = _camwebsrv_rtsp_qtable_get(prtsp, &jpeg);
+  tstamp = (uint32_t) ((camwebsrv_camera_frame_tstamp(frame) * (_CAMWEBSRV_RTSP_RTP_CLOCK / 1000)) / 1000);
+
+  for (i = 0; i < CAMWEBSRV_RTSP_MAX_SESSIONS; i++)
+  {
+    _camwebsrv_rtsp_session_t *psess = &(prtsp->sessions[i]);
+
+    if (!psess->active || psess->state != _CAMWEBSRV_RTSP_STATE_PLAYING)
+    {
+      continue;
+    }
+
+    rv = _camwebsrv_rtsp_session_send(prtsp, psess, &jpeg, qindex, tstamp);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGD(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_frame_send(%d): dropped frame %u", psess->sock, prtsp->fseq);
+    }
+  }
+
+  return ESP_OK;
+}
+
+static esp_err_t _camwebsrv_rtsp_jpeg_parse(const uint8_t *fbuf, size_t flen, _camwebsrv_rtsp_jpeg_t *jpeg)
+{
+  size_t i = 2;
+  size_t j;
+  bool sof = false;
+
+  memset(jpeg, 0x00, sizeof(_camwebsrv_rtsp_jpeg_t));
+
+  if (flen < 4 || fbuf[0] != 0xFF || fbuf[1] != 0xD8)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // walk the marker segments up to the start of scan; RFC 2435 only carries
+  // the scan data, the tables and the few parameters needed to rebuild the
+  // headers
+
+  while(i + 4 <= flen)
+  {
+    const uint8_t *seg;
+    size_t slen;
+    uint8_t marker;
+
+    if (fbuf[i] != 0xFF)
+    {
+      return ESP_ERR_INVALID_ARG;
+    }
+
+    marker = fbuf[i + 1];
+
+    if (marker == 0xFF)
+    {
+      i++;
+      continue;
+    }
+
+    slen = (fbuf[i + 2] << 8) | fbuf[i + 3];
+
+    if (slen < 2 || i + 2 + slen > flen)
+    {
+      return ESP_ERR_INVALID_SIZE;
+    }
+
+    seg = fbuf + i + 4;
+    slen -= 2;
+
+    switch(marker)
+    {
+      // quantization tables; only 8 bit ones, one for luma and one for chroma
+
+      case 0xDB:
+
+        for (j = 0; j < slen; j += 1 + _CAMWEBSRV_RTSP_QT_LEN)
+        {
+          if (slen - j < 1 + _CAMWEBSRV_RTSP_QT_LEN || (seg[j] >> 4) != 0 || (seg[j] & 0x0F) > 1)
+          {
+            return ESP_ERR_NOT_SUPPORTED;
+          }
+
+          jpeg->qt[seg[j] & 0x0F] = seg + j + 1;
+        }
+
+        break;
+
+      // baseline, YUV with 2x1 (type 0) or 2x2 (type 1) luma sampling, and
+      // both chroma components sharing the second table
+
+      case 0xC0:
+
+        if (slen < 15 || seg[5] != 3 || seg[8] != 0 || seg[10] != 0x11 || seg[11] != 1 || seg[13] != 0x11 || seg[14] != 1)
+        {
+          return ESP_ERR_NOT_SUPPORTED;
+        }
+
+        if (seg[7] == 0x21)
+        {
+          jpeg->type = 0;
+        }
+        else if (seg[7] == 0x22)
+        {
+          jpeg->type = 1;
+        }
+        else
+        {
+          return ESP_ERR_NOT_SUPPORTED;
+        }
+
+        jpeg->height = (seg[1] << 8) | seg[2];
+        jpeg->width = (seg[3] << 8) | seg[4];
+
+        sof = true;
+
+        break;
+
+      // restart interval
+
+      case 0xDD:
+
+        if (slen < 2)
+        {
+          return ESP_ERR_INVALID_SIZE;
+        }
+
+        jpeg->dri = (seg[0] << 8) | seg[1];
+
+        break;
+
+      // start of scan; everything from here up to the EOI marker is sent
+
+      case 0xDA:
+
+        jpeg->scan = seg + slen;
+        jpeg->slen = flen - (jpeg->scan - fbuf);
+
+        for (j = jpeg->slen; j >= 2 && jpeg->slen - j < 64; j--)
+        {
+          if (jpeg->scan[j - 2] == 0xFF && jpeg->scan[j - 1] == 0xD9)
+          {
+            jpeg->slen = j - 2;
+            break;
+          }
+        }
+
+        goto jpeg_parse_out;
+
+      // any other frame type isn't something RFC 2435 can carry
+
+      case 0xC1: case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+      case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+
+        return ESP_ERR_NOT_SUPPORTED;
+
+      default:
+
+        break;
+    }
+
+    i += 4 + slen;
+  }
+
+  return ESP_ERR_INVALID_ARG;
+
+  jpeg_parse_out:
+
+  if (!sof || jpeg->qt[0] == NULL || jpeg->qt[1] == NULL)
+  {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+
+  if (jpeg->width > _CAMWEBSRV_RTSP_DIM_MAX || jpeg->height > _CAMWEBSRV_RTSP_DIM_MAX)
+  {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+
+  if (jpeg->dri > 0)
+  {
+    jpeg->type += 64;
+  }
+
+  return ESP_OK;
+}
+
+static uint8_t _camwebsrv_rtsp_qtable_get(_camwebsrv_rtsp_t *prtsp, const _camwebsrv_rtsp_jpeg_t *jpeg)
+{
+  _camwebsrv_rtsp_qtable_t *pqt;
+  uint8_t lru = 0;
+  uint8_t i;
+
+  // the camera only uses a handful of distinct table pairs, one per quality
+  // setting, so each pair seen gets its own Q value, and a receiver that
+  // has seen a pair once doesn't need to be sent it again
+
+  for (i = 0; i < CAMWEBSRV_RTSP_QTABLES; i++)
+  {
+    pqt = &(prtsp->qtables[i]);
+
+    if (!pqt->valid)
+    {
+      lru = i;
+      continue;
+    }
+
+    if (memcmp(pqt->tables, jpeg->qt[0], _CAMWEBSRV_RTSP_QT_LEN) == 0 && memcmp(pqt->tables + _CAMWEBSRV_RTSP_QT_LEN, jpeg->qt[1], _CAMWEBSRV_RTSP_QT_LEN) == 0)
+    {
+      pqt->tused = prtsp->frames;
+      return i;
+    }
+
+    if (prtsp->qtables[lru].valid && pqt->tused < prtsp->qtables[lru].tused)
+    {
+      lru = i;
+    }
+  }
+
+  // new pair; recycle the least recently used Q value, which every session
+  // now has to be sent again
+
+  pqt = &(prtsp->qtables[lru]);
+
+  memcpy(pqt->tables, jpeg->qt[0], _CAMWEBSRV_RTSP_QT_LEN);
+  memcpy(pqt->tables + _CAMWEBSRV_RTSP_QT_LEN, jpeg->qt[1], _CAMWEBSRV_RTSP_QT_LEN);
+
+  pqt->tused = prtsp->frames;
+  pqt->valid = true;
+
+  for (i = 0; i < CAMWEBSRV_RTSP_MAX_SESSIONS; i++)
+  {
+    prtsp->sessions[i].qsent &= ~(1UL << lru);
+  }
+
+  ESP_LOGD(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_qtable_get(): new tables as Q %u", _CAMWEBSRV_RTSP_QT_Q_BASE + lru);
+
+  return lru;
+}
+
+static esp_err_t _camwebsrv_rtsp_session_read(_camwebsrv_rtsp_t *prtsp, _camwebsrv_rtsp_session_t *psess)
+{
+  esp_err_t rv;
+  ssize_t n;
+
+  n = recv(psess->sock, psess->rbuf + psess->rlen, CAMWEBSRV_RTSP_REQ_LEN - psess->rlen, 0);
+
+  if (n == 0)
+  {
+    ESP_LOGI(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_session_read(%d): disconnected", psess->sock);
+    return ESP_FAIL;
+  }
+
+  if (n < 0)
+  {
+    int e = errno;
+
+    if (e == EAGAIN || e == EWOULDBLOCK)
+    {
+      return ESP_OK;
+    }
+
+    ESP_LOGE(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_session_read(%d): recv() failed: [%d]: %s", psess->sock, e, strerror(e));
+    return ESP_FAIL;
+  }
+
+  psess->rlen += n;
+  psess->rbuf[psess->rlen] = '\0';
+
+  // handle every complete request we have; requests with a body are read
+  // in full, but the body itself is never needed
+
+  while(psess->rlen > 0)
+  {
+    char val[_CAMWEBSRV_RTSP_HDR_VAL_LEN];
+    size_t hlen;
+    size_t blen = 0;
+    char *end;
+
+    end = strstr(psess->rbuf, "\r\n\r\n");
+
+    if (end == NULL)
+    {
+      if (psess->rlen >= CAMWEBSRV_RTSP_REQ_LEN)
+      {
+        ESP_LOGE(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_session_read(%d): request too long", psess->sock);
+        return ESP_FAIL;
+      }
+
+      return ESP_OK;
+    }
+
+    hlen = (end - psess->rbuf) + 4;
+
+    // terminate the header block, leaving its last line ending in place
+
+    end[2] = '\0';
+
+    if (_camwebsrv_rtsp_header(psess->rbuf, "Content-Length", val, sizeof(val)))
+    {
+      blen = strtoul(val, NULL, 10);
+    }
+
+    if (hlen + blen > CAMWEBSRV_RTSP_REQ_LEN)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_session_read(%d): request too long", psess->sock);
+      return ESP_FAIL;
+    }
+
+    if (hlen + blen > psess->rlen)
+    {
+      end[2] = '\r';
+      return ESP_OK;
+    }
+
+    rv = _camwebsrv_rtsp_session_request(prtsp, psess, psess->rbuf);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_session_read(%d): _camwebsrv_rtsp_session_request() failed: [%d]: %s", psess->sock, rv, esp_err_to_name(rv));
+      return rv;
+    }
+
+    psess->rlen -= hlen + blen;
+
+    memmove(psess->rbuf, psess->rbuf + hlen + blen, psess->rlen);
+
+    psess->rbuf[psess->rlen] = '\0';
+  }
+
+  return ESP_OK;
+}
+
+static esp_err_t _camwebsrv_rtsp_session_request(_camwebsrv_rtsp_t *prtsp, _camwebsrv_rtsp_session_t *psess, char *req)
+{
+  char method[_CAMWEBSRV_RTSP_METHOD_LEN];
+  char url[_CAMWEBSRV_RTSP_URL_LEN];
+  char val[_CAMWEBSRV_RTSP_HDR_VAL_LEN];
+  char *resp = prtsp->resp;
+  size_t len = _CAMWEBSRV_RTSP_RESP_LEN;
+  uint32_t cseq = 0;
+  int code = 200;
+  int n;
+
+  psess->tactive = esp_timer_get_time();
+
+  if (_camwebsrv_rtsp_header(req, "CSeq", val, sizeof(val)))
+  {
+    cseq = strtoul(val, NULL, 10);
+  }
+
+  if (sscanf(req, "%15s %127s RTSP/1.0", method, url) != 2)
+  {
+    code = 400;
+    goto request_out;
+  }
+
+  ESP_LOGD(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_session_request(%d): %s %s", psess->sock, method, url);
+
+  // anything after SETUP must name the session it set up
+
+  if (strcmp(method, "PLAY") == 0 || strcmp(method, "TEARDOWN") == 0)
+  {
+    if (psess->state == _CAMWEBSRV_RTSP_STATE_INIT)
+    {
+      code = 455;
+      goto request_out;
+    }
+
+    if (!_camwebsrv_rtsp_header(req, "Session", val, sizeof(val)) || strtoul(val, NULL, 16) != psess->id)
+    {
+      code = 454;
+      goto request_out;
+    }
+  }
+
+  if (strcmp(method, "OPTIONS") == 0)
+  {
+    n = snprintf(resp, len, _CAMWEBSRV_RTSP_RESP_HDR_STR _CAMWEBSRV_RTSP_RESP_PUBLIC_STR "\r\n", code, "OK", cseq);
+  }
+  else if (strcmp(method, "DESCRIBE") == 0)
+  {
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    char sdp[192];
+    int slen;
+
+    // relative URLs in the description resolve against the request's
+
+    if (strlen(url) > 0 && url[strlen(url) - 1] == '/')
+    {
+      url[strlen(url) - 1] = '\0';
+    }
+
+    // the session description needs our own address
+
+    memset(&addr, 0x00, sizeof(addr));
+
+    getsockname(psess->sock, (struct sockaddr *) &addr, &alen);
+
+    slen = snprintf(sdp, sizeof(sdp), _CAMWEBSRV_RTSP_RESP_SDP_STR, (uint32_t) (esp_timer_get_time() / 1000000), inet_ntoa(addr.sin_addr));
+
+    if (slen < 0 || slen >= (int) sizeof(sdp))
+    {
+      return ESP_ERR_INVALID_SIZE;
+    }
+
+    n = snprintf(resp, len, _CAMWEBSRV_RTSP_RESP_HDR_STR _CAMWEBSRV_RTSP_RESP_DESCRIBE_STR "\r\n%s", code, "OK", cseq, url, slen, sdp);
+  }
+  else if (strcmp(method, "SETUP") == 0)
+  {
+    socklen_t alen = sizeof(psess->addr);
+    char *p;
+    uint16_t cport;
+
+    // RTP over UDP only; interleaved and multicast transports aren't
+    // supported
+
+    if (!_camwebsrv_rtsp_header(req, "Transport", val, sizeof(val)) || strstr(val, "RTP/AVP/TCP") != NULL || strstr(val, "interleaved") != NULL || strstr(val, "multicast") != NULL || (p = strstr(val, "client_port=")) == NULL)
+    {
+      code = 461;
+      goto request_out;
+    }
+
+    cport = (uint16_t) strtoul(p + strlen("client_port="), NULL, 10);
+
+    if (cport == 0)
+    {
+      code = 461;
+      goto request_out;
+    }
+
+    // RTP goes to the same host that the control connection is from
+
+    if (getpeername(psess->sock, (struct sockaddr *) &(psess->addr), &alen) != 0)
+    {
+      int e = errno;
+      ESP_LOGE(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_session_request(%d): getpeername() failed: [%d]: %s", psess->sock, e, strerror(e));
+      return ESP_FAIL;
+    }
+
+    psess->addr.sin_port = htons(cport);
+
+    if (psess->state == _CAMWEBSRV_RTSP_STATE_INIT)
+    {
+      psess->id = esp_random();
+      psess->ssrc = esp_random();
+      psess->rtpseq = (uint16_t) esp_random();
+      psess->state = _CAMWEBSRV_RTSP_STATE_READY;
+    }
+
+    n = snprintf(resp, len, _CAMWEBSRV_RTSP_RESP_HDR_STR _CAMWEBSRV_RTSP_RESP_TRANSPORT_STR _CAMWEBSRV_RTSP_RESP_SESSION_STR "\r\n", code, "OK", cseq, cport, cport + 1, CAMWEBSRV_RTSP_RTP_PORT, CAMWEBSRV_RTSP_RTP_PORT + 1, psess->ssrc, psess->id, CAMWEBSRV_RTSP_SESSION_TMOUT);
+  }
+  else if (strcmp(method, "PLAY") == 0)
+  {
+    // a new receiver needs the tables again
+
+    if (psess->state != _CAMWEBSRV_RTSP_STATE_PLAYING)
+    {
+      psess->qsent = 0;
+      psess->state = _CAMWEBSRV_RTSP_STATE_PLAYING;
+
+      ESP_LOGI(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_session_request(%d): playing to %s:%u", psess->sock, inet_ntoa(psess->addr.sin_addr), ntohs(psess->addr.sin_port));
+    }
+
+    n = snprintf(resp, len, _CAMWEBSRV_RTSP_RESP_HDR_STR _CAMWEBSRV_RTSP_RESP_SESSION_STR "Range: npt=0.000-\r\n\r\n", code, "OK", cseq, psess->id, CAMWEBSRV_RTSP_SESSION_TMOUT);
+  }
+  else if (strcmp(method, "TEARDOWN") == 0)
+  {
+    n = snprintf(resp, len, _CAMWEBSRV_RTSP_RESP_HDR_STR _CAMWEBSRV_RTSP_RESP_SESSION_STR "\r\n", code, "OK", cseq, psess->id, CAMWEBSRV_RTSP_SESSION_TMOUT);
+
+    psess->state = _CAMWEBSRV_RTSP_STATE_INIT;
+    psess->id = 0;
+  }
+  else if (strcmp(method, "GET_PARAMETER") == 0)
+  {
+    // keep alive
+
+    n = snprintf(resp, len, _CAMWEBSRV_RTSP_RESP_HDR_STR "\r\n", code, "OK", cseq);
+  }
+  else
+  {
+    code = 501;
+    goto request_out;
+  }
+
+  if (n < 0 || n >= (int) len)
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  return _camwebsrv_rtsp_session_reply(psess, resp, n);
+
+  request_out:
+
+  switch(code)
+  {
+    case 400: n = snprintf(resp, len, _CAMWEBSRV_RTSP_RESP_HDR_STR "\r\n", code, "Bad Request", cseq); break;
+    case 454: n = snprintf(resp, len, _CAMWEBSRV_RTSP_RESP_HDR_STR "\r\n", code, "Session Not Found", cseq); break;
+    case 455: n = snprintf(resp, len, _CAMWEBSRV_RTSP_RESP_HDR_STR "\r\n", code, "Method Not Valid in This State", cseq); break;
+    case 461: n = snprintf(resp, len, _CAMWEBSRV_RTSP_RESP_HDR_STR "\r\n", code, "Unsupported Transport", cseq); break;
+    default:  n = snprintf(resp, len, _CAMWEBSRV_RTSP_RESP_HDR_STR _CAMWEBSRV_RTSP_RESP_PUBLIC_STR "\r\n", code, "Not Implemented", cseq); break;
+  }
+
+  ESP_LOGW(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_session_request(%d): responded with %d", psess->sock, code);
+
+  return _camwebsrv_rtsp_session_reply(psess, resp, n);
+}
+
+static esp_err_t _camwebsrv_rtsp_session_reply(_camwebsrv_rtsp_session_t *psess, const char *buf, size_t len)
+{
+  size_t sent = 0;
+  uint8_t tries = 0;
+
+  // replies are small, so a full socket buffer only ever needs a moment
+
+  while(sent < len)
+  {
+    ssize_t n = send(psess->sock, buf + sent, len - sent, 0);
+
+    if (n < 0)
+    {
+      int e = errno;
+
+      if ((e == EAGAIN || e == EWOULDBLOCK) && tries++ < CAMWEBSRV_RTSP_SEND_RETRIES)
+      {
+        vTaskDelay(1);
+        continue;
+      }
+
+      ESP_LOGE(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_session_reply(%d): send() failed: [%d]: %s", psess->sock, e, strerror(e));
+      return ESP_FAIL;
+    }
+
+    sent += n;
+  }
+
+  return ESP_OK;
+}
+
+static esp_err_t _camwebsrv_rtsp_session_send(_camwebsrv_rtsp_t *prtsp, _camwebsrv_rtsp_session_t *psess, const _camwebsrv_rtsp_jpeg_t *jpeg, uint8_t qindex, uint32_t tstamp)
+{
+  size_t offset = 0;
+  bool tables;
+
+  // send the tables to a session that hasn't had them yet, and every so often
+  // anyway, in case the packet that carried them was lost
+
+  tables = ((psess->qsent & (1UL << qindex)) == 0 || psess->qframes >= CAMWEBSRV_RTSP_QTABLE_REFRESH);
+
+  while(offset < jpeg->slen)
+  {
+    uint8_t *p = prtsp->pkt;
+    size_t dlen;
+
+    // RTP header; the marker bit goes on the frame's last packet, which gets
+    // filled in below once we know how much fits
+
+    *p++ = 0x80;
+    *p++ = _CAMWEBSRV_RTSP_RTP_PT;
+    *p++ = (uint8_t) (psess->rtpseq >> 8);
+    *p++ = (uint8_t) psess->rtpseq;
+    *p++ = (uint8_t) (tstamp >> 24);
+    *p++ = (uint8_t) (tstamp >> 16);
+    *p++ = (uint8_t) (tstamp >> 8);
+    *p++ = (uint8_t) tstamp;
+    *p++ = (uint8_t) (psess->ssrc >> 24);
+    *p++ = (uint8_t) (psess->ssrc >> 16);
+    *p++ = (uint8_t) (psess->ssrc >> 8);
+    *p++ = (uint8_t) psess->ssrc;
+
+    // JPEG header
+
+    *p++ = 0;
+    *p++ = (uint8_t) (offset >> 16);
+    *p++ = (uint8_t) (offset >> 8);
+    *p++ = (uint8_t) offset;
+    *p++ = jpeg->type;
+    *p++ = _CAMWEBSRV_RTSP_QT_Q_BASE + qindex;
+    *p++ = (uint8_t) (jpeg->width / 8);
+    *p++ = (uint8_t) (jpeg->height / 8);
+
+    // restart marker header, with the whole frame as a single chunk
+
+    if (jpeg->dri > 0)
+    {
+      *p++ = (uint8_t) (jpeg->dri >> 8);
+      *p++ = (uint8_t) jpeg->dri;
+      *p++ = 0xFF;
+      *p++ = 0xFF;
+    }
+
+    // quantization table header, first packet only; a zero length tells the
+    // receiver to use the tables it already has for this Q
+
+    if (offset == 0)
+    {
+      *p++ = 0;
+      *p++ = 0;
+      *p++ = 0;
+      *p++ = tables ? (_CAMWEBSRV_RTSP_QT_LEN * 2) : 0;
+
+      if (tables)
+      {
+        memcpy(p, jpeg->qt[0], _CAMWEBSRV_RTSP_QT_LEN);
+        memcpy(p + _CAMWEBSRV_RTSP_QT_LEN, jpeg->qt[1], _CAMWEBSRV_RTSP_QT_LEN);
+        p += _CAMWEBSRV_RTSP_QT_LEN * 2;
+      }
+    }
+
+    dlen = CAMWEBSRV_RTSP_PACKET_LEN - (p - prtsp->pkt);
+
+    if (dlen >= jpeg->slen - offset)
+    {
+      dlen = jpeg->slen - offset;
+      prtsp->pkt[1] |= 0x80;
+    }
+
+    memcpy(p, jpeg->scan + offset, dlen);
+    p += dlen;
+
+    if (camwebsrv_udp_sendto(prtsp->usock, prtsp->pkt, p - prtsp->pkt, (struct sockaddr *) &(psess->addr), sizeof(psess->addr), CAMWEBSRV_RTSP_SEND_RETRIES) != ESP_OK)
+    {
+      ESP_LOGD(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_session_send(%d): camwebsrv_udp_sendto() failed", psess->sock);
+      return ESP_FAIL;
+    }
+
+    psess->rtpseq++;
+    offset += dlen;
+  }
+
+  if (tables)
+  {
+    psess->qsent |= (1UL << qindex);
+    psess->qframes = 0;
+  }
+  else
+  {
+    psess->qframes++;
+  }
+
+  return ESP_OK;
+}
+
+static void _camwebsrv_rtsp_session_close(_camwebsrv_rtsp_session_t *psess)
+{
+  if (!psess->active)
+  {
+    return;
+  }
+
+  ESP_LOGI(CAMWEBSRV_TAG, "RTSP _camwebsrv_rtsp_session_close(%d): closed", psess->sock);
+
+  close(psess->sock);
+
+  psess->sock = -1;
+  psess->state = _CAMWEBSRV_RTSP_STATE_INIT;
+  psess->active = false;
+}
+
+static bool _camwebsrv_rtsp_header(const char *req, const char *name, char *val, size_t len)
+{
+  const char *p;
+  const char *e;
+  size_t nlen = strlen(name);
+  size_t vlen;
+
+  // the first line is the request line; headers follow, one per line
+
+  for (p = strstr(req, "\r\n"); p != NULL; p = strstr(p, "\r\n"))
+  {
+    p += 2;
+
+    if (strncasecmp(p, name, nlen) != 0 || p[nlen] != ':')
+    {
+      continue;
+    }
+
+    for (p += nlen + 1; *p == ' ' || *p == '\t'; p++);
+
+    e = strstr(p, "\r\n");
+    vlen = (e == NULL) ? strlen(p) : (size_t) (e - p);
+
+    if (vlen >= len)
+    {
+      vlen = len - 1;
+    }
+
+    memcpy(val, p, vlen);
+    val[vlen] = '\0';
+
+    return true;
+  }
+
+  return false;
+}
@@ -0,0 +1,19 @@
+// 2026-10-16 rtsp.h
+// Copyright (C) 2023 Vino Fernando Crescini  <vfcrescini@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _CAMWEBSRV_RTSP_H
+#define _CAMWEBSRV_RTSP_H
+
+#include "cfgman.h"
+#include "camera.h"
+
+#include <esp_err.h>
+
+typedef void *camwebsrv_rtsp_t;
+
+esp_err_t camwebsrv_rtsp_init(camwebsrv_rtsp_t *rtsp, camwebsrv_cfgman_t cfgman, camwebsrv_camera_t cam);
+esp_err_t camwebsrv_rtsp_destroy(camwebsrv_rtsp_t *rtsp);
+esp_err_t camwebsrv_rtsp_start(camwebsrv_rtsp_t rtsp);
+
+#endif
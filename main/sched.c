@@ -0,0 +1,389 @@
+// 2026-10-16 sched.c
+// Copyright (C) 2023 Vino Fernando Crescini  <vfcrescini@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "config.h"
+#include "sched.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <esp_log.h>
+#include <esp_err.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+typedef struct
+{
+  const void *owner;
+  int64_t deadline;
+} _camwebsrv_sched_entry_t;
+
+typedef struct
+{
+  _camwebsrv_sched_entry_t heap[CAMWEBSRV_SCHED_MAX_ENTRIES];
+  uint8_t count;
+  esp_timer_handle_t timer;
+  TaskHandle_t task;
+  SemaphoreHandle_t mutex;
+} _camwebsrv_sched_t;
+
+static void _camwebsrv_sched_timer(void *arg);
+static void _camwebsrv_sched_up(_camwebsrv_sched_t *psched, uint8_t i);
+static void _camwebsrv_sched_down(_camwebsrv_sched_t *psched, uint8_t i);
+static int _camwebsrv_sched_find(_camwebsrv_sched_t *psched, const void *owner);
+static void _camwebsrv_sched_remove(_camwebsrv_sched_t *psched, uint8_t i);
+static void _camwebsrv_sched_expire(_camwebsrv_sched_t *psched, int64_t now);
+
+esp_err_t camwebsrv_sched_init(camwebsrv_sched_t *sched)
+{
+  _camwebsrv_sched_t *psched;
+  esp_timer_create_args_t targs;
+  esp_err_t rv;
+
+  if (sched == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  psched = (_camwebsrv_sched_t *) malloc(sizeof(_camwebsrv_sched_t));
+
+  if (psched == NULL)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "SCHED camwebsrv_sched_init(): malloc() failed: [%d]: %s", e, strerror(e));
+    return ESP_ERR_NO_MEM;
+  }
+
+  memset(psched, 0x00, sizeof(_camwebsrv_sched_t));
+
+  psched->mutex = xSemaphoreCreateMutex();
+
+  if (psched->mutex == NULL)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCHED camwebsrv_sched_init(): xSemaphoreCreateMutex() failed");
+    free(psched);
+    return ESP_FAIL;
+  }
+
+  // one one-shot timer, always armed for the earliest deadline
+
+  memset(&targs, 0x00, sizeof(targs));
+
+  targs.callback = _camwebsrv_sched_timer;
+  targs.arg = psched;
+  targs.dispatch_method = ESP_TIMER_TASK;
+  targs.name = "sched";
+
+  rv = esp_timer_create(&targs, &(psched->timer));
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCHED camwebsrv_sched_init(): esp_timer_create() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    vSemaphoreDelete(psched->mutex);
+    free(psched);
+    return rv;
+  }
+
+  psched->count = 0;
+  psched->task = NULL;
+
+  *sched = (camwebsrv_sched_t) psched;
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_sched_destroy(camwebsrv_sched_t *sched)
+{
+  _camwebsrv_sched_t *psched;
+
+  if (sched == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  psched = (_camwebsrv_sched_t *) *sched;
+
+  if (psched == NULL)
+  {
+    return ESP_OK;
+  }
+
+  esp_timer_stop(psched->timer);
+  esp_timer_delete(psched->timer);
+
+  vSemaphoreDelete(psched->mutex);
+
+  free(psched);
+
+  *sched = NULL;
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_sched_at(camwebsrv_sched_t sched, const void *owner, int64_t deadline)
+{
+  _camwebsrv_sched_t *psched;
+  int i;
+
+  if (sched == NULL || owner == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  psched = (_camwebsrv_sched_t *) sched;
+
+  xSemaphoreTake(psched->mutex, portMAX_DELAY);
+
+  // each owner has at most one deadline; a new one replaces the old one
+
+  i = _camwebsrv_sched_find(psched, owner);
+
+  if (i < 0)
+  {
+    if (psched->count >= CAMWEBSRV_SCHED_MAX_ENTRIES)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "SCHED camwebsrv_sched_at(): no room for another deadline");
+      xSemaphoreGive(psched->mutex);
+      return ESP_ERR_NO_MEM;
+    }
+
+    i = psched->count++;
+    psched->heap[i].owner = owner;
+    psched->heap[i].deadline = deadline;
+
+    _camwebsrv_sched_up(psched, i);
+  }
+  else if (deadline < psched->heap[i].deadline)
+  {
+    psched->heap[i].deadline = deadline;
+    _camwebsrv_sched_up(psched, i);
+  }
+  else
+  {
+    psched->heap[i].deadline = deadline;
+    _camwebsrv_sched_down(psched, i);
+  }
+
+  // if this is now the earliest deadline, whoever is waiting has the timer
+  // armed for a later one, so get them to re-arm it
+
+  if (psched->task != NULL && psched->heap[0].owner == owner)
+  {
+    xTaskNotifyGive(psched->task);
+  }
+
+  xSemaphoreGive(psched->mutex);
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_sched_cancel(camwebsrv_sched_t sched, const void *owner)
+{
+  _camwebsrv_sched_t *psched;
+  int i;
+
+  if (sched == NULL || owner == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  psched = (_camwebsrv_sched_t *) sched;
+
+  xSemaphoreTake(psched->mutex, portMAX_DELAY);
+
+  i = _camwebsrv_sched_find(psched, owner);
+
+  if (i >= 0)
+  {
+    _camwebsrv_sched_remove(psched, i);
+  }
+
+  xSemaphoreGive(psched->mutex);
+
+  return ESP_OK;
+}
+
+esp_err_t camwebsrv_sched_wait(camwebsrv_sched_t sched)
+{
+  _camwebsrv_sched_t *psched;
+  int64_t now;
+  esp_err_t rv;
+
+  if (sched == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  psched = (_camwebsrv_sched_t *) sched;
+
+  xSemaphoreTake(psched->mutex, portMAX_DELAY);
+
+  // anything already due? if so, there's no need to sleep at all
+
+  now = esp_timer_get_time();
+
+  if (psched->count > 0 && psched->heap[0].deadline <= now)
+  {
+    _camwebsrv_sched_expire(psched, now);
+    xSemaphoreGive(psched->mutex);
+    return ESP_OK;
+  }
+
+  // arm the timer for the earliest deadline; with nothing scheduled, sleep
+  // until someone schedules something
+
+  psched->task = xTaskGetCurrentTaskHandle();
+
+  if (psched->count > 0)
+  {
+    rv = esp_timer_start_once(psched->timer, psched->heap[0].deadline - now);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "SCHED camwebsrv_sched_wait(): esp_timer_start_once() failed: [%d]: %s", rv, esp_err_to_name(rv));
+      psched->task = NULL;
+      xSemaphoreGive(psched->mutex);
+      return rv;
+    }
+  }
+
+  xSemaphoreGive(psched->mutex);
+
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+  // woken either by the timer or by a new earlier deadline; either way, the
+  // caller goes round its loop and we get called again to re-arm
+
+  xSemaphoreTake(psched->mutex, portMAX_DELAY);
+
+  esp_timer_stop(psched->timer);
+
+  psched->task = NULL;
+
+  _camwebsrv_sched_expire(psched, esp_timer_get_time());
+
+  xSemaphoreGive(psched->mutex);
+
+  return ESP_OK;
+}
+
+static void _camwebsrv_sched_timer(void *arg)
+{
+  _camwebsrv_sched_t *psched;
+  TaskHandle_t task;
+
+  psched = (_camwebsrv_sched_t *) arg;
+
+  task = psched->task;
+
+  if (task != NULL)
+  {
+    xTaskNotifyGive(task);
+  }
+}
+
+static void _camwebsrv_sched_up(_camwebsrv_sched_t *psched, uint8_t i)
+{
+  _camwebsrv_sched_entry_t tmp;
+  uint8_t parent;
+
+  while(i > 0)
+  {
+    parent = (i - 1) / 2;
+
+    if (psched->heap[parent].deadline <= psched->heap[i].deadline)
+    {
+      break;
+    }
+
+    tmp = psched->heap[parent];
+    psched->heap[parent] = psched->heap[i];
+    psched->heap[i] = tmp;
+
+    i = parent;
+  }
+}
+
+static void _camwebsrv_sched_down(_camwebsrv_sched_t *psched, uint8_t i)
+{
+  _camwebsrv_sched_entry_t tmp;
+  uint8_t child;
+
+  while(true)
+  {
+    child = (2 * i) + 1;
+
+    if (child >= psched->count)
+    {
+      break;
+    }
+
+    if (child + 1 < psched->count && psched->heap[child + 1].deadline < psched->heap[child].deadline)
+    {
+      child++;
+    }
+
+    if (psched->heap[i].deadline <= psched->heap[child].deadline)
+    {
+      break;
+    }
+
+    tmp = psched->heap[child];
+    psched->heap[child] = psched->heap[i];
+    psched->heap[i] = tmp;
+
+    i = child;
+  }
+}
+
+static int _camwebsrv_sched_find(_camwebsrv_sched_t *psched, const void *owner)
+{
+  uint8_t i;
+
+  // there are only ever a handful of these
+
+  for (i = 0; i < psched->count; i++)
+  {
+    if (psched->heap[i].owner == owner)
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static void _camwebsrv_sched_remove(_camwebsrv_sched_t *psched, uint8_t i)
+{
+  // move the last entry into the hole, then let it find its place
+
+  psched->count--;
+
+  if (i == psched->count)
+  {
+    return;
+  }
+
+  psched->heap[i] = psched->heap[psched->count];
+
+  _camwebsrv_sched_up(psched, i);
+  _camwebsrv_sched_down(psched, i);
+}
+
+static void _camwebsrv_sched_expire(_camwebsrv_sched_t *psched, int64_t now)
+{
+  // due deadlines are dropped; their owners get to run now, and register
+  // their next one while they're at it
+
+  while(psched->count > 0 && psched->heap[0].deadline <= now)
+  {
+    _camwebsrv_sched_remove(psched, 0);
+  }
+}
@@ -0,0 +1,20 @@
+// 2026-10-16 sched.h
+// Copyright (C) 2023 Vino Fernando Crescini  <vfcrescini@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _CAMWEBSRV_SCHED_H
+#define _CAMWEBSRV_SCHED_H
+
+#include <stdint.h>
+
+#include <esp_err.h>
+
+typedef void *camwebsrv_sched_t;
+
+esp_err_t camwebsrv_sched_init(camwebsrv_sched_t *sched);
+esp_err_t camwebsrv_sched_destroy(camwebsrv_sched_t *sched);
+esp_err_t camwebsrv_sched_at(camwebsrv_sched_t sched, const void *owner, int64_t deadline);
+esp_err_t camwebsrv_sched_cancel(camwebsrv_sched_t sched, const void *owner);
+esp_err_t camwebsrv_sched_wait(camwebsrv_sched_t sched);
+
+#endif
@@ -4,28 +4,34 @@
 
 #include "config.h"
 #include "sclients.h"
-#include "vbytes.h"
+#include "ringbuf.h"
 
 #include <stdlib.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #include <sys/socket.h>
+#include <sys/select.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include <esp_log.h>
 #include <esp_err.h>
 #include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <esp_system.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#include <freertos/task.h>
 
 #define _CAMWEBSRV_SCLIENTS_RESP_HDR_MAIN_STR "\
 HTTP/1.1 200 OK\r\n\
@@ -35,14 +41,78 @@ Access-Control-Allow-Origin: *\r\n\
 \r\n\
 "
 
-#define _CAMWEBSRV_SCLIENTS_RESP_HDR_CHUNK_STR "\
-14\r\n--0123456789ABCDEF\r\n\r\n\
-1A\r\nContent-Type: image/jpeg\r\n\r\n\
-%x\r\nContent-Length: %u\r\n\r\n\
-2\r\n\r\n\r\n\
-%x\r\n\
+// without the chunk envelope, the end of the stream is the end of the
+// connection
+
+#define _CAMWEBSRV_SCLIENTS_RESP_HDR_MAIN_RAW_STR "\
+HTTP/1.1 200 OK\r\n\
+Content-Type: multipart/x-mixed-replace;boundary=0123456789ABCDEF\r\n\
+Access-Control-Allow-Origin: *\r\n\
+Connection: close\r\n\
+\r\n\
+"
+
+#define _CAMWEBSRV_SCLIENTS_RESP_HDR_CHUNK_LEN 128
+
+// each frame goes out as a single chunk: the chunk size, then the part
+// header, the frame, and the end of the part and of the chunk
+
+#define _CAMWEBSRV_SCLIENTS_RESP_HDR_PART_STR "--0123456789ABCDEF\r\nContent-Type: image/jpeg\r\nContent-Length: "
+
+#define _CAMWEBSRV_SCLIENTS_RESP_TRL_CHUNK_STR "\r\n\r\n"
+
+// raw framing sends the same part, just without the chunk size in front and
+// the chunk end at the back
+
+#define _CAMWEBSRV_SCLIENTS_RESP_TRL_PART_STR "\r\n"
+
+// websocket framing sends each frame as a single unmasked binary message,
+// with the frame's sequence number, capture time (usec) and size in front of
+// the JPEG data, all big endian; the http side of the handshake is done by
+// the server before the client gets here, and there's no trailer
+
+#define _CAMWEBSRV_SCLIENTS_WS_META_LEN 16
+#define _CAMWEBSRV_SCLIENTS_WS_HDR_LEN (10 + _CAMWEBSRV_SCLIENTS_WS_META_LEN)
+#define _CAMWEBSRV_SCLIENTS_RESP_TRL_WS_STR ""
+
+// the client's pings and closes are answered by the sender task, between two
+// frames, with an unmasked pong or close of its own
+
+#define _CAMWEBSRV_SCLIENTS_WS_CTRL_LEN 125
+#define _CAMWEBSRV_SCLIENTS_WS_OP_CLOSE 0x88
+#define _CAMWEBSRV_SCLIENTS_WS_OP_PONG 0x8A
+
+// one-shot framing is a plain response carrying a single frame, for
+// /capture; the connection is closed once it has gone out
+
+#define _CAMWEBSRV_SCLIENTS_RESP_HDR_ONESHOT_STR "\
+HTTP/1.1 200 OK\r\n\
+Content-Type: image/jpeg\r\n\
+Content-Length: %u\r\n\
+Content-Disposition: inline; filename=capture.jpg\r\n\
+ETag: \"%08x-%u\"\r\n\
+Last-Modified: %s\r\n\
+Cache-Control: max-age=%u\r\n\
+Access-Control-Allow-Origin: *\r\n\
+Connection: close\r\n\
+\r\n\
 "
 
+#define _CAMWEBSRV_SCLIENTS_RESP_HDR_ONESHOT_LEN 320
+#define _CAMWEBSRV_SCLIENTS_RESP_TRL_ONESHOT_STR ""
+
+// ring buffer (2 runs), frame slice, trailer
+
+#define _CAMWEBSRV_SCLIENTS_IOV_MAX 4
+
+// one session slot per socket lwip can hand out, indexed by socket fd
+
+#define _CAMWEBSRV_SCLIENTS_SLOTS CONFIG_LWIP_MAX_SOCKETS
+
+// client counts are kept per mode, since that's what their cost depends on
+
+#define _CAMWEBSRV_SCLIENTS_MODES 2
+
 #if CONFIG_LWIP_IPV6
   #define _CAMWEBSRV_SCLIIENTS_SOCKADDR_IN_T   struct sockaddr_in6
   #define _CAMWEBSRV_SCLIENTS_AF               AF_INET6
@@ -57,60 +127,299 @@ Access-Control-Allow-Origin: *\r\n\
   #define _CAMWEBSRV_SCLIENTS_PORT(X)         ((X).sin_port)
 #endif
 
-typedef struct _camwebsrv_sclients_node_t
+typedef struct
 {
   int sockfd;
-  camwebsrv_vbytes_t sockbuf;
-  struct _camwebsrv_sclients_node_t *next;
+  char caddr[CAMWEBSRV_SCLIENTS_ADDR_LEN];
+  camwebsrv_ringbuf_t sockbuf;
+  camwebsrv_camera_frame_t frame;
+  size_t foffset;
+  size_t toffset;
+  camwebsrv_sclients_mode_t mode;
+  camwebsrv_sclients_framing_t framing;
+  const char *trailer;
+  size_t tlen;
+  uint8_t fps;
+  int64_t maxage;
+  int64_t tmin;
+  uint32_t tagid;
+  camwebsrv_camera_frame_t jqueue[CAMWEBSRV_SCLIENTS_JITTER_DEPTH];
+  uint8_t jhead;
+  uint8_t jlen;
+  uint32_t wqueue[CAMWEBSRV_SCLIENTS_WS_WINDOW];
+  uint8_t whead;
+  uint8_t wlen;
+  uint8_t cbuf[2 + _CAMWEBSRV_SCLIENTS_WS_CTRL_LEN];
+  size_t clen;
+  bool closing;
+  uint32_t fseqlast;
+  uint32_t fdropped;
+  size_t deficit;
+  int64_t tquantum;
+  uint32_t qturns;
+  uint32_t qbytehits;
+  uint32_t qtimehits;
+  uint32_t rframes;
+  uint32_t rfbytes;
+  uint64_t sbytes;
+  uint32_t sframes;
+  uint32_t sstalls;
+  bool active;
+  uint8_t shard;
+  size_t pos;
   int64_t tframelast;
+  int64_t tqueuelast;
   int64_t twritelast;
+  int64_t tconnect;
 } _camwebsrv_sclients_node_t;
 
+// other tasks never touch a shard's sessions; they post events to it
+// instead, which its sender task takes at the start of each pass. the queue
+// is a lock-free stack that the sender task empties in one go, and each slot
+// has one event of each kind, so posting never allocates or blocks
+
+typedef enum
+{
+  _CAMWEBSRV_SCLIENTS_EVENT_ADD,
+  _CAMWEBSRV_SCLIENTS_EVENT_CLOSE,
+  _CAMWEBSRV_SCLIENTS_EVENT_ACK,
+  _CAMWEBSRV_SCLIENTS_EVENT_PING,
+  _CAMWEBSRV_SCLIENTS_EVENT_BYE
+} _camwebsrv_sclients_event_type_t;
+
+struct _camwebsrv_sclients_mbox_t;
+
+typedef struct _camwebsrv_sclients_event_t
+{
+  struct _camwebsrv_sclients_event_t *next;
+  struct _camwebsrv_sclients_mbox_t *pmbox;
+  _camwebsrv_sclients_event_type_t type;
+  atomic_bool queued;
+} _camwebsrv_sclients_event_t;
+
+typedef struct _camwebsrv_sclients_mbox_t
+{
+  _camwebsrv_sclients_event_t eadd;
+  _camwebsrv_sclients_event_t eclose;
+  _camwebsrv_sclients_event_t eack;
+  _camwebsrv_sclients_event_t eping;
+  _camwebsrv_sclients_event_t ebye;
+  _camwebsrv_sclients_node_t *pnode;
+  camwebsrv_sclients_params_t params;
+  char caddr[CAMWEBSRV_SCLIENTS_ADDR_LEN];
+  uint8_t pbuf[_CAMWEBSRV_SCLIENTS_WS_CTRL_LEN];
+  size_t plen;
+  _Atomic uint32_t ackseq;
+  _Atomic uint16_t byecode;
+  _Atomic uint8_t shard;
+  atomic_bool live;
+} _camwebsrv_sclients_mbox_t;
+
+// what a shard's sender task publishes at the end of each pass, for other
+// tasks to read without taking the shard's mutex; it is guarded by a
+// sequence count that is odd while the sender task is writing it
+
+typedef struct
+{
+  camwebsrv_sclients_info_t info;
+  uint32_t rframes;
+  uint32_t rfbytes;
+} _camwebsrv_sclients_stat_t;
+
+typedef struct
+{
+  size_t count;
+  _camwebsrv_sclients_stat_t stats[CAMWEBSRV_SCLIENTS_MAX_CLIENTS];
+  size_t occupancy;
+  size_t hwm;
+  uint32_t qturns;
+  uint32_t qbytehits;
+  uint32_t qtimehits;
+} _camwebsrv_sclients_pub_t;
+
+// the rate controller's view of each slot at its last call, so that it gets
+// what was sent since then
+
 typedef struct
 {
-  _camwebsrv_sclients_node_t *list;
+  int64_t tconnect;
+  uint64_t bytes;
+  uint32_t stalls;
+  uint32_t frames;
+  uint32_t fbytes;
+} _camwebsrv_sclients_rprev_t;
+
+typedef struct
+{
+  _camwebsrv_sclients_node_t *active[_CAMWEBSRV_SCLIENTS_SLOTS];
+  size_t count;
+  _Atomic(_camwebsrv_sclients_event_t *) queue;
+  _Atomic uint32_t load[_CAMWEBSRV_SCLIENTS_MODES];
+  size_t hwm;
+  uint32_t qturns;
+  uint32_t qbytehits;
+  uint32_t qtimehits;
+  int wakefd;
+  uint8_t index;
+  volatile bool stop;
+  camwebsrv_camera_t cam;
+  httpd_handle_t handle;
+  TaskHandle_t task;
+  SemaphoreHandle_t done;
   SemaphoreHandle_t mutex;
+  uint32_t hseq;
+  size_t hlen;
+  size_t hpart;
+  char hbuf[_CAMWEBSRV_SCLIENTS_RESP_HDR_CHUNK_LEN];
+  uint32_t wseq;
+  size_t wlen;
+  char wbuf[_CAMWEBSRV_SCLIENTS_WS_HDR_LEN];
+  size_t olen;
+  char obuf[_CAMWEBSRV_SCLIENTS_RESP_HDR_ONESHOT_LEN];
+  _Atomic uint32_t pseq;
+  _camwebsrv_sclients_pub_t pub;
+} _camwebsrv_sclients_shard_t;
+
+typedef struct
+{
+  _camwebsrv_sclients_shard_t shards[CAMWEBSRV_SCLIENTS_SHARDS];
+  _camwebsrv_sclients_node_t nodes[_CAMWEBSRV_SCLIENTS_SLOTS];
+  _camwebsrv_sclients_mbox_t mboxes[_CAMWEBSRV_SCLIENTS_SLOTS];
+  _camwebsrv_sclients_rprev_t rprev[_CAMWEBSRV_SCLIENTS_SLOTS];
+  SemaphoreHandle_t rmutex;
+  camwebsrv_camera_t cam;
 } _camwebsrv_sclients_t;
 
-size_t _camwebsrv_sclients_count_digits(size_t n);
-bool _camwebsrv_sclients_sock_exists(_camwebsrv_sclients_node_t *pnode, int sockfd);
-ssize_t _camwebsrv_sclients_sock_send_bytes(int sockfd, uint8_t *bytes, size_t len);
-esp_err_t _camwebsrv_sclients_node_send_bytes(_camwebsrv_sclients_node_t *pnode, uint8_t *bytes, size_t len);
-esp_err_t _camwebsrv_sclients_node_send_vbytes(_camwebsrv_sclients_node_t *pnode, camwebsrv_vbytes_t *vbytes);
-esp_err_t _camwebsrv_sclients_node_send_str(_camwebsrv_sclients_node_t *pnode, const char *fmt, ...);
+size_t _camwebsrv_sclients_count_digits(size_t n, uint8_t base);
+size_t _camwebsrv_sclients_format_digits(char *buf, size_t n, uint8_t base);
+size_t _camwebsrv_sclients_cost(camwebsrv_sclients_mode_t mode, size_t fsize);
+ssize_t _camwebsrv_sclients_sock_send_iov(int sockfd, struct iovec *iov, int iovcnt, size_t budget, int64_t tlimit, bool *bytehit, bool *timehit);
+void _camwebsrv_sclients_node_quantum(_camwebsrv_sclients_node_t *pnode);
+size_t _camwebsrv_sclients_node_backlog(_camwebsrv_sclients_node_t *pnode);
 esp_err_t _camwebsrv_sclients_node_flush(_camwebsrv_sclients_node_t *pnode, bool *flushed);
-esp_err_t _camwebsrv_sclients_node_frame(_camwebsrv_sclients_node_t *pnode, uint8_t *fbuf, size_t flen);
+esp_err_t _camwebsrv_sclients_node_frame(_camwebsrv_sclients_node_t *pnode, camwebsrv_camera_frame_t frame, const char *hbuf, size_t hlen);
+esp_err_t _camwebsrv_sclients_node_next(_camwebsrv_sclients_node_t *pnode, camwebsrv_camera_frame_t latest, int64_t interval, camwebsrv_camera_frame_t *frame);
+esp_err_t _camwebsrv_sclients_node_enqueue(_camwebsrv_sclients_node_t *pnode, camwebsrv_camera_frame_t latest, int64_t interval);
+esp_err_t _camwebsrv_sclients_node_oneshot(_camwebsrv_sclients_node_t *pnode, camwebsrv_camera_t cam, camwebsrv_camera_frame_t *frame);
+esp_err_t _camwebsrv_sclients_latest(camwebsrv_camera_t cam, int64_t maxage, camwebsrv_camera_frame_t *latest);
 esp_err_t _camwebsrv_sclients_sock_get_peer(int sockfd, char *caddr);
-esp_err_t _camwebsrv_sclients_purge(_camwebsrv_sclients_node_t **plist, httpd_handle_t handle);
+int _camwebsrv_sclients_sock_wake(void);
+esp_err_t _camwebsrv_sclients_shard_init(_camwebsrv_sclients_shard_t *pshard, uint8_t index);
+void _camwebsrv_sclients_shard_destroy(_camwebsrv_sclients_shard_t *pshard, httpd_handle_t handle);
+esp_err_t _camwebsrv_sclients_shard_process(_camwebsrv_sclients_shard_t *pshard, uint16_t *nextevent);
+esp_err_t _camwebsrv_sclients_shard_wait(_camwebsrv_sclients_shard_t *pshard, uint16_t timeout);
+esp_err_t _camwebsrv_sclients_shard_wake(_camwebsrv_sclients_shard_t *pshard);
+esp_err_t _camwebsrv_sclients_shard_header(_camwebsrv_sclients_shard_t *pshard, camwebsrv_camera_frame_t frame, camwebsrv_sclients_framing_t framing, const char **hbuf, size_t *hlen);
+esp_err_t _camwebsrv_sclients_shard_header_ws(_camwebsrv_sclients_shard_t *pshard, camwebsrv_camera_frame_t frame, const char **hbuf, size_t *hlen);
+esp_err_t _camwebsrv_sclients_shard_header_oneshot(_camwebsrv_sclients_shard_t *pshard, camwebsrv_camera_frame_t frame, int64_t maxage, uint32_t tagid, const char **hbuf, size_t *hlen);
+void _camwebsrv_sclients_shard_task(void *arg);
+void _camwebsrv_sclients_on_publish(void *arg);
+esp_err_t _camwebsrv_sclients_shard_purge(_camwebsrv_sclients_shard_t *pshard, httpd_handle_t handle);
+void _camwebsrv_sclients_shard_remove(_camwebsrv_sclients_shard_t *pshard, size_t pos);
+void _camwebsrv_sclients_shard_publish(_camwebsrv_sclients_shard_t *pshard);
+void _camwebsrv_sclients_shard_read(_camwebsrv_sclients_shard_t *pshard, _camwebsrv_sclients_pub_t *pub);
+void _camwebsrv_sclients_shard_post(_camwebsrv_sclients_shard_t *pshard, _camwebsrv_sclients_event_t *pevent);
+void _camwebsrv_sclients_shard_drain(_camwebsrv_sclients_shard_t *pshard);
+esp_err_t _camwebsrv_sclients_shard_insert(_camwebsrv_sclients_shard_t *pshard, _camwebsrv_sclients_node_t *pnode, const camwebsrv_sclients_params_t *params, const char *caddr);
 
 esp_err_t camwebsrv_sclients_init(camwebsrv_sclients_t *clients)
 {
   _camwebsrv_sclients_t *pclients;
+  esp_err_t rv;
+  uint8_t i;
+  size_t j;
 
   if (clients == NULL)
   {
     return ESP_ERR_INVALID_ARG;
   }
 
-  pclients = (_camwebsrv_sclients_t *) malloc(sizeof(_camwebsrv_sclients_t));
+  // the session table is walked on every pass, so keep it in internal RAM
+
+  pclients = (_camwebsrv_sclients_t *) heap_caps_malloc(sizeof(_camwebsrv_sclients_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
 
   if (pclients == NULL)
   {
-    int e = errno;
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_init(): malloc() failed: [%d]: %s", e, strerror(e));
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_init(): heap_caps_malloc(%u) failed", sizeof(_camwebsrv_sclients_t));
     return ESP_FAIL;
   }
 
-  pclients->mutex = xSemaphoreCreateMutex();
+  memset(pclients, 0x00, sizeof(_camwebsrv_sclients_t));
+
+  pclients->rmutex = xSemaphoreCreateMutex();
 
-  if (pclients->mutex == NULL)
+  if (pclients->rmutex == NULL)
   {
     ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_init(): xSemaphoreCreateMutex() failed");
-    free(pclients);
+    heap_caps_free(pclients);
     return ESP_FAIL;
   }
 
-  pclients->list = NULL;
+  for (i = 0; i < CAMWEBSRV_SCLIENTS_SHARDS; i++)
+  {
+    rv = _camwebsrv_sclients_shard_init(&(pclients->shards[i]), i);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_init(): _camwebsrv_sclients_shard_init(%u) failed: [%d]: %s", i, rv, esp_err_to_name(rv));
+
+      while(i > 0)
+      {
+        i--;
+        _camwebsrv_sclients_shard_destroy(&(pclients->shards[i]), NULL);
+      }
+
+      vSemaphoreDelete(pclients->rmutex);
+      heap_caps_free(pclients);
+      return ESP_FAIL;
+    }
+  }
+
+  // every slot gets its socket buffer up front, so adding a client doesn't
+  // need to allocate anything
+
+  for (j = 0; j < _CAMWEBSRV_SCLIENTS_SLOTS; j++)
+  {
+    _camwebsrv_sclients_node_t *pnode = &(pclients->nodes[j]);
+    _camwebsrv_sclients_mbox_t *pmbox = &(pclients->mboxes[j]);
+
+    pnode->sockfd = LWIP_SOCKET_OFFSET + j;
+    pnode->active = false;
+
+    pmbox->pnode = pnode;
+    pmbox->eadd.pmbox = pmbox;
+    pmbox->eadd.type = _CAMWEBSRV_SCLIENTS_EVENT_ADD;
+    pmbox->eclose.pmbox = pmbox;
+    pmbox->eclose.type = _CAMWEBSRV_SCLIENTS_EVENT_CLOSE;
+    pmbox->eack.pmbox = pmbox;
+    pmbox->eack.type = _CAMWEBSRV_SCLIENTS_EVENT_ACK;
+    pmbox->eping.pmbox = pmbox;
+    pmbox->eping.type = _CAMWEBSRV_SCLIENTS_EVENT_PING;
+    pmbox->ebye.pmbox = pmbox;
+    pmbox->ebye.type = _CAMWEBSRV_SCLIENTS_EVENT_BYE;
+
+    rv = camwebsrv_ringbuf_init(&(pnode->sockbuf), CAMWEBSRV_SCLIENTS_RBUF_SIZE);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_init(): camwebsrv_ringbuf_init(%u) failed: [%d]: %s", j, rv, esp_err_to_name(rv));
+
+      while(j > 0)
+      {
+        j--;
+        camwebsrv_ringbuf_destroy(&(pclients->nodes[j].sockbuf));
+      }
+
+      for (i = 0; i < CAMWEBSRV_SCLIENTS_SHARDS; i++)
+      {
+        _camwebsrv_sclients_shard_destroy(&(pclients->shards[i]), NULL);
+      }
+
+      vSemaphoreDelete(pclients->rmutex);
+      heap_caps_free(pclients);
+      return ESP_FAIL;
+    }
+  }
 
   *clients = pclients;
 
@@ -120,7 +429,8 @@ esp_err_t camwebsrv_sclients_init(camwebsrv_sclients_t *clients)
 esp_err_t camwebsrv_sclients_destroy(camwebsrv_sclients_t *clients, httpd_handle_t handle)
 {
   _camwebsrv_sclients_t *pclients;
-  esp_err_t rv;
+  uint8_t i;
+  size_t j;
 
   if (clients == NULL)
   {
@@ -134,124 +444,211 @@ esp_err_t camwebsrv_sclients_destroy(camwebsrv_sclients_t *clients, httpd_handle
     return ESP_OK;
   }
 
-  xSemaphoreTake(pclients->mutex, portMAX_DELAY);
+  if (pclients->cam != NULL)
+  {
+    camwebsrv_camera_unsubscribe(pclients->cam, _camwebsrv_sclients_on_publish, pclients);
+  }
 
-  rv = _camwebsrv_sclients_purge(&(pclients->list), handle);
+  for (i = 0; i < CAMWEBSRV_SCLIENTS_SHARDS; i++)
+  {
+    _camwebsrv_sclients_shard_destroy(&(pclients->shards[i]), handle);
+  }
 
-  if (rv != ESP_OK)
+  for (j = 0; j < _CAMWEBSRV_SCLIENTS_SLOTS; j++)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_destroy(): _camwebsrv_sclients_purge() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    camwebsrv_ringbuf_destroy(&(pclients->nodes[j].sockbuf));
   }
 
-  *clients = NULL;
+  vSemaphoreDelete(pclients->rmutex);
 
-  xSemaphoreGive(pclients->mutex);
-  vSemaphoreDelete(pclients->mutex);
+  *clients = NULL;
 
-  free(pclients);
+  heap_caps_free(pclients);
 
   return ESP_OK;
 }
 
-esp_err_t camwebsrv_sclients_add(camwebsrv_sclients_t clients, int sockfd)
+esp_err_t camwebsrv_sclients_start(camwebsrv_sclients_t clients, camwebsrv_camera_t cam, httpd_handle_t handle)
 {
   _camwebsrv_sclients_t *pclients;
-  _camwebsrv_sclients_node_t *pnode;
-  char caddr[_CAMWEBSRV_SCLIENTS_ADDRSTRLEN + 6];
   esp_err_t rv;
+  uint8_t i;
 
-  if (clients == NULL)
+  if (clients == NULL || cam == NULL)
   {
     return ESP_ERR_INVALID_ARG;
   }
 
   pclients = (_camwebsrv_sclients_t *) clients;
 
-  rv = _camwebsrv_sclients_sock_get_peer(sockfd, caddr);
+  pclients->cam = cam;
+
+  // one sender task per shard, spread across the cores
+
+  for (i = 0; i < CAMWEBSRV_SCLIENTS_SHARDS; i++)
+  {
+    _camwebsrv_sclients_shard_t *pshard = &(pclients->shards[i]);
+
+    if (pshard->task != NULL)
+    {
+      continue;
+    }
+
+    pshard->cam = cam;
+    pshard->handle = handle;
+    pshard->stop = false;
+
+    if (xTaskCreatePinnedToCore(_camwebsrv_sclients_shard_task, "sclients", CAMWEBSRV_SCLIENTS_TASK_STACK, pshard, CAMWEBSRV_SCLIENTS_TASK_PRIO, &(pshard->task), i % portNUM_PROCESSORS) != pdPASS)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_start(): xTaskCreatePinnedToCore(%u) failed", i);
+      pshard->task = NULL;
+      return ESP_FAIL;
+    }
+
+    ESP_LOGI(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_start(): started shard %u on core %u", i, i % portNUM_PROCESSORS);
+  }
+
+  // clients waiting on a new frame are woken up as soon as it is published,
+  // instead of the shards polling for it
+
+  rv = camwebsrv_camera_subscribe(cam, _camwebsrv_sclients_on_publish, pclients);
 
   if (rv != ESP_OK)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_add(%d): _camwebsrv_sclients_sock_get_peer failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_start(): camwebsrv_camera_subscribe() failed: [%d]: %s", rv, esp_err_to_name(rv));
     return rv;
   }
 
-  // get mutex
+  return ESP_OK;
+}
 
-  if (xSemaphoreTake(pclients->mutex, portMAX_DELAY) != pdTRUE)
+esp_err_t camwebsrv_sclients_params_init(camwebsrv_sclients_params_t *params)
+{
+  if (params == NULL)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_add(%d): xSemaphoreTake() failed", sockfd);
-    return ESP_FAIL;
+    return ESP_ERR_INVALID_ARG;
   }
 
-  // does it already exist?
+  memset(params, 0x00, sizeof(camwebsrv_sclients_params_t));
+
+  params->mode = CAMWEBSRV_SCLIENTS_MODE_LATENCY;
+  params->framing = CAMWEBSRV_SCLIENTS_FRAMING_CHUNKED;
+
+  return ESP_OK;
+}
 
-  if (_camwebsrv_sclients_sock_exists(pclients->list, sockfd))
+esp_err_t camwebsrv_sclients_limits(camwebsrv_sclients_t clients, camwebsrv_sclients_limits_t *limits)
+{
+  _camwebsrv_sclients_t *pclients;
+  size_t fsize;
+  size_t j;
+  uint8_t i;
+
+  if (clients == NULL || limits == NULL)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_add(%d): failed: already in the client list", sockfd);
-    xSemaphoreGive(pclients->mutex);
-    return ESP_FAIL;
+    return ESP_ERR_INVALID_ARG;
   }
 
-  // create new node
+  pclients = (_camwebsrv_sclients_t *) clients;
+
+  memset(limits, 0x00, sizeof(camwebsrv_sclients_limits_t));
+
+  // what the connected clients are estimated to be holding on to, at the
+  // current average frame size
 
-  pnode = (_camwebsrv_sclients_node_t *) malloc(sizeof(_camwebsrv_sclients_node_t));
+  fsize = camwebsrv_camera_frame_avgsize(pclients->cam);
 
-  if (pnode == NULL)
+  // the per-mode counts include clients that have been added but not yet
+  // taken by their sender task, and can be read without waiting for a pass
+
+  for (i = 0; i < CAMWEBSRV_SCLIENTS_SHARDS; i++)
   {
-    int e = errno;
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_add(%d): malloc() failed: [%d]: %s", sockfd, e, strerror(e));
-    xSemaphoreGive(pclients->mutex);
-    return ESP_FAIL;
+    for (j = 0; j < _CAMWEBSRV_SCLIENTS_MODES; j++)
+    {
+      uint32_t n = atomic_load(&(pclients->shards[i].load[j]));
+
+      limits->used = limits->used + (n * _camwebsrv_sclients_cost((camwebsrv_sclients_mode_t) j, fsize));
+      limits->clients = limits->clients + n;
+    }
   }
 
-  pnode->sockfd = sockfd;
-  pnode->next = pclients->list;
-  pnode->tframelast = 0;
-  pnode->twritelast = esp_timer_get_time();
+  limits->clients_max = CAMWEBSRV_SCLIENTS_MAX_CLIENTS;
+  limits->fsize = fsize;
+  limits->budget = CAMWEBSRV_SCLIENTS_MEM_BUDGET;
+  limits->heap = esp_get_free_heap_size();
+  limits->reserve = CAMWEBSRV_SCLIENTS_HEAP_RESERVE;
 
-  rv = camwebsrv_vbytes_init(&(pnode->sockbuf));
+  return ESP_OK;
+}
 
-  if (rv != ESP_OK)
+esp_err_t camwebsrv_sclients_admit(camwebsrv_sclients_t clients, const camwebsrv_sclients_params_t *params)
+{
+  camwebsrv_sclients_limits_t limits;
+  camwebsrv_sclients_params_t dparams;
+  esp_err_t rv;
+  size_t cost;
+
+  if (clients == NULL)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_add(%d): camwebsrv_vbytes_init() failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
-    free(pnode);
-    xSemaphoreGive(pclients->mutex);
-    return rv;
+    return ESP_ERR_INVALID_ARG;
   }
 
-  // load http headers in buffer
-  // XXX: instead of loading into the buffer, consider attempting to write to the socket instead
+  // no params means defaults
+
+  if (params == NULL)
+  {
+    camwebsrv_sclients_params_init(&dparams);
+    params = &dparams;
+  }
 
-  rv = camwebsrv_vbytes_append_str(pnode->sockbuf, _CAMWEBSRV_SCLIENTS_RESP_HDR_MAIN_STR);
+  rv = camwebsrv_sclients_limits(clients, &limits);
 
   if (rv != ESP_OK)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_add(%d): camwebsrv_vbytes_append_str() failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
-    camwebsrv_vbytes_destroy(&(pnode->sockbuf));
-    free(pnode);
-    xSemaphoreGive(pclients->mutex);
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_admit(): camwebsrv_sclients_limits() failed: [%d]: %s", rv, esp_err_to_name(rv));
     return rv;
   }
 
-  // attach to list
+  // room for one more?
 
-  pclients->list = pnode;
+  if (limits.clients >= limits.clients_max)
+  {
+    ESP_LOGW(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_admit(): refused; already at %u of %u clients", limits.clients, limits.clients_max);
+    return ESP_ERR_NO_MEM;
+  }
 
-  // release mutex
+  // enough memory for one more?
 
-  xSemaphoreGive(pclients->mutex);
+  cost = _camwebsrv_sclients_cost(params->mode, limits.fsize);
 
-  // done
+  if ((limits.used + cost) > limits.budget)
+  {
+    ESP_LOGW(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_admit(): refused; %u + %u bytes would exceed the %u byte budget", limits.used, cost, limits.budget);
+    return ESP_ERR_NO_MEM;
+  }
 
-  ESP_LOGI(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_add(%d): Added client %s", sockfd, caddr);
+  if ((cost + limits.reserve) > limits.heap)
+  {
+    ESP_LOGW(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_admit(): refused; %u bytes would leave less than %u of %u bytes free", cost, limits.reserve, limits.heap);
+    return ESP_ERR_NO_MEM;
+  }
 
   return ESP_OK;
 }
 
-esp_err_t camwebsrv_sclients_purge(camwebsrv_sclients_t clients, httpd_handle_t handle)
+esp_err_t camwebsrv_sclients_add(camwebsrv_sclients_t clients, int sockfd, const camwebsrv_sclients_params_t *params)
 {
   _camwebsrv_sclients_t *pclients;
+  _camwebsrv_sclients_shard_t *pshard;
+  _camwebsrv_sclients_mbox_t *pmbox;
+  camwebsrv_sclients_params_t dparams;
+  char caddr[CAMWEBSRV_SCLIENTS_ADDR_LEN];
   esp_err_t rv;
+  uint32_t total;
+  uint32_t load;
+  uint32_t lmin;
+  uint8_t i;
+  uint8_t j;
 
   if (clients == NULL)
   {
@@ -260,524 +657,2368 @@ esp_err_t camwebsrv_sclients_purge(camwebsrv_sclients_t clients, httpd_handle_t
 
   pclients = (_camwebsrv_sclients_t *) clients;
 
-  xSemaphoreTake(pclients->mutex, portMAX_DELAY);
+  // no params means defaults
 
-  rv = _camwebsrv_sclients_purge(&(pclients->list), handle);
+  if (params == NULL)
+  {
+    camwebsrv_sclients_params_init(&dparams);
+    params = &dparams;
+  }
 
-  xSemaphoreGive(pclients->mutex);
+  rv = _camwebsrv_sclients_sock_get_peer(sockfd, caddr);
 
   if (rv != ESP_OK)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_purge(): _camwebsrv_sclients_purge() failed: [%d]: %s", rv, esp_err_to_name(rv));
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_add(%d): _camwebsrv_sclients_sock_get_peer failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
     return rv;
   }
 
-  ESP_LOGI(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_purge(): Removed all clients");
-
-  return ESP_OK;
-}
-
-esp_err_t camwebsrv_sclients_process(camwebsrv_sclients_t clients, camwebsrv_camera_t cam, httpd_handle_t handle, uint16_t *nextevent)
-{
-  esp_err_t rv;
-  _camwebsrv_sclients_t *pclients;
-  _camwebsrv_sclients_node_t *curr;
-  _camwebsrv_sclients_node_t *prev;
-  _camwebsrv_sclients_node_t *temp;
+  // the client's slot in the session table is given by its socket
 
-  if (clients == NULL || cam == NULL)
+  if (sockfd < LWIP_SOCKET_OFFSET || sockfd >= (LWIP_SOCKET_OFFSET + _CAMWEBSRV_SCLIENTS_SLOTS))
   {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_add(%d): failed: socket out of range", sockfd);
     return ESP_ERR_INVALID_ARG;
   }
 
-  pclients = (_camwebsrv_sclients_t *) clients;
+  pmbox = &(pclients->mboxes[sockfd - LWIP_SOCKET_OFFSET]);
 
-  // get mutex
+  // the slot's add event can only be posted again once its sender task has
+  // taken it
 
-  if (xSemaphoreTake(pclients->mutex, portMAX_DELAY) != pdTRUE)
+  if (atomic_load(&(pmbox->eadd.queued)))
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_process(): xSemaphoreTake(mutex) failed");
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_add(%d): failed: already being added", sockfd);
     return ESP_FAIL;
   }
 
-  // traverse list
+  // go to the shard with the fewest clients; the socket's previous session,
+  // if any, is gone by now, since its shard closes the socket only after it
+  // has dropped it
 
-  curr = pclients->list;
-  prev = NULL;
+  pshard = NULL;
+  lmin = UINT32_MAX;
 
-  while(curr != NULL)
+  for (i = 0; i < CAMWEBSRV_SCLIENTS_SHARDS; i++)
   {
-    bool flushed = false;
-    int sockfd = curr->sockfd;
-    int64_t tnow = esp_timer_get_time();
+    load = 0;
 
-    // check the idle timer
-
-    if ((tnow - curr->twritelast) > (CAMWEBSRV_SCLIENTS_IDLE_TMOUT * 1000))
+    for (j = 0; j < _CAMWEBSRV_SCLIENTS_MODES; j++)
     {
-      ESP_LOGW(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_process(%d): exceeded idle time limit", sockfd);
-      goto rm_client;
+      load = load + atomic_load(&(pclients->shards[i].load[j]));
     }
 
-    // attempt to flush out the socket buffer
-
-    rv = _camwebsrv_sclients_node_flush(curr, &flushed);
-
-    if (rv != ESP_OK)
+    if (load < lmin)
     {
-      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_process(%d): _camwebsrv_sclients_node_flush() failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
-      goto rm_client;
+      pshard = &(pclients->shards[i]);
+      lmin = load;
     }
+  }
 
-    // is the buffer empty?
-
-    if (flushed)
-    {
-      // has enough time lapsed since the last frame?
-
-      if (tnow > (curr->tframelast + (1000000 / camwebsrv_camera_fps_get(cam))))
-      {
-        uint8_t *fbuf = NULL;
-        size_t flen = 0;
-        int64_t ftstamp = 0;
+  // count it in first, then hold the line on the total, whatever
+  // camwebsrv_sclients_admit() said earlier
 
-        // get, send and dispose new frame
+  atomic_fetch_add(&(pshard->load[params->mode]), 1);
 
-        rv = camwebsrv_camera_frame_grab(cam, &fbuf, &flen, &ftstamp);
+  total = 0;
 
-        if (rv != ESP_OK)
-        {
-          ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_process(%d): camwebsrv_camera_frame_grab() failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
-          goto rm_client;
-        }
+  for (i = 0; i < CAMWEBSRV_SCLIENTS_SHARDS; i++)
+  {
+    for (j = 0; j < _CAMWEBSRV_SCLIENTS_MODES; j++)
+    {
+      total = total + atomic_load(&(pclients->shards[i].load[j]));
+    }
+  }
 
-        rv = _camwebsrv_sclients_node_frame(curr, fbuf, flen);
+  if (total > CAMWEBSRV_SCLIENTS_MAX_CLIENTS)
+  {
+    atomic_fetch_sub(&(pshard->load[params->mode]), 1);
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_add(%d): failed: already at %u clients", sockfd, total - 1);
+    return ESP_ERR_NO_MEM;
+  }
 
-        camwebsrv_camera_frame_dispose(cam);
+  // hand it over to the shard's sender task, which sets up the slot when it
+  // gets round to it
 
-        if (rv != ESP_OK)
-        {
-          ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_process(%d): _camwebsrv_sclients_node_frame() failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
-          goto rm_client;
-        }
+  memcpy(&(pmbox->params), params, sizeof(camwebsrv_sclients_params_t));
 
-        curr->tframelast = ftstamp;
-      }
-    }
+  strncpy(pmbox->caddr, caddr, sizeof(pmbox->caddr) - 1);
+  pmbox->caddr[sizeof(pmbox->caddr) - 1] = '\0';
 
-    // the next event for this client is ASAP if there is something in the
-    // buffer, or whenever the next frame is due, otherwise
+  atomic_store(&(pmbox->shard), pshard->index);
+  atomic_store(&(pmbox->live), true);
+  atomic_store(&(pmbox->eadd.queued), true);
 
-    if (nextevent != NULL)
-    {
-      if (camwebsrv_vbytes_length(curr->sockbuf) > 0)
-      {
-        *nextevent = CAMWEBSRV_MAIN_MIN_CYCLE_MSEC;
-      }
-      else
-      {
-        *nextevent = 1000 / camwebsrv_camera_fps_get(cam);
-      }
-    }
+  _camwebsrv_sclients_shard_post(pshard, &(pmbox->eadd));
 
-    prev = curr;
-    curr = curr->next;
+  ESP_LOGD(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_add(%d): queued for shard %u", sockfd, pshard->index);
 
-    continue;
+  return ESP_OK;
+}
 
-    // on error, close socket, then delete node
+esp_err_t camwebsrv_sclients_close(camwebsrv_sclients_t clients, int sockfd)
+{
+  _camwebsrv_sclients_t *pclients;
+  _camwebsrv_sclients_mbox_t *pmbox;
 
-    rm_client:
+  if (clients == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
 
-      httpd_sess_trigger_close(handle, sockfd);
-      camwebsrv_vbytes_destroy(&(curr->sockbuf));
+  pclients = (_camwebsrv_sclients_t *) clients;
 
-      temp = curr;
+  if (sockfd < LWIP_SOCKET_OFFSET || sockfd >= (LWIP_SOCKET_OFFSET + _CAMWEBSRV_SCLIENTS_SLOTS))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
 
-      if (prev == NULL)
-      {
-        pclients->list = curr->next;
-        curr = pclients->list;
-      }
-      else
-      {
-        prev->next = curr->next;
-        curr = prev->next;
-      }
+  pmbox = &(pclients->mboxes[sockfd - LWIP_SOCKET_OFFSET]);
 
-      free(temp);
+  // most sockets the server closes were never ours, and it closes those
+  // itself
 
-      ESP_LOGI(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_process(%d): Removed client", sockfd);
+  if (!atomic_exchange(&(pmbox->live), false))
+  {
+    return ESP_ERR_NOT_FOUND;
   }
 
-  // release mutex
+  // ours are closed by their shard once it has dropped the session, so that
+  // the socket can't be handed out again while a pass may still write to it
 
-  xSemaphoreGive(pclients->mutex);
+  _camwebsrv_sclients_shard_post(&(pclients->shards[atomic_load(&(pmbox->shard)) % CAMWEBSRV_SCLIENTS_SHARDS]), &(pmbox->eclose));
 
   return ESP_OK;
 }
 
-size_t _camwebsrv_sclients_count_digits(size_t n)
+esp_err_t camwebsrv_sclients_ack(camwebsrv_sclients_t clients, int sockfd, uint32_t seq)
 {
-  size_t i;
+  _camwebsrv_sclients_t *pclients;
+  _camwebsrv_sclients_mbox_t *pmbox;
 
-  for(i = 0; n > 0; i++)
+  if (clients == NULL)
   {
-    n = n / 10;
+    return ESP_ERR_INVALID_ARG;
   }
 
-  return i;
-}
+  pclients = (_camwebsrv_sclients_t *) clients;
 
-bool _camwebsrv_sclients_sock_exists(_camwebsrv_sclients_node_t *pnode, int sockfd)
-{
-  while(pnode != NULL)
+  if (sockfd < LWIP_SOCKET_OFFSET || sockfd >= (LWIP_SOCKET_OFFSET + _CAMWEBSRV_SCLIENTS_SLOTS))
   {
-    if (pnode->sockfd == sockfd)
-    {
-      return true;
-    }
-    pnode = pnode->next;
+    return ESP_ERR_INVALID_ARG;
   }
-  return false;
-}
 
-ssize_t _camwebsrv_sclients_sock_send_bytes(int sockfd, uint8_t *bytes, size_t len)
-{
-  size_t bytes_left = len;
-  size_t bytes_sent = 0;
-  size_t bytes_blck;
-  TickType_t started = xTaskGetTickCount();
+  pmbox = &(pclients->mboxes[sockfd - LWIP_SOCKET_OFFSET]);
 
-  while(bytes_left > 0)
+  if (!atomic_load(&(pmbox->live)))
   {
-    ssize_t rv;
+    return ESP_ERR_NOT_FOUND;
+  }
 
-    // have we exceeded the time limit?
+  // only the latest ack matters, since it covers every frame before it; if
+  // an ack is already on its way, it picks this one up
 
-    if ((xTaskGetTickCount() - started) > pdMS_TO_TICKS(CAMWEBSRV_SCLIENTS_SEND_TMOUT))
-    {
-      ESP_LOGW(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_send_bytes(%d): exceeded send time limit", sockfd);
-      break;
-    }
+  atomic_store(&(pmbox->ackseq), seq);
 
-    // how much to send this time?
+  if (!atomic_exchange(&(pmbox->eack.queued), true))
+  {
+    _camwebsrv_sclients_shard_post(&(pclients->shards[atomic_load(&(pmbox->shard)) % CAMWEBSRV_SCLIENTS_SHARDS]), &(pmbox->eack));
+  }
 
-    bytes_blck = bytes_left < CAMWEBSRV_SCLIENTS_BSIZE ? bytes_left : CAMWEBSRV_SCLIENTS_BSIZE;
+  return ESP_OK;
+}
 
-    // send a block at a time
-    // XXX we really should use httpd_socket_send() here, but we can't until
-    // IDFGH-9275 is fixed
-
-    rv = send(sockfd, (const void *) bytes, bytes_blck, MSG_DONTWAIT | MSG_NOSIGNAL);
+esp_err_t camwebsrv_sclients_ping(camwebsrv_sclients_t clients, int sockfd, const uint8_t *payload, size_t len)
+{
+  _camwebsrv_sclients_t *pclients;
+  _camwebsrv_sclients_mbox_t *pmbox;
 
-    // error?
+  if (clients == NULL || (payload == NULL && len > 0) || len > _CAMWEBSRV_SCLIENTS_WS_CTRL_LEN)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
 
-    if (rv < 0)
-    {
-      int e = errno;
+  pclients = (_camwebsrv_sclients_t *) clients;
 
-      if (e == EAGAIN || e == EWOULDBLOCK)
-      {
-        ESP_LOGD(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_send_bytes(%d): send() would block", sockfd);
-        break;
-      }
+  if (sockfd < LWIP_SOCKET_OFFSET || sockfd >= (LWIP_SOCKET_OFFSET + _CAMWEBSRV_SCLIENTS_SLOTS))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
 
-      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_send_bytes(%d): send() failed: [%d]: %s", sockfd, e, strerror(e));
-      return -1;
-    }
+  pmbox = &(pclients->mboxes[sockfd - LWIP_SOCKET_OFFSET]);
 
-    // this should never happen, given that we're sendig with the NONBLOCK flag
+  if (!atomic_load(&(pmbox->live)))
+  {
+    return ESP_ERR_NOT_FOUND;
+  }
 
-    if (rv == 0)
-    {
-      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_send_bytes(%d): send() failed", sockfd);
-      return -2;
-    }
+  // the payload is only written while no ping is on its way, since the
+  // sender task reads it before letting the next one be posted; a client
+  // only needs a pong for one of the pings it sent in between
 
-    // success!
+  if (atomic_exchange(&(pmbox->eping.queued), true))
+  {
+    return ESP_OK;
+  }
 
-    bytes_left = bytes_left - rv;
-    bytes_sent = bytes_sent + rv;
-    bytes = bytes + rv;
+  if (len > 0)
+  {
+    memcpy(pmbox->pbuf, payload, len);
   }
 
-  ESP_LOGD(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_send_bytes(%d): sent %u bytes", sockfd, bytes_sent);
+  pmbox->plen = len;
 
-  return bytes_sent;
+  _camwebsrv_sclients_shard_post(&(pclients->shards[atomic_load(&(pmbox->shard)) % CAMWEBSRV_SCLIENTS_SHARDS]), &(pmbox->eping));
+
+  return ESP_OK;
 }
 
-esp_err_t _camwebsrv_sclients_node_send_bytes(_camwebsrv_sclients_node_t *pnode, uint8_t *bytes, size_t len)
+esp_err_t camwebsrv_sclients_bye(camwebsrv_sclients_t clients, int sockfd, uint16_t code)
 {
-  esp_err_t rv;
-
-  // if the buffer is empty, make one attempt to send data to the socket first
+  _camwebsrv_sclients_t *pclients;
+  _camwebsrv_sclients_mbox_t *pmbox;
 
-  if (camwebsrv_vbytes_length(pnode->sockbuf) == 0)
+  if (clients == NULL)
   {
-    ssize_t sent;
+    return ESP_ERR_INVALID_ARG;
+  }
 
-    sent = _camwebsrv_sclients_sock_send_bytes(pnode->sockfd, bytes, len);
+  pclients = (_camwebsrv_sclients_t *) clients;
 
-    if (sent < 0)
-    {
-      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_send_bytes(%d): _camwebsrv_sclients_sock_send_bytes() failed", pnode->sockfd);
-      return ESP_FAIL;
-    }
+  if (sockfd < LWIP_SOCKET_OFFSET || sockfd >= (LWIP_SOCKET_OFFSET + _CAMWEBSRV_SCLIENTS_SLOTS))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
 
-    // update idle timer
+  pmbox = &(pclients->mboxes[sockfd - LWIP_SOCKET_OFFSET]);
 
-    pnode->twritelast = esp_timer_get_time();
+  if (!atomic_load(&(pmbox->live)))
+  {
+    return ESP_ERR_NOT_FOUND;
+  }
 
-    // increment stuff
+  atomic_store(&(pmbox->byecode), code);
 
-    bytes = bytes + sent;
-    len = len - sent;
+  if (!atomic_exchange(&(pmbox->ebye.queued), true))
+  {
+    _camwebsrv_sclients_shard_post(&(pclients->shards[atomic_load(&(pmbox->shard)) % CAMWEBSRV_SCLIENTS_SHARDS]), &(pmbox->ebye));
   }
 
-  // enbuffer unsent data
+  return ESP_OK;
+}
 
-  rv = camwebsrv_vbytes_append_bytes(pnode->sockbuf, bytes, len);
+esp_err_t camwebsrv_sclients_purge(camwebsrv_sclients_t clients, httpd_handle_t handle)
+{
+  _camwebsrv_sclients_t *pclients;
+  esp_err_t rv;
+  uint8_t i;
 
-  if (rv != ESP_OK)
+  if (clients == NULL)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_send_bytes(%d): camwebsrv_vbytes_append_bytes() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
-    return ESP_FAIL;
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  pclients = (_camwebsrv_sclients_t *) clients;
+
+  for (i = 0; i < CAMWEBSRV_SCLIENTS_SHARDS; i++)
+  {
+    _camwebsrv_sclients_shard_t *pshard = &(pclients->shards[i]);
+
+    xSemaphoreTake(pshard->mutex, portMAX_DELAY);
+
+    rv = _camwebsrv_sclients_shard_purge(pshard, handle);
+
+    xSemaphoreGive(pshard->mutex);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_purge(): _camwebsrv_sclients_shard_purge() failed: [%d]: %s", rv, esp_err_to_name(rv));
+      return rv;
+    }
   }
 
+  ESP_LOGI(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_purge(): Removed all clients");
+
   return ESP_OK;
 }
 
-esp_err_t _camwebsrv_sclients_node_send_vbytes(_camwebsrv_sclients_node_t *pnode, camwebsrv_vbytes_t *vbytes)
+esp_err_t camwebsrv_sclients_sockbuf_stats(camwebsrv_sclients_t clients, size_t *occupancy, size_t *highwater)
 {
-  esp_err_t rv;
-  uint8_t *bbytes = NULL;
-  size_t blen = 0;
+  _camwebsrv_sclients_t *pclients;
+  _camwebsrv_sclients_pub_t pub;
+  size_t used = 0;
+  size_t hwm = 0;
+  uint8_t i;
+
+  if (clients == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
 
-  rv = camwebsrv_vbytes_get_bytes(vbytes, (const uint8_t **) &bbytes, &blen);
+  pclients = (_camwebsrv_sclients_t *) clients;
 
-  if (rv != ESP_OK)
+  // total bytes currently buffered, and the highest any one client's buffer
+  // has ever reached
+
+  for (i = 0; i < CAMWEBSRV_SCLIENTS_SHARDS; i++)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_send_vbytes(%d): camwebsrv_vbytes_get_bytes() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
-    return ESP_FAIL;
+    _camwebsrv_sclients_shard_read(&(pclients->shards[i]), &pub);
+
+    used = used + pub.occupancy;
+
+    if (pub.hwm > hwm)
+    {
+      hwm = pub.hwm;
+    }
   }
 
-  rv = _camwebsrv_sclients_node_send_bytes(pnode, bbytes, blen);
+  if (occupancy != NULL)
+  {
+    *occupancy = used;
+  }
 
-  if (rv != ESP_OK)
+  if (highwater != NULL)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_send_vbytes(%d): _camwebsrv_sclients_node_send_bytes() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
-    return ESP_FAIL;
+    *highwater = hwm;
   }
 
   return ESP_OK;
 }
 
-esp_err_t _camwebsrv_sclients_node_send_str(_camwebsrv_sclients_node_t *pnode, const char *fmt, ...)
+esp_err_t camwebsrv_sclients_quantum_stats(camwebsrv_sclients_t clients, uint32_t *turns, uint32_t *bytehits, uint32_t *timehits)
 {
-  va_list vlist;
-  esp_err_t rv;
-  camwebsrv_vbytes_t vbytes;
-
-  rv = camwebsrv_vbytes_init(&vbytes);
+  _camwebsrv_sclients_t *pclients;
+  _camwebsrv_sclients_pub_t pub;
+  uint32_t t = 0;
+  uint32_t b = 0;
+  uint32_t m = 0;
+  uint8_t i;
 
-  if (rv != ESP_OK)
+  if (clients == NULL)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_send_str(%d): camwebsrv_vbytes_init() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
-    return ESP_FAIL;
+    return ESP_ERR_INVALID_ARG;
   }
 
-  va_start(vlist, fmt);
-  rv = camwebsrv_vbytes_set_vlist(vbytes, fmt, vlist);
-  va_end(vlist);
+  pclients = (_camwebsrv_sclients_t *) clients;
+
+  // how many turns clients have had since boot, and how many of them were
+  // cut short by the byte or the time quantum
 
-  if (rv != ESP_OK)
+  for (i = 0; i < CAMWEBSRV_SCLIENTS_SHARDS; i++)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_send_str(%d): camwebsrv_vbytes_set_vlist() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
-    return ESP_FAIL;
+    _camwebsrv_sclients_shard_read(&(pclients->shards[i]), &pub);
+
+    t = t + pub.qturns;
+    b = b + pub.qbytehits;
+    m = m + pub.qtimehits;
   }
 
-  rv = _camwebsrv_sclients_node_send_vbytes(pnode, vbytes);
+  if (turns != NULL)
+  {
+    *turns = t;
+  }
 
-  if (rv != ESP_OK)
+  if (bytehits != NULL)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_send_str(%d): _camwebsrv_sclients_node_send_vbytes() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
-    return ESP_FAIL;
+    *bytehits = b;
   }
 
-  camwebsrv_vbytes_destroy(&vbytes);
+  if (timehits != NULL)
+  {
+    *timehits = m;
+  }
 
   return ESP_OK;
 }
 
-esp_err_t _camwebsrv_sclients_node_flush(_camwebsrv_sclients_node_t *pnode, bool *flushed)
+esp_err_t camwebsrv_sclients_rate_stats(camwebsrv_sclients_t clients, camwebsrv_sclients_rate_t *rate)
 {
-  esp_err_t rv;
-  ssize_t sent = 0;
-  uint8_t *bbytes = NULL;
-  size_t blen = 0;
+  _camwebsrv_sclients_t *pclients;
+  _camwebsrv_sclients_pub_t pub;
+  size_t j;
+  uint8_t i;
+
+  if (clients == NULL || rate == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  pclients = (_camwebsrv_sclients_t *) clients;
 
-  // get internal buffer
+  memset(rate, 0x00, sizeof(camwebsrv_sclients_rate_t));
 
-  rv = camwebsrv_vbytes_get_bytes(pnode->sockbuf, (const uint8_t **) &bbytes, &blen);
+  rate->slowest = UINT32_MAX;
 
-  if (rv != ESP_OK)
+  // what the clients managed to send since the last call, and how far behind
+  // the worst of them is; the sender tasks only ever count up, so each call
+  // takes the difference from what the previous call saw
+
+  if (xSemaphoreTake(pclients->rmutex, portMAX_DELAY) != pdTRUE)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_flush(%d): camwebsrv_vbytes_get_bytes() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS camwebsrv_sclients_rate_stats(): xSemaphoreTake() failed");
     return ESP_FAIL;
   }
 
-  // nothing to do if the buffer is empty
-
-  if (blen > 0)
+  for (i = 0; i < CAMWEBSRV_SCLIENTS_SHARDS; i++)
   {
-    // make one attempt to send buffered data to socket
+    _camwebsrv_sclients_shard_read(&(pclients->shards[i]), &pub);
 
-    sent = _camwebsrv_sclients_sock_send_bytes(pnode->sockfd, bbytes, blen);
-
-    if (sent < 0)
+    for (j = 0; j < pub.count; j++)
     {
-      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_flush(%d): _camwebsrv_sclients_sock_send_bytes() failed", pnode->sockfd);
-      return ESP_FAIL;
-    }
+      _camwebsrv_sclients_stat_t *pstat = &(pub.stats[j]);
+      _camwebsrv_sclients_rprev_t *pprev = &(pclients->rprev[pstat->info.sockfd - LWIP_SOCKET_OFFSET]);
+      uint32_t bytes;
+      uint32_t stalls;
 
-    // update idle timer
+      // a new session on the same socket starts from zero
 
-    pnode->twritelast = esp_timer_get_time();
+      if (pprev->tconnect != pstat->info.tconnect)
+      {
+        memset(pprev, 0x00, sizeof(_camwebsrv_sclients_rprev_t));
+        pprev->tconnect = pstat->info.tconnect;
+      }
 
-    // reset buffer to whatever remains unsent
+      bytes = (uint32_t) (pstat->info.bytes - pprev->bytes);
+      stalls = pstat->info.stalls - pprev->stalls;
 
-    rv = camwebsrv_vbytes_set_bytes(pnode->sockbuf, bbytes + sent, blen - sent);
+      rate->clients++;
+      rate->bytes = rate->bytes + bytes;
+      rate->stalls = rate->stalls + stalls;
+      rate->frames = rate->frames + (pstat->rframes - pprev->frames);
+      rate->fbytes = rate->fbytes + (pstat->rfbytes - pprev->fbytes);
 
-    if (rv != ESP_OK)
-    {
-      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_flush(%d): camwebsrv_vbytes_set_bytes() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
-      return ESP_FAIL;
-    }
-  }
+      // only clients that had to wait for the socket tell us anything about
+      // how much the link can take
 
-  // set flag, if supplied
+      if (stalls > 0 && bytes < rate->slowest)
+      {
+        rate->slowest = bytes;
+      }
 
-  if (flushed != NULL)
-  {
-    *flushed = (blen == sent);
+      if (pstat->info.buffered > rate->backlog)
+      {
+        rate->backlog = pstat->info.buffered;
+      }
+
+      pprev->bytes = pstat->info.bytes;
+      pprev->stalls = pstat->info.stalls;
+      pprev->frames = pstat->rframes;
+      pprev->fbytes = pstat->rfbytes;
+    }
   }
 
+  xSemaphoreGive(pclients->rmutex);
+
   return ESP_OK;
 }
 
-esp_err_t _camwebsrv_sclients_node_frame(_camwebsrv_sclients_node_t *pnode, uint8_t *fbuf, size_t flen)
+esp_err_t camwebsrv_sclients_snapshot(camwebsrv_sclients_t clients, camwebsrv_sclients_info_t *info, size_t max, size_t *count)
 {
-  esp_err_t rv;
+  _camwebsrv_sclients_t *pclients;
+  _camwebsrv_sclients_pub_t pub;
+  size_t n = 0;
+  size_t j;
+  uint8_t i;
 
-  // chunk header
+  if (clients == NULL || (info == NULL && max > 0) || count == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  pclients = (_camwebsrv_sclients_t *) clients;
 
-  rv = _camwebsrv_sclients_node_send_str(
-    pnode,
-    _CAMWEBSRV_SCLIENTS_RESP_HDR_CHUNK_STR,
-    18 + _camwebsrv_sclients_count_digits(flen),
-    flen,
-    flen
-  );
+  // copy out what each shard published at the end of its last pass; that
+  // never waits for a pass that is still sending
 
-  if (rv != ESP_OK)
+  for (i = 0; i < CAMWEBSRV_SCLIENTS_SHARDS && n < max; i++)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_frame(%d): _camwebsrv_sclients_node_send_str(1) failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
-    return ESP_FAIL;
+    _camwebsrv_sclients_shard_read(&(pclients->shards[i]), &pub);
+
+    for (j = 0; j < pub.count && n < max; j++, n++)
+    {
+      memcpy(&(info[n]), &(pub.stats[j].info), sizeof(camwebsrv_sclients_info_t));
+    }
   }
 
-  // chunk data
+  *count = n;
 
-  rv = _camwebsrv_sclients_node_send_bytes(pnode, fbuf, flen);
+  return ESP_OK;
+}
 
-  if (rv != ESP_OK)
+esp_err_t camwebsrv_sclients_wake(camwebsrv_sclients_t clients)
+{
+  _camwebsrv_sclients_t *pclients;
+  esp_err_t rv;
+  uint8_t i;
+
+  if (clients == NULL)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_frame(%d): _camwebsrv_sclients_node_send_bytes() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
-    return ESP_FAIL;
+    return ESP_ERR_INVALID_ARG;
   }
 
-  // chunk end
-
-  rv = _camwebsrv_sclients_node_send_str(pnode, "\r\n");
+  pclients = (_camwebsrv_sclients_t *) clients;
 
-  if (rv != ESP_OK)
+  for (i = 0; i < CAMWEBSRV_SCLIENTS_SHARDS; i++)
   {
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_frame(%d): _camwebsrv_sclients_node_send_str(1) failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
-    return ESP_FAIL;
+    rv = _camwebsrv_sclients_shard_wake(&(pclients->shards[i]));
+
+    if (rv != ESP_OK)
+    {
+      return rv;
+    }
   }
 
   return ESP_OK;
 }
 
-esp_err_t _camwebsrv_sclients_sock_get_peer(int sockfd, char *caddr)
+void _camwebsrv_sclients_on_publish(void *arg)
 {
-  _CAMWEBSRV_SCLIIENTS_SOCKADDR_IN_T addr;
-  socklen_t len = sizeof(addr);
-  char tip[_CAMWEBSRV_SCLIENTS_ADDRSTRLEN];
+  // runs on the camera's producer task, so all it does is poke the shards
 
-  memset(&addr, 0x00, sizeof(addr));
+  camwebsrv_sclients_wake((camwebsrv_sclients_t) arg);
+}
 
-  if (getpeername(sockfd, (struct sockaddr *) &addr, &len) != 0)
-  {
-    int e = errno;
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_sock_get_peer(): getpeername() failed: [%d]: %s", e, strerror(e));
-    return ESP_FAIL;
-  }
+esp_err_t _camwebsrv_sclients_shard_process(_camwebsrv_sclients_shard_t *pshard, uint16_t *nextevent)
+{
+  esp_err_t rv;
+  _camwebsrv_sclients_node_t *curr;
+  camwebsrv_camera_frame_t latest = NULL;
+  size_t i;
 
-  if (inet_ntop(_CAMWEBSRV_SCLIENTS_AF, &_CAMWEBSRV_SCLIENTS_ADDR(addr), tip, _CAMWEBSRV_SCLIENTS_ADDRSTRLEN) == NULL)
+  // get mutex
+
+  if (xSemaphoreTake(pshard->mutex, portMAX_DELAY) != pdTRUE)
   {
-    int e = errno;
-    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_sock_get_peer(): inet_ntop() failed: [%d]: %s", e, strerror(e));
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_process(): xSemaphoreTake(mutex) failed");
     return ESP_FAIL;
   }
 
-  sprintf(caddr, "%s:%d", tip, ntohs(_CAMWEBSRV_SCLIENTS_PORT(addr)));
+  // take in whatever other tasks have posted since the last pass
 
-  return ESP_OK;
-}
+  _camwebsrv_sclients_shard_drain(pshard);
 
-esp_err_t _camwebsrv_sclients_purge(_camwebsrv_sclients_node_t **plist, httpd_handle_t handle)
-{
-  _camwebsrv_sclients_node_t *cnode;
-  _camwebsrv_sclients_node_t *tnode;
-  esp_err_t rv;
+  // walk the active array; removing a client moves the last one into its
+  // place, so the index only advances past clients that stay
 
-  cnode = *plist;
+  i = 0;
 
-  while(cnode != NULL)
+  while(i < pshard->count)
   {
-    // be graceful and try to flush out the buffer first
+    bool flushed = false;
+    int sockfd;
+    int64_t tnow = esp_timer_get_time();
+    int64_t interval;
+
+    curr = pshard->active[i];
+    sockfd = curr->sockfd;
+
+    // clients that didn't ask for a specific frame rate follow the camera's,
+    // and those that asked for more than it makes get no more than that;
+    // one-shot clients may take any frame up to their own max age
 
-    rv = _camwebsrv_sclients_node_flush(cnode, NULL);
+    if (curr->framing == CAMWEBSRV_SCLIENTS_FRAMING_ONESHOT && curr->maxage > 0)
+    {
+      interval = curr->maxage;
+    }
+    else
+    {
+      uint8_t cfps = camwebsrv_camera_fps_get(pshard->cam);
+
+      interval = 1000000 / ((curr->fps > 0 && curr->fps < cfps) ? curr->fps : cfps);
+    }
+
+    // check the idle timer
+
+    if ((tnow - curr->twritelast) > (CAMWEBSRV_SCLIENTS_IDLE_TMOUT * 1000))
+    {
+      ESP_LOGW(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_process(%d): exceeded idle time limit", sockfd);
+      goto rm_client;
+    }
+
+    // start this client's turn with a fresh quantum, then attempt to flush
+    // out the socket buffer
+
+    _camwebsrv_sclients_node_quantum(curr);
+
+    rv = _camwebsrv_sclients_node_flush(curr, &flushed);
 
     if (rv != ESP_OK)
     {
-      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_purge(%d): _camwebsrv_sclients_node_flush() failed: [%d]: %s", cnode->sockfd, rv, esp_err_to_name(rv));
+      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_process(%d): _camwebsrv_sclients_node_flush() failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
+      goto rm_client;
     }
 
-    // kill session
+    // one-shot clients are done once their frame has gone out
 
-    if (cnode->sockfd > 0)
+    if (curr->framing == CAMWEBSRV_SCLIENTS_FRAMING_ONESHOT && flushed && curr->sframes > 0)
     {
-      httpd_sess_trigger_close(handle, cnode->sockfd);
+      goto rm_client;
     }
 
-    // destroy buffer
+    // so are websocket clients that said goodbye, once our close has gone
+    // out after them
 
-    if (cnode->sockbuf != NULL)
+    if (curr->closing && flushed && curr->clen == 0)
     {
-      camwebsrv_vbytes_destroy(&(cnode->sockbuf));
+      goto rm_client;
     }
 
-    tnode = cnode;
-    cnode = cnode->next;
+    // a pong or close waiting to go out is sent between two frames, so that
+    // it never lands in the middle of one
 
-    ESP_LOGI(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_purge(%d): Removed client", tnode->sockfd);
+    if (flushed && curr->clen > 0)
+    {
+      rv = camwebsrv_ringbuf_write(curr->sockbuf, curr->cbuf, curr->clen);
 
-    free(tnode);
-  }
+      if (rv != ESP_OK)
+      {
+        ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_process(%d): camwebsrv_ringbuf_write() failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
+        goto rm_client;
+      }
+
+      curr->clen = 0;
+
+      flushed = false;
+    }
+
+    // smooth clients need to see every new frame, even when they're busy, so
+    // that it can be queued up
+
+    if (curr->mode == CAMWEBSRV_SCLIENTS_MODE_SMOOTH)
+    {
+      rv = _camwebsrv_sclients_latest(pshard->cam, interval, &latest);
+
+      if (rv != ESP_OK && rv != ESP_ERR_NOT_FOUND)
+      {
+        ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_process(%d): _camwebsrv_sclients_latest() failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
+        goto rm_client;
+      }
+
+      rv = _camwebsrv_sclients_node_enqueue(curr, latest, interval);
+
+      if (rv != ESP_OK)
+      {
+        ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_process(%d): _camwebsrv_sclients_node_enqueue() failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
+        goto rm_client;
+      }
+    }
+
+    // is the buffer empty, i.e. are we at a part boundary?
+
+    if (flushed)
+    {
+      // has enough time lapsed since the last frame? websocket clients also
+      // need to have acknowledged enough of the frames already sent
+
+      if (tnow > (curr->tframelast + interval) && !curr->closing && (curr->framing != CAMWEBSRV_SCLIENTS_FRAMING_WS || curr->wlen < CAMWEBSRV_SCLIENTS_WS_WINDOW))
+      {
+        camwebsrv_camera_frame_t frame = NULL;
+
+        if (curr->framing == CAMWEBSRV_SCLIENTS_FRAMING_ONESHOT)
+        {
+          // one-shot clients stay parked until a frame recent enough for
+          // them has been published, without waiting on the camera here
+
+          rv = _camwebsrv_sclients_node_oneshot(curr, pshard->cam, &frame);
+
+          if (rv != ESP_OK)
+          {
+            ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_process(%d): _camwebsrv_sclients_node_oneshot() failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
+            goto rm_client;
+          }
+        }
+        else
+        {
+          // the current frame is shared by all clients in this pass, and
+          // only grabbed if somebody actually needs it
+
+          if (curr->mode == CAMWEBSRV_SCLIENTS_MODE_LATENCY)
+          {
+            rv = _camwebsrv_sclients_latest(pshard->cam, interval, &latest);
+
+            if (rv != ESP_OK && rv != ESP_ERR_NOT_FOUND)
+            {
+              ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_process(%d): _camwebsrv_sclients_latest() failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
+              goto rm_client;
+            }
+          }
+
+          // pick the next frame to send, if there is one, then hand it over
+          // to the client, which disposes of it once it has been sent out
+
+          rv = _camwebsrv_sclients_node_next(curr, latest, interval, &frame);
+
+          if (rv != ESP_OK)
+          {
+            ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_process(%d): _camwebsrv_sclients_node_next() failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
+            goto rm_client;
+          }
+        }
+
+        if (frame != NULL)
+        {
+          // latency clients are paced by capture time, while smooth clients
+          // are paced by playout time, since their frames may be a bit old
+
+          const char *hbuf = NULL;
+          size_t hlen = 0;
+
+          curr->tframelast = (curr->mode == CAMWEBSRV_SCLIENTS_MODE_SMOOTH) ? tnow : camwebsrv_camera_frame_tstamp(frame);
+
+          // the chunk header is the same for every client sending this
+          // frame, so it is only built once
+
+          if (curr->framing == CAMWEBSRV_SCLIENTS_FRAMING_ONESHOT)
+          {
+            rv = _camwebsrv_sclients_shard_header_oneshot(pshard, frame, interval, curr->tagid, &hbuf, &hlen);
+          }
+          else
+          {
+            rv = _camwebsrv_sclients_shard_header(pshard, frame, curr->framing, &hbuf, &hlen);
+          }
+
+          if (rv != ESP_OK)
+          {
+            ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_process(%d): _camwebsrv_sclients_shard_header() failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
+            camwebsrv_camera_frame_dispose(&frame);
+            goto rm_client;
+          }
+
+          // websocket clients hand back a credit for this one once they
+          // acknowledge it
+
+          if (curr->framing == CAMWEBSRV_SCLIENTS_FRAMING_WS)
+          {
+            curr->wqueue[(curr->whead + curr->wlen) % CAMWEBSRV_SCLIENTS_WS_WINDOW] = camwebsrv_camera_frame_seq(frame);
+            curr->wlen++;
+          }
+
+          rv = _camwebsrv_sclients_node_frame(curr, frame, hbuf, hlen);
+
+          if (rv != ESP_OK)
+          {
+            ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_process(%d): _camwebsrv_sclients_node_frame() failed: [%d]: %s", sockfd, rv, esp_err_to_name(rv));
+            goto rm_client;
+          }
+        }
+      }
+    }
+
+    // if there's nothing left to send, there's no deficit to carry over
+
+    if (camwebsrv_ringbuf_length(curr->sockbuf) == 0 && curr->frame == NULL)
+    {
+      curr->deficit = 0;
+    }
+
+    // the next timed event for this client is whenever its next frame is
+    // due; anything still in the buffer goes out as soon as the socket is
+    // writable, which _camwebsrv_sclients_shard_wait() takes care of. a
+    // client that is already due but got nothing, like a parked one-shot
+    // client, is waiting for the next frame to be published, which wakes us
+    // up, and acks and closes wake us up too, so there's no timed event for
+    // those
+
+    if (nextevent != NULL)
+    {
+      int64_t tnext;
+
+      tnext = curr->tframelast + interval - esp_timer_get_time();
+
+      if (tnext > 0)
+      {
+        tnext = (tnext + 999) / 1000;
+
+        if (*nextevent > tnext)
+        {
+          *nextevent = tnext;
+        }
+      }
+    }
+
+    i++;
+
+    continue;
+
+    // on error, close socket, then free up the slot
+
+    rm_client:
+
+      httpd_sess_trigger_close(pshard->handle, sockfd);
+
+      ESP_LOGI(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_process(%d): Removed client; dropped %u frames", sockfd, curr->fdropped);
+
+      _camwebsrv_sclients_shard_remove(pshard, i);
+  }
+
+  // let go of this pass's frame
+
+  if (latest != NULL)
+  {
+    camwebsrv_camera_frame_dispose(&latest);
+  }
+
+  // let everyone else see how the pass went
+
+  _camwebsrv_sclients_shard_publish(pshard);
+
+  // release mutex
+
+  xSemaphoreGive(pshard->mutex);
+
+  return ESP_OK;
+}
+
+esp_err_t _camwebsrv_sclients_shard_wait(_camwebsrv_sclients_shard_t *pshard, uint16_t timeout)
+{
+  _camwebsrv_sclients_node_t *curr;
+  struct timeval tv;
+  size_t i;
+  fd_set rfds;
+  fd_set wfds;
+  int maxfd;
+  int rv;
+
+  FD_ZERO(&rfds);
+  FD_ZERO(&wfds);
+
+  // always listen out for a wake up call
+
+  FD_SET(pshard->wakefd, &rfds);
+  maxfd = pshard->wakefd;
+
+  // wait for any client that still has something to send to become writable
+
+  if (xSemaphoreTake(pshard->mutex, portMAX_DELAY) != pdTRUE)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_wait(): xSemaphoreTake() failed");
+    return ESP_FAIL;
+  }
+
+  for (i = 0; i < pshard->count; i++)
+  {
+    curr = pshard->active[i];
+
+    if (camwebsrv_ringbuf_length(curr->sockbuf) > 0 || curr->frame != NULL)
+    {
+      FD_SET(curr->sockfd, &wfds);
+
+      if (curr->sockfd > maxfd)
+      {
+        maxfd = curr->sockfd;
+      }
+    }
+  }
+
+  xSemaphoreGive(pshard->mutex);
+
+  // block until a socket is ready, we get woken up, or the timeout lapses
+
+  tv.tv_sec = timeout / 1000;
+  tv.tv_usec = (timeout % 1000) * 1000;
+
+  rv = select(maxfd + 1, &rfds, &wfds, NULL, (timeout == UINT16_MAX) ? NULL : &tv);
+
+  if (rv < 0)
+  {
+    int e = errno;
+
+    if (e == EINTR)
+    {
+      return ESP_OK;
+    }
+
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_wait(): select() failed: [%d]: %s", e, strerror(e));
+    return ESP_FAIL;
+  }
+
+  // drain any wake up calls
+
+  if (rv > 0 && FD_ISSET(pshard->wakefd, &rfds))
+  {
+    uint8_t b[8];
+
+    while(recv(pshard->wakefd, b, sizeof(b), MSG_DONTWAIT) > 0);
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t _camwebsrv_sclients_shard_wake(_camwebsrv_sclients_shard_t *pshard)
+{
+  uint8_t b = 0;
+
+  // if the socket buffer is full, a wake up call is already pending anyway
+
+  if (send(pshard->wakefd, &b, sizeof(b), MSG_DONTWAIT) < 0)
+  {
+    int e = errno;
+
+    if (e != EAGAIN && e != EWOULDBLOCK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_wake(): send() failed: [%d]: %s", e, strerror(e));
+      return ESP_FAIL;
+    }
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t _camwebsrv_sclients_shard_init(_camwebsrv_sclients_shard_t *pshard, uint8_t index)
+{
+  memset(pshard, 0x00, sizeof(_camwebsrv_sclients_shard_t));
+
+  pshard->mutex = xSemaphoreCreateMutex();
+
+  if (pshard->mutex == NULL)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_init(%u): xSemaphoreCreateMutex() failed", index);
+    return ESP_FAIL;
+  }
+
+  pshard->done = xSemaphoreCreateBinary();
+
+  if (pshard->done == NULL)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_init(%u): xSemaphoreCreateBinary() failed", index);
+    vSemaphoreDelete(pshard->mutex);
+    return ESP_FAIL;
+  }
+
+  // loopback socket that lets other tasks break the sender task out of
+  // select()
+
+  pshard->wakefd = _camwebsrv_sclients_sock_wake();
+
+  if (pshard->wakefd < 0)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_init(%u): _camwebsrv_sclients_sock_wake() failed", index);
+    vSemaphoreDelete(pshard->done);
+    vSemaphoreDelete(pshard->mutex);
+    return ESP_FAIL;
+  }
+
+  pshard->count = 0;
+  atomic_init(&(pshard->queue), NULL);
+  atomic_init(&(pshard->pseq), 0);
+  pshard->hwm = 0;
+  pshard->qturns = 0;
+  pshard->qbytehits = 0;
+  pshard->qtimehits = 0;
+  pshard->hseq = 0;
+  pshard->hlen = 0;
+  pshard->wseq = 0;
+  pshard->wlen = 0;
+  pshard->olen = 0;
+  pshard->index = index;
+  pshard->stop = false;
+  pshard->task = NULL;
+
+  return ESP_OK;
+}
+
+void _camwebsrv_sclients_shard_destroy(_camwebsrv_sclients_shard_t *pshard, httpd_handle_t handle)
+{
+  esp_err_t rv;
+
+  // stop the sender task, and wait for it to finish its current pass
+
+  if (pshard->task != NULL)
+  {
+    pshard->stop = true;
+
+    _camwebsrv_sclients_shard_wake(pshard);
+
+    xSemaphoreTake(pshard->done, portMAX_DELAY);
+
+    pshard->task = NULL;
+  }
+
+  xSemaphoreTake(pshard->mutex, portMAX_DELAY);
+
+  rv = _camwebsrv_sclients_shard_purge(pshard, handle);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_destroy(%u): _camwebsrv_sclients_shard_purge() failed: [%d]: %s", pshard->index, rv, esp_err_to_name(rv));
+  }
+
+  xSemaphoreGive(pshard->mutex);
+
+  vSemaphoreDelete(pshard->mutex);
+  vSemaphoreDelete(pshard->done);
+
+  close(pshard->wakefd);
+}
+
+void _camwebsrv_sclients_shard_task(void *arg)
+{
+  _camwebsrv_sclients_shard_t *pshard;
+  esp_err_t rv;
+
+  pshard = (_camwebsrv_sclients_shard_t *) arg;
+
+  while(!pshard->stop)
+  {
+    uint16_t nextevent = UINT16_MAX;
+
+    // push out whatever this shard's clients can take
+
+    rv = _camwebsrv_sclients_shard_process(pshard, &nextevent);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_task(%u): _camwebsrv_sclients_shard_process() failed: [%d]: %s", pshard->index, rv, esp_err_to_name(rv));
+      nextevent = CAMWEBSRV_MAIN_MIN_CYCLE_MSEC;
+    }
+
+    // block until there is actually something to do
+
+    rv = _camwebsrv_sclients_shard_wait(pshard, nextevent);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_task(%u): _camwebsrv_sclients_shard_wait() failed: [%d]: %s", pshard->index, rv, esp_err_to_name(rv));
+      vTaskDelay(pdMS_TO_TICKS(CAMWEBSRV_MAIN_MIN_CYCLE_MSEC));
+    }
+  }
+
+  // let whoever stopped us know we're done
+
+  xSemaphoreGive(pshard->done);
+
+  vTaskDelete(NULL);
+}
+
+esp_err_t _camwebsrv_sclients_shard_header(_camwebsrv_sclients_shard_t *pshard, camwebsrv_camera_frame_t frame, camwebsrv_sclients_framing_t framing, const char **hbuf, size_t *hlen)
+{
+  esp_err_t rv;
+  const uint8_t *fbuf = NULL;
+  size_t flen = 0;
+  size_t plen;
+  char *p;
+
+  // already built for this frame? websocket clients have their own
+
+  if (framing == CAMWEBSRV_SCLIENTS_FRAMING_WS || (pshard->hlen > 0 && pshard->hseq == camwebsrv_camera_frame_seq(frame)))
+  {
+    goto header_out;
+  }
+
+  rv = camwebsrv_camera_frame_bytes(frame, &fbuf, &flen);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_header(%u): camwebsrv_camera_frame_bytes() failed: [%d]: %s", pshard->index, rv, esp_err_to_name(rv));
+    return ESP_FAIL;
+  }
+
+  // the part header is the boundary, content type and content length, then
+  // a blank line; the chunk also carries the frame and the end of the part
+
+  plen = strlen(_CAMWEBSRV_SCLIENTS_RESP_HDR_PART_STR) + _camwebsrv_sclients_count_digits(flen, 10) + 4;
+
+  p = pshard->hbuf;
+
+  p = p + _camwebsrv_sclients_format_digits(p, plen + flen + 2, 16);
+  memcpy(p, "\r\n", 2);
+  p = p + 2;
+
+  pshard->hpart = p - pshard->hbuf;
+
+  memcpy(p, _CAMWEBSRV_SCLIENTS_RESP_HDR_PART_STR, strlen(_CAMWEBSRV_SCLIENTS_RESP_HDR_PART_STR));
+  p = p + strlen(_CAMWEBSRV_SCLIENTS_RESP_HDR_PART_STR);
+
+  p = p + _camwebsrv_sclients_format_digits(p, flen, 10);
+  memcpy(p, "\r\n\r\n", 4);
+  p = p + 4;
+
+  pshard->hseq = camwebsrv_camera_frame_seq(frame);
+  pshard->hlen = p - pshard->hbuf;
+
+  // raw framing is the same header, minus the chunk size line
+
+  header_out:
+
+  if (framing == CAMWEBSRV_SCLIENTS_FRAMING_WS)
+  {
+    return _camwebsrv_sclients_shard_header_ws(pshard, frame, hbuf, hlen);
+  }
+
+  if (framing == CAMWEBSRV_SCLIENTS_FRAMING_RAW)
+  {
+    *hbuf = pshard->hbuf + pshard->hpart;
+    *hlen = pshard->hlen - pshard->hpart;
+  }
+  else
+  {
+    *hbuf = pshard->hbuf;
+    *hlen = pshard->hlen;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t _camwebsrv_sclients_shard_header_ws(_camwebsrv_sclients_shard_t *pshard, camwebsrv_camera_frame_t frame, const char **hbuf, size_t *hlen)
+{
+  esp_err_t rv;
+  const uint8_t *fbuf = NULL;
+  size_t flen = 0;
+  uint64_t plen;
+  uint64_t tstamp;
+  uint32_t seq;
+  uint8_t *p;
+  uint8_t i;
+
+  seq = camwebsrv_camera_frame_seq(frame);
+
+  // already built for this frame?
+
+  if (pshard->wlen > 0 && pshard->wseq == seq)
+  {
+    goto header_ws_out;
+  }
+
+  rv = camwebsrv_camera_frame_bytes(frame, &fbuf, &flen);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_header_ws(%u): camwebsrv_camera_frame_bytes() failed: [%d]: %s", pshard->index, rv, esp_err_to_name(rv));
+    return ESP_FAIL;
+  }
+
+  // final binary message, with a 7, 16 or 64 bit payload length
+
+  p = (uint8_t *) pshard->wbuf;
+  plen = _CAMWEBSRV_SCLIENTS_WS_META_LEN + flen;
+
+  *p++ = 0x82;
+
+  if (plen < 126)
+  {
+    *p++ = (uint8_t) plen;
+  }
+  else if (plen < 65536)
+  {
+    *p++ = 126;
+    *p++ = (uint8_t) (plen >> 8);
+    *p++ = (uint8_t) plen;
+  }
+  else
+  {
+    *p++ = 127;
+
+    for (i = 8; i > 0; i--)
+    {
+      *p++ = (uint8_t) (plen >> ((i - 1) * 8));
+    }
+  }
+
+  // then the frame's metadata
+
+  tstamp = (uint64_t) camwebsrv_camera_frame_tstamp(frame);
+
+  for (i = 4; i > 0; i--)
+  {
+    *p++ = (uint8_t) (seq >> ((i - 1) * 8));
+  }
+
+  for (i = 8; i > 0; i--)
+  {
+    *p++ = (uint8_t) (tstamp >> ((i - 1) * 8));
+  }
+
+  for (i = 4; i > 0; i--)
+  {
+    *p++ = (uint8_t) (((uint32_t) flen) >> ((i - 1) * 8));
+  }
+
+  pshard->wseq = seq;
+  pshard->wlen = p - (uint8_t *) pshard->wbuf;
+
+  header_ws_out:
+
+  *hbuf = pshard->wbuf;
+  *hlen = pshard->wlen;
+
+  return ESP_OK;
+}
+
+esp_err_t _camwebsrv_sclients_shard_header_oneshot(_camwebsrv_sclients_shard_t *pshard, camwebsrv_camera_frame_t frame, int64_t maxage, uint32_t tagid, const char **hbuf, size_t *hlen)
+{
+  esp_err_t rv;
+  const uint8_t *fbuf = NULL;
+  size_t flen = 0;
+  char mtime[CAMWEBSRV_CAMERA_MTIME_LEN];
+  int64_t ttl;
+  int n;
+
+  rv = camwebsrv_camera_frame_bytes(frame, &fbuf, &flen);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_header_oneshot(%u): camwebsrv_camera_frame_bytes() failed: [%d]: %s", pshard->index, rv, esp_err_to_name(rv));
+    return ESP_FAIL;
+  }
+
+  rv = camwebsrv_camera_frame_mtime(frame, mtime, sizeof(mtime));
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_header_oneshot(%u): camwebsrv_camera_frame_mtime() failed: [%d]: %s", pshard->index, rv, esp_err_to_name(rv));
+    return ESP_FAIL;
+  }
+
+  // the tag is the caller's per-boot id and the frame's sequence number, and
+  // caches may keep it for as long as we would have kept handing it out
+  // ourselves
+
+  ttl = maxage - (esp_timer_get_time() - camwebsrv_camera_frame_tstamp(frame));
+  ttl = (ttl > 0) ? ttl / 1000000 : 0;
+
+  n = snprintf(pshard->obuf, sizeof(pshard->obuf), _CAMWEBSRV_SCLIENTS_RESP_HDR_ONESHOT_STR, flen, (unsigned int) tagid, camwebsrv_camera_frame_seq(frame), mtime, (uint32_t) ttl);
+
+  if (n < 0 || n >= sizeof(pshard->obuf))
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_header_oneshot(%u): snprintf() failed", pshard->index);
+    pshard->olen = 0;
+    return ESP_FAIL;
+  }
+
+  pshard->olen = n;
+
+  *hbuf = pshard->obuf;
+  *hlen = pshard->olen;
+
+  return ESP_OK;
+}
+
+size_t _camwebsrv_sclients_count_digits(size_t n, uint8_t base)
+{
+  size_t i;
+
+  for(i = 1; n >= base; i++)
+  {
+    n = n / base;
+  }
+
+  return i;
+}
+
+size_t _camwebsrv_sclients_format_digits(char *buf, size_t n, uint8_t base)
+{
+  size_t len;
+  size_t i;
+
+  // fill in from the least significant digit; no terminating null
+
+  len = _camwebsrv_sclients_count_digits(n, base);
+
+  for (i = len; i > 0; i--)
+  {
+    buf[i - 1] = "0123456789abcdef"[n % base];
+    n = n / base;
+  }
+
+  return len;
+}
+
+size_t _camwebsrv_sclients_cost(camwebsrv_sclients_mode_t mode, size_t fsize)
+{
+  // a latency client holds on to one frame at a time, a smooth client to a
+  // full jitter buffer plus the one going out; either way, lwip buffers up
+  // to a send buffer's worth for its socket
+
+  if (mode == CAMWEBSRV_SCLIENTS_MODE_SMOOTH)
+  {
+    return (fsize * (CAMWEBSRV_SCLIENTS_JITTER_DEPTH + 1)) + CONFIG_LWIP_TCP_SND_BUF_DEFAULT;
+  }
+
+  return fsize + CONFIG_LWIP_TCP_SND_BUF_DEFAULT;
+}
+
+ssize_t _camwebsrv_sclients_sock_send_iov(int sockfd, struct iovec *iov, int iovcnt, size_t budget, int64_t tlimit, bool *bytehit, bool *timehit)
+{
+  size_t bytes_sent = 0;
+  struct msghdr msg;
+
+  memset(&msg, 0x00, sizeof(msg));
+
+  *bytehit = false;
+  *timehit = false;
+
+  while(iovcnt > 0)
+  {
+    ssize_t rv;
+    size_t len;
+    size_t saved;
+    int n;
+
+    // have we used up this turn's byte or time quantum?
+
+    if (bytes_sent >= budget)
+    {
+      *bytehit = true;
+      break;
+    }
+
+    if (esp_timer_get_time() >= tlimit)
+    {
+      *timehit = true;
+      break;
+    }
+
+    // gather as much of what's left as the byte quantum allows into a single
+    // call, trimming the last iovec if need be
+    // XXX we really should use httpd_socket_send() here, but we can't until
+    // IDFGH-9275 is fixed
+
+    for (n = 0, len = 0; n < iovcnt && len < (budget - bytes_sent); n++)
+    {
+      len = len + iov[n].iov_len;
+    }
+
+    saved = iov[n - 1].iov_len;
+
+    if (len > (budget - bytes_sent))
+    {
+      iov[n - 1].iov_len = saved - (len - (budget - bytes_sent));
+    }
+
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n;
+
+    rv = sendmsg(sockfd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    iov[n - 1].iov_len = saved;
+
+    // error?
+
+    if (rv < 0)
+    {
+      int e = errno;
+
+      if (e == EAGAIN || e == EWOULDBLOCK)
+      {
+        ESP_LOGD(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_sock_send_iov(%d): sendmsg() would block", sockfd);
+        break;
+      }
+
+      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_sock_send_iov(%d): sendmsg() failed: [%d]: %s", sockfd, e, strerror(e));
+      return -1;
+    }
+
+    // this should never happen, given that we're sendig with the NONBLOCK flag
+
+    if (rv == 0)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_sock_send_iov(%d): sendmsg() failed", sockfd);
+      return -2;
+    }
+
+    // success! skip over whatever was sent, which may end part-way through
+    // an iovec
+
+    bytes_sent = bytes_sent + rv;
+
+    while(iovcnt > 0 && rv >= iov->iov_len)
+    {
+      rv = rv - iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+
+    if (iovcnt > 0)
+    {
+      iov->iov_base = (uint8_t *) iov->iov_base + rv;
+      iov->iov_len = iov->iov_len - rv;
+    }
+  }
+
+  ESP_LOGD(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_sock_send_iov(%d): sent %u bytes", sockfd, bytes_sent);
+
+  return bytes_sent;
+}
+
+void _camwebsrv_sclients_node_quantum(_camwebsrv_sclients_node_t *pnode)
+{
+  size_t cap;
+
+  // deficit round robin: every turn adds a quantum of bytes to whatever the
+  // client didn't get to use last time, and caps how long it can hold the
+  // loop for
+
+  pnode->deficit = pnode->deficit + CAMWEBSRV_SCLIENTS_QUANTUM_BYTES;
+
+  // a client whose socket keeps saying EAGAIN would otherwise bank credit
+  // without limit, and then hog the loop once it drains; it never needs more
+  // than a quantum on top of what it still has to send
+
+  cap = CAMWEBSRV_SCLIENTS_QUANTUM_BYTES + _camwebsrv_sclients_node_backlog(pnode);
+
+  if (pnode->deficit > cap)
+  {
+    pnode->deficit = cap;
+  }
+
+  pnode->tquantum = esp_timer_get_time() + CAMWEBSRV_SCLIENTS_QUANTUM_USEC;
+  pnode->qturns++;
+}
+
+size_t _camwebsrv_sclients_node_backlog(_camwebsrv_sclients_node_t *pnode)
+{
+  size_t backlog;
+
+  // what's in the socket buffer, plus whatever is left of the frame
+
+  backlog = camwebsrv_ringbuf_length(pnode->sockbuf);
+
+  if (pnode->frame != NULL)
+  {
+    const uint8_t *fbytes = NULL;
+    size_t flen = 0;
+
+    camwebsrv_camera_frame_bytes(pnode->frame, &fbytes, &flen);
+
+    backlog = backlog + (flen - pnode->foffset) + (pnode->tlen - pnode->toffset);
+  }
+
+  return backlog;
+}
+
+esp_err_t _camwebsrv_sclients_node_flush(_camwebsrv_sclients_node_t *pnode, bool *flushed)
+{
+  esp_err_t rv;
+  ssize_t sent;
+  struct iovec iov[_CAMWEBSRV_SCLIENTS_IOV_MAX];
+  int iovcnt = 0;
+  const uint8_t *bbytes1 = NULL;
+  const uint8_t *bbytes2 = NULL;
+  size_t blen1 = 0;
+  size_t blen2 = 0;
+  const uint8_t *fbytes = NULL;
+  size_t flen = 0;
+  size_t tlen = pnode->tlen;
+  size_t n;
+  bool bytehit = false;
+  bool timehit = false;
+
+  // buffered bytes always go out first
+
+  rv = camwebsrv_ringbuf_peek(pnode->sockbuf, &bbytes1, &blen1, &bbytes2, &blen2);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_flush(%d): camwebsrv_ringbuf_peek() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
+    return ESP_FAIL;
+  }
+
+  if (blen1 > 0)
+  {
+    iov[iovcnt].iov_base = (void *) bbytes1;
+    iov[iovcnt].iov_len = blen1;
+    iovcnt++;
+  }
+
+  if (blen2 > 0)
+  {
+    iov[iovcnt].iov_base = (void *) bbytes2;
+    iov[iovcnt].iov_len = blen2;
+    iovcnt++;
+  }
+
+  // then whatever is left of the frame, straight from the shared frame
+  // buffer, then the chunk end
+
+  if (pnode->frame != NULL)
+  {
+    rv = camwebsrv_camera_frame_bytes(pnode->frame, &fbytes, &flen);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_flush(%d): camwebsrv_camera_frame_bytes() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
+      return ESP_FAIL;
+    }
+
+    if (pnode->foffset < flen)
+    {
+      iov[iovcnt].iov_base = (void *) (fbytes + pnode->foffset);
+      iov[iovcnt].iov_len = flen - pnode->foffset;
+      iovcnt++;
+    }
+
+    if (pnode->toffset < tlen)
+    {
+      iov[iovcnt].iov_base = (void *) (pnode->trailer + pnode->toffset);
+      iov[iovcnt].iov_len = tlen - pnode->toffset;
+      iovcnt++;
+    }
+  }
+
+  // nothing to do if there's nothing to send
+
+  if (iovcnt > 0)
+  {
+    sent = _camwebsrv_sclients_sock_send_iov(pnode->sockfd, iov, iovcnt, pnode->deficit, pnode->tquantum, &bytehit, &timehit);
+
+    if (sent < 0)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_flush(%d): _camwebsrv_sclients_sock_send_iov() failed", pnode->sockfd);
+      return ESP_FAIL;
+    }
+
+    // charge it to the client's deficit, and keep count of how often the
+    // quantum cut it short
+
+    pnode->deficit = pnode->deficit - sent;
+
+    if (bytehit)
+    {
+      pnode->qbytehits++;
+    }
+
+    if (timehit)
+    {
+      pnode->qtimehits++;
+    }
+
+    // update idle timer, but only if we actually got somewhere
+
+    if (sent > 0)
+    {
+      pnode->twritelast = esp_timer_get_time();
+    }
+
+    pnode->sbytes = pnode->sbytes + sent;
+
+    // account for what was sent, in the order it was gathered
+
+    n = (sent < (blen1 + blen2)) ? sent : (blen1 + blen2);
+
+    camwebsrv_ringbuf_consume(pnode->sockbuf, n);
+
+    sent = sent - n;
+
+    if (pnode->frame != NULL)
+    {
+      n = (sent < (flen - pnode->foffset)) ? sent : (flen - pnode->foffset);
+
+      pnode->foffset = pnode->foffset + n;
+      pnode->toffset = pnode->toffset + (sent - n);
+
+      // whole part sent, so let the frame go
+
+      if (pnode->foffset == flen && pnode->toffset == tlen)
+      {
+        camwebsrv_camera_frame_dispose(&(pnode->frame));
+        pnode->foffset = 0;
+        pnode->toffset = 0;
+        pnode->sframes++;
+      }
+    }
+
+    // if neither quantum cut it short and there's still something left, the
+    // socket would have blocked
+
+    if (!bytehit && !timehit && (camwebsrv_ringbuf_length(pnode->sockbuf) > 0 || pnode->frame != NULL))
+    {
+      pnode->sstalls++;
+    }
+  }
+
+  // set flag, if supplied
+
+  if (flushed != NULL)
+  {
+    *flushed = (camwebsrv_ringbuf_length(pnode->sockbuf) == 0 && pnode->frame == NULL);
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t _camwebsrv_sclients_node_frame(_camwebsrv_sclients_node_t *pnode, camwebsrv_camera_frame_t frame, const char *hbuf, size_t hlen)
+{
+  esp_err_t rv;
+  const uint8_t *fbytes = NULL;
+  size_t flen = 0;
+
+  // the node takes over the caller's frame reference
+
+  pnode->frame = frame;
+  pnode->foffset = 0;
+  pnode->toffset = 0;
+
+  // keep track of the size of the frames handed out
+
+  if (camwebsrv_camera_frame_bytes(frame, &fbytes, &flen) == ESP_OK)
+  {
+    pnode->rframes++;
+    pnode->rfbytes = pnode->rfbytes + flen;
+  }
+
+  // chunk header
+
+  rv = camwebsrv_ringbuf_write(pnode->sockbuf, (const uint8_t *) hbuf, hlen);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_frame(%d): camwebsrv_ringbuf_write() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
+    return ESP_FAIL;
+  }
+
+  // chunk header, chunk data and chunk end all go out in one go, as far as
+  // the socket lets us
+
+  rv = _camwebsrv_sclients_node_flush(pnode, NULL);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_frame(%d): _camwebsrv_sclients_node_flush() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
+    return ESP_FAIL;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t _camwebsrv_sclients_node_next(_camwebsrv_sclients_node_t *pnode, camwebsrv_camera_frame_t latest, int64_t interval, camwebsrv_camera_frame_t *frame)
+{
+  esp_err_t rv;
+  uint32_t seq;
+  int64_t tstamp;
+
+  *frame = NULL;
+
+  // smooth: play out the oldest queued frame
+
+  if (pnode->mode == CAMWEBSRV_SCLIENTS_MODE_SMOOTH)
+  {
+    if (pnode->jlen > 0)
+    {
+      *frame = pnode->jqueue[pnode->jhead];
+
+      pnode->jqueue[pnode->jhead] = NULL;
+      pnode->jhead = (pnode->jhead + 1) % CAMWEBSRV_SCLIENTS_JITTER_DEPTH;
+      pnode->jlen--;
+    }
+
+    return ESP_OK;
+  }
+
+  // latency: skip straight to the newest frame, if there is one and we
+  // haven't already sent it
+
+  if (latest == NULL)
+  {
+    return ESP_OK;
+  }
+
+  seq = camwebsrv_camera_frame_seq(latest);
+
+  if (seq == pnode->fseqlast)
+  {
+    return ESP_OK;
+  }
+
+  rv = camwebsrv_camera_frame_ref(latest);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_next(%d): camwebsrv_camera_frame_ref() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
+    return ESP_FAIL;
+  }
+
+  // every whole interval skipped since the last frame we sent is a frame this
+  // client should have seen, but didn't
+
+  tstamp = camwebsrv_camera_frame_tstamp(latest);
+
+  if (pnode->fseqlast > 0 && (tstamp - pnode->tframelast) >= (2 * interval))
+  {
+    pnode->fdropped = pnode->fdropped + (((tstamp - pnode->tframelast) / interval) - 1);
+  }
+
+  pnode->fseqlast = seq;
+
+  *frame = latest;
+
+  return ESP_OK;
+}
+
+esp_err_t _camwebsrv_sclients_node_enqueue(_camwebsrv_sclients_node_t *pnode, camwebsrv_camera_frame_t latest, int64_t interval)
+{
+  esp_err_t rv;
+  uint32_t seq;
+  int64_t tstamp;
+
+  // is there one at all, have we already queued it, or is it too soon for
+  // the next one?
+
+  if (latest == NULL)
+  {
+    return ESP_OK;
+  }
+
+  seq = camwebsrv_camera_frame_seq(latest);
+  tstamp = camwebsrv_camera_frame_tstamp(latest);
+
+  if (seq == pnode->fseqlast || tstamp < (pnode->tqueuelast + interval))
+  {
+    return ESP_OK;
+  }
+
+  // if the queue is full, make room by dropping the oldest frame
+
+  if (pnode->jlen == CAMWEBSRV_SCLIENTS_JITTER_DEPTH)
+  {
+    camwebsrv_camera_frame_dispose(&(pnode->jqueue[pnode->jhead]));
+
+    pnode->jhead = (pnode->jhead + 1) % CAMWEBSRV_SCLIENTS_JITTER_DEPTH;
+    pnode->jlen--;
+    pnode->fdropped++;
+  }
+
+  rv = camwebsrv_camera_frame_ref(latest);
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_enqueue(%d): camwebsrv_camera_frame_ref() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
+    return ESP_FAIL;
+  }
+
+  pnode->jqueue[(pnode->jhead + pnode->jlen) % CAMWEBSRV_SCLIENTS_JITTER_DEPTH] = latest;
+  pnode->jlen++;
+
+  pnode->fseqlast = seq;
+  pnode->tqueuelast = tstamp;
+
+  return ESP_OK;
+}
+
+esp_err_t _camwebsrv_sclients_node_oneshot(_camwebsrv_sclients_node_t *pnode, camwebsrv_camera_t cam, camwebsrv_camera_frame_t *frame)
+{
+  esp_err_t rv;
+
+  *frame = NULL;
+
+  // nothing published yet, so nothing to send yet either
+
+  rv = camwebsrv_camera_frame_current(cam, frame);
+
+  if (rv == ESP_ERR_NOT_FOUND)
+  {
+    return ESP_OK;
+  }
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_node_oneshot(%d): camwebsrv_camera_frame_current() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
+    return ESP_FAIL;
+  }
+
+  // captured before the oldest this client takes? then wait for the next
+  // one to be published
+
+  if (camwebsrv_camera_frame_tstamp(*frame) < pnode->tmin)
+  {
+    camwebsrv_camera_frame_dispose(frame);
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t _camwebsrv_sclients_latest(camwebsrv_camera_t cam, int64_t maxage, camwebsrv_camera_frame_t *latest)
+{
+  esp_err_t rv;
+
+  // is the frame we already have fresh enough for this client?
+
+  if (*latest != NULL && (esp_timer_get_time() - camwebsrv_camera_frame_tstamp(*latest)) < maxage)
+  {
+    return ESP_OK;
+  }
+
+  // if not, take whatever the camera published last; no client asks for
+  // frames faster than the camera makes them, so there's never a fresher one
+  // worth waiting for, and the pass never blocks on the producer
+
+  if (*latest != NULL)
+  {
+    camwebsrv_camera_frame_dispose(latest);
+  }
+
+  rv = camwebsrv_camera_frame_current(cam, latest);
+
+  if (rv != ESP_OK && rv != ESP_ERR_NOT_FOUND)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_latest(): camwebsrv_camera_frame_current() failed: [%d]: %s", rv, esp_err_to_name(rv));
+  }
+
+  return rv;
+}
+
+esp_err_t _camwebsrv_sclients_sock_get_peer(int sockfd, char *caddr)
+{
+  _CAMWEBSRV_SCLIIENTS_SOCKADDR_IN_T addr;
+  socklen_t len = sizeof(addr);
+  char tip[_CAMWEBSRV_SCLIENTS_ADDRSTRLEN];
+
+  memset(&addr, 0x00, sizeof(addr));
+
+  if (getpeername(sockfd, (struct sockaddr *) &addr, &len) != 0)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_sock_get_peer(): getpeername() failed: [%d]: %s", e, strerror(e));
+    return ESP_FAIL;
+  }
+
+  if (inet_ntop(_CAMWEBSRV_SCLIENTS_AF, &_CAMWEBSRV_SCLIENTS_ADDR(addr), tip, _CAMWEBSRV_SCLIENTS_ADDRSTRLEN) == NULL)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_sock_get_peer(): inet_ntop() failed: [%d]: %s", e, strerror(e));
+    return ESP_FAIL;
+  }
+
+  sprintf(caddr, "%s:%d", tip, ntohs(_CAMWEBSRV_SCLIENTS_PORT(addr)));
+
+  return ESP_OK;
+}
+
+int _camwebsrv_sclients_sock_wake(void)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int sockfd;
+
+  // a UDP socket on the loopback interface, connected to itself
+
+  sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+  if (sockfd < 0)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_sock_wake(): socket() failed: [%d]: %s", e, strerror(e));
+    return -1;
+  }
+
+  memset(&addr, 0x00, sizeof(addr));
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+
+  if (bind(sockfd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_sock_wake(): bind() failed: [%d]: %s", e, strerror(e));
+    close(sockfd);
+    return -1;
+  }
+
+  if (getsockname(sockfd, (struct sockaddr *) &addr, &len) != 0)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_sock_wake(): getsockname() failed: [%d]: %s", e, strerror(e));
+    close(sockfd);
+    return -1;
+  }
+
+  if (connect(sockfd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_sock_wake(): connect() failed: [%d]: %s", e, strerror(e));
+    close(sockfd);
+    return -1;
+  }
+
+  if (fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK) != 0)
+  {
+    int e = errno;
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_sock_wake(): fcntl() failed: [%d]: %s", e, strerror(e));
+    close(sockfd);
+    return -1;
+  }
+
+  return sockfd;
+}
+
+esp_err_t _camwebsrv_sclients_shard_purge(_camwebsrv_sclients_shard_t *pshard, httpd_handle_t handle)
+{
+  _camwebsrv_sclients_node_t *pnode;
+
+  // clients still waiting to be taken in go as well
+
+  _camwebsrv_sclients_shard_drain(pshard);
+
+  while(pshard->count > 0)
+  {
+    esp_err_t rv;
+
+    pnode = pshard->active[pshard->count - 1];
+
+    // be graceful and try to flush out the buffer first, within one quantum
+
+    _camwebsrv_sclients_node_quantum(pnode);
+
+    rv = _camwebsrv_sclients_node_flush(pnode, NULL);
+
+    if (rv != ESP_OK)
+    {
+      ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_purge(%d): _camwebsrv_sclients_node_flush() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
+    }
+
+    // kill session
+
+    if (pnode->sockfd > 0 && handle != NULL)
+    {
+      httpd_sess_trigger_close(handle, pnode->sockfd);
+    }
+
+    ESP_LOGI(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_purge(%d): Removed client", pnode->sockfd);
+
+    _camwebsrv_sclients_shard_remove(pshard, pshard->count - 1);
+  }
+
+  _camwebsrv_sclients_shard_publish(pshard);
+
+  return ESP_OK;
+}
+
+void _camwebsrv_sclients_shard_remove(_camwebsrv_sclients_shard_t *pshard, size_t pos)
+{
+  _camwebsrv_sclients_node_t *pnode = pshard->active[pos];
+
+  // release frames
+
+  if (pnode->frame != NULL)
+  {
+    camwebsrv_camera_frame_dispose(&(pnode->frame));
+  }
+
+  while(pnode->jlen > 0)
+  {
+    camwebsrv_camera_frame_dispose(&(pnode->jqueue[pnode->jhead]));
+
+    pnode->jhead = (pnode->jhead + 1) % CAMWEBSRV_SCLIENTS_JITTER_DEPTH;
+    pnode->jlen--;
+  }
+
+  // empty the buffer, but keep track of how much of it was actually used
+  // first
+
+  ESP_LOGD(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_remove(%d): socket buffer high-water mark: %u of %u bytes", pnode->sockfd, camwebsrv_ringbuf_highwater(pnode->sockbuf), camwebsrv_ringbuf_capacity(pnode->sockbuf));
+
+  if (camwebsrv_ringbuf_highwater(pnode->sockbuf) > pshard->hwm)
+  {
+    pshard->hwm = camwebsrv_ringbuf_highwater(pnode->sockbuf);
+  }
+
+  camwebsrv_ringbuf_clear(pnode->sockbuf);
+
+  // the shard keeps the quantum counts of clients that have gone
+
+  pshard->qturns = pshard->qturns + pnode->qturns;
+  pshard->qbytehits = pshard->qbytehits + pnode->qbytehits;
+  pshard->qtimehits = pshard->qtimehits + pnode->qtimehits;
+
+  pnode->active = false;
+
+  atomic_fetch_sub(&(pshard->load[pnode->mode]), 1);
+
+  // fill the gap with the last active client, so the array stays dense
+
+  pshard->count--;
+
+  if (pos < pshard->count)
+  {
+    pshard->active[pos] = pshard->active[pshard->count];
+    pshard->active[pos]->pos = pos;
+  }
+
+  pshard->active[pshard->count] = NULL;
+}
+
+void _camwebsrv_sclients_shard_publish(_camwebsrv_sclients_shard_t *pshard)
+{
+  _camwebsrv_sclients_pub_t *pub = &(pshard->pub);
+  _camwebsrv_sclients_node_t *curr;
+  uint32_t seq;
+  size_t i;
+
+  // caller holds the shard's mutex, which makes it the only writer; don't
+  // let anything on this core get in while the count is odd, so readers
+  // never spin for long
+
+  vTaskSuspendAll();
+
+  seq = atomic_load_explicit(&(pshard->pseq), memory_order_relaxed);
+
+  atomic_store_explicit(&(pshard->pseq), seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  pub->count = 0;
+  pub->occupancy = 0;
+  pub->qturns = pshard->qturns;
+  pub->qbytehits = pshard->qbytehits;
+  pub->qtimehits = pshard->qtimehits;
+
+  for (i = 0; i < pshard->count && i < CAMWEBSRV_SCLIENTS_MAX_CLIENTS; i++)
+  {
+    camwebsrv_sclients_info_t *pinfo = &(pub->stats[i].info);
+
+    curr = pshard->active[i];
+
+    pinfo->sockfd = curr->sockfd;
+    pinfo->shard = pshard->index;
+    pinfo->mode = curr->mode;
+    pinfo->framing = curr->framing;
+    pinfo->fps = curr->fps;
+    pinfo->tconnect = curr->tconnect;
+    pinfo->bytes = curr->sbytes;
+    pinfo->frames = curr->sframes;
+    pinfo->dropped = curr->fdropped;
+    pinfo->stalls = curr->sstalls;
+    pinfo->buffered = _camwebsrv_sclients_node_backlog(curr);
+
+    memcpy(pinfo->addr, curr->caddr, sizeof(pinfo->addr));
+
+    pub->stats[i].rframes = curr->rframes;
+    pub->stats[i].rfbytes = curr->rfbytes;
+
+    pub->occupancy = pub->occupancy + camwebsrv_ringbuf_length(curr->sockbuf);
+
+    if (camwebsrv_ringbuf_highwater(curr->sockbuf) > pshard->hwm)
+    {
+      pshard->hwm = camwebsrv_ringbuf_highwater(curr->sockbuf);
+    }
+
+    pub->qturns = pub->qturns + curr->qturns;
+    pub->qbytehits = pub->qbytehits + curr->qbytehits;
+    pub->qtimehits = pub->qtimehits + curr->qtimehits;
+
+    pub->count++;
+  }
+
+  pub->hwm = pshard->hwm;
+
+  atomic_store_explicit(&(pshard->pseq), seq + 2, memory_order_release);
+
+  xTaskResumeAll();
+}
+
+void _camwebsrv_sclients_shard_read(_camwebsrv_sclients_shard_t *pshard, _camwebsrv_sclients_pub_t *pub)
+{
+  uint32_t seq1;
+  uint32_t seq2;
+
+  // copy it out, and start over if the sender task was writing it meanwhile
+
+  while(true)
+  {
+    seq1 = atomic_load_explicit(&(pshard->pseq), memory_order_acquire);
+
+    if (seq1 & 1)
+    {
+      continue;
+    }
+
+    memcpy(pub, &(pshard->pub), sizeof(_camwebsrv_sclients_pub_t));
+
+    atomic_thread_fence(memory_order_acquire);
+
+    seq2 = atomic_load_explicit(&(pshard->pseq), memory_order_relaxed);
+
+    if (seq1 == seq2)
+    {
+      break;
+    }
+  }
+}
+
+void _camwebsrv_sclients_shard_post(_camwebsrv_sclients_shard_t *pshard, _camwebsrv_sclients_event_t *pevent)
+{
+  _camwebsrv_sclients_event_t *head;
+
+  // push onto the shard's stack; whatever was written to the slot before
+  // this is visible to the sender task once it takes the stack
+
+  head = atomic_load_explicit(&(pshard->queue), memory_order_relaxed);
+
+  do
+  {
+    pevent->next = head;
+  }
+  while(!atomic_compare_exchange_weak_explicit(&(pshard->queue), &head, pevent, memory_order_release, memory_order_relaxed));
+
+  _camwebsrv_sclients_shard_wake(pshard);
+}
+
+void _camwebsrv_sclients_shard_drain(_camwebsrv_sclients_shard_t *pshard)
+{
+  _camwebsrv_sclients_event_t *head;
+  _camwebsrv_sclients_event_t *prev = NULL;
+  _camwebsrv_sclients_event_t *next;
+  esp_err_t rv;
+
+  // caller holds the shard's mutex, which makes it the only consumer; take
+  // the whole stack, and turn it round so events are seen in posting order
+
+  head = atomic_exchange_explicit(&(pshard->queue), NULL, memory_order_acquire);
+
+  while(head != NULL)
+  {
+    next = head->next;
+    head->next = prev;
+    prev = head;
+    head = next;
+  }
+
+  while(prev != NULL)
+  {
+    _camwebsrv_sclients_event_t *pevent = prev;
+    _camwebsrv_sclients_mbox_t *pmbox = pevent->pmbox;
+    _camwebsrv_sclients_node_t *pnode = pmbox->pnode;
+    camwebsrv_sclients_mode_t mode;
+    uint32_t seq;
+    uint16_t code;
+    size_t plen;
+    uint8_t acked = 0;
+
+    prev = pevent->next;
+
+    switch(pevent->type)
+    {
+      case _CAMWEBSRV_SCLIENTS_EVENT_ADD:
+
+        mode = pmbox->params.mode;
+
+        rv = _camwebsrv_sclients_shard_insert(pshard, pnode, &(pmbox->params), pmbox->caddr);
+
+        atomic_store(&(pevent->queued), false);
+
+        if (rv != ESP_OK)
+        {
+          ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_drain(%d): _camwebsrv_sclients_shard_insert() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
+          atomic_fetch_sub(&(pshard->load[mode]), 1);
+          httpd_sess_trigger_close(pshard->handle, pnode->sockfd);
+        }
+
+        break;
+
+      case _CAMWEBSRV_SCLIENTS_EVENT_CLOSE:
+
+        // the server closed it, so there's no one left to send to; the
+        // session may already be gone if it was this shard that asked for
+        // the close
+
+        if (pnode->active && pnode->shard == pshard->index)
+        {
+          ESP_LOGI(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_drain(%d): Removed client; session closed", pnode->sockfd);
+          _camwebsrv_sclients_shard_remove(pshard, pnode->pos);
+        }
+
+        // nothing refers to the socket any more, so it can go
+
+        close(pnode->sockfd);
+
+        break;
+
+      case _CAMWEBSRV_SCLIENTS_EVENT_ACK:
+
+        // let the next ack be posted before reading this one, so that none
+        // get lost in between
+
+        atomic_store(&(pevent->queued), false);
+
+        seq = atomic_load(&(pmbox->ackseq));
+
+        if (!pnode->active || pnode->shard != pshard->index || pnode->framing != CAMWEBSRV_SCLIENTS_FRAMING_WS)
+        {
+          break;
+        }
+
+        // an ack covers the given frame and every frame sent before it
+
+        while(pnode->wlen > 0 && ((int32_t) (pnode->wqueue[pnode->whead] - seq)) <= 0)
+        {
+          pnode->whead = (pnode->whead + 1) % CAMWEBSRV_SCLIENTS_WS_WINDOW;
+          pnode->wlen--;
+          acked++;
+        }
+
+        // a client that acks is alive, even if it hasn't been sent anything
+        // lately
+
+        pnode->twritelast = esp_timer_get_time();
+
+        ESP_LOGV(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_drain(%d): acked %u frames up to %u", pnode->sockfd, acked, seq);
+
+        break;
+
+      case _CAMWEBSRV_SCLIENTS_EVENT_PING:
+
+        // copy the payload out before letting the next ping be posted, since
+        // that one is written to the same place
+
+        plen = pmbox->plen;
+
+        if (pnode->active && pnode->shard == pshard->index && pnode->framing == CAMWEBSRV_SCLIENTS_FRAMING_WS && !pnode->closing)
+        {
+          pnode->cbuf[0] = _CAMWEBSRV_SCLIENTS_WS_OP_PONG;
+          pnode->cbuf[1] = (uint8_t) plen;
+
+          memcpy(pnode->cbuf + 2, pmbox->pbuf, plen);
+
+          pnode->clen = 2 + plen;
+          pnode->twritelast = esp_timer_get_time();
+        }
+
+        atomic_store(&(pevent->queued), false);
+
+        break;
+
+      case _CAMWEBSRV_SCLIENTS_EVENT_BYE:
+
+        atomic_store(&(pevent->queued), false);
+
+        code = atomic_load(&(pmbox->byecode));
+
+        if (!pnode->active || pnode->shard != pshard->index || pnode->framing != CAMWEBSRV_SCLIENTS_FRAMING_WS || pnode->closing)
+        {
+          break;
+        }
+
+        // echo the client's close code, if it gave one; this replaces any
+        // pong that hasn't gone out yet, as nothing may follow a close
+
+        pnode->cbuf[0] = _CAMWEBSRV_SCLIENTS_WS_OP_CLOSE;
+
+        if (code > 0)
+        {
+          pnode->cbuf[1] = 2;
+          pnode->cbuf[2] = (uint8_t) (code >> 8);
+          pnode->cbuf[3] = (uint8_t) code;
+          pnode->clen = 4;
+        }
+        else
+        {
+          pnode->cbuf[1] = 0;
+          pnode->clen = 2;
+        }
+
+        pnode->closing = true;
+
+        ESP_LOGI(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_drain(%d): client closed the session; code %u", pnode->sockfd, code);
+
+        break;
+    }
+  }
+}
+
+esp_err_t _camwebsrv_sclients_shard_insert(_camwebsrv_sclients_shard_t *pshard, _camwebsrv_sclients_node_t *pnode, const camwebsrv_sclients_params_t *params, const char *caddr)
+{
+  esp_err_t rv;
+
+  // does it already exist?
+
+  if (pnode->active)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_insert(%d): failed: already in the client list", pnode->sockfd);
+    return ESP_FAIL;
+  }
+
+  // set up the slot; its socket buffer was allocated up front, and only
+  // needs emptying out
+
+  pnode->frame = NULL;
+  pnode->foffset = 0;
+  pnode->toffset = 0;
+  pnode->mode = params->mode;
+  pnode->framing = params->framing;
+
+  // each framing ends a frame its own way
+
+  if (params->framing == CAMWEBSRV_SCLIENTS_FRAMING_WS)
+  {
+    pnode->trailer = _CAMWEBSRV_SCLIENTS_RESP_TRL_WS_STR;
+  }
+  else if (params->framing == CAMWEBSRV_SCLIENTS_FRAMING_ONESHOT)
+  {
+    pnode->trailer = _CAMWEBSRV_SCLIENTS_RESP_TRL_ONESHOT_STR;
+  }
+  else if (params->framing == CAMWEBSRV_SCLIENTS_FRAMING_RAW)
+  {
+    pnode->trailer = _CAMWEBSRV_SCLIENTS_RESP_TRL_PART_STR;
+  }
+  else
+  {
+    pnode->trailer = _CAMWEBSRV_SCLIENTS_RESP_TRL_CHUNK_STR;
+  }
+
+  pnode->tlen = strlen(pnode->trailer);
+  pnode->fps = params->fps;
+  pnode->maxage = params->maxage;
+  pnode->tmin = params->tmin;
+  pnode->tagid = params->tagid;
+  pnode->jhead = 0;
+  pnode->jlen = 0;
+  pnode->whead = 0;
+  pnode->wlen = 0;
+  pnode->clen = 0;
+  pnode->closing = false;
+  pnode->fseqlast = 0;
+  pnode->fdropped = 0;
+  pnode->deficit = 0;
+  pnode->tquantum = 0;
+  pnode->qturns = 0;
+  pnode->qbytehits = 0;
+  pnode->qtimehits = 0;
+  pnode->rframes = 0;
+  pnode->rfbytes = 0;
+  pnode->sbytes = 0;
+  pnode->sframes = 0;
+  pnode->sstalls = 0;
+  pnode->tframelast = 0;
+  pnode->tqueuelast = 0;
+  pnode->twritelast = esp_timer_get_time();
+  pnode->tconnect = pnode->twritelast;
+
+  strncpy(pnode->caddr, caddr, sizeof(pnode->caddr) - 1);
+  pnode->caddr[sizeof(pnode->caddr) - 1] = '\0';
+
+  camwebsrv_ringbuf_clear(pnode->sockbuf);
+
+  // load http headers in buffer
+  // XXX: instead of loading into the buffer, consider attempting to write to the socket instead
+
+  if (params->framing == CAMWEBSRV_SCLIENTS_FRAMING_WS || params->framing == CAMWEBSRV_SCLIENTS_FRAMING_ONESHOT)
+  {
+    rv = ESP_OK;
+  }
+  else if (params->framing == CAMWEBSRV_SCLIENTS_FRAMING_RAW)
+  {
+    rv = camwebsrv_ringbuf_write(pnode->sockbuf, (const uint8_t *) _CAMWEBSRV_SCLIENTS_RESP_HDR_MAIN_RAW_STR, strlen(_CAMWEBSRV_SCLIENTS_RESP_HDR_MAIN_RAW_STR));
+  }
+  else
+  {
+    rv = camwebsrv_ringbuf_write(pnode->sockbuf, (const uint8_t *) _CAMWEBSRV_SCLIENTS_RESP_HDR_MAIN_STR, strlen(_CAMWEBSRV_SCLIENTS_RESP_HDR_MAIN_STR));
+  }
+
+  if (rv != ESP_OK)
+  {
+    ESP_LOGE(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_insert(%d): camwebsrv_ringbuf_write() failed: [%d]: %s", pnode->sockfd, rv, esp_err_to_name(rv));
+    return rv;
+  }
+
+  // append to the shard's active array
+
+  pnode->active = true;
+  pnode->shard = pshard->index;
+  pnode->pos = pshard->count;
+
+  pshard->active[pshard->count] = pnode;
+  pshard->count++;
 
-  *plist = NULL;
+  ESP_LOGI(CAMWEBSRV_TAG, "SCLIENTS _camwebsrv_sclients_shard_insert(%d): Added client %s; shard: %u; mode: %s; framing: %s; fps: %u", pnode->sockfd, caddr, pshard->index, params->mode == CAMWEBSRV_SCLIENTS_MODE_SMOOTH ? "smooth" : "latency", params->framing == CAMWEBSRV_SCLIENTS_FRAMING_WS ? "ws" : (params->framing == CAMWEBSRV_SCLIENTS_FRAMING_ONESHOT ? "oneshot" : (params->framing == CAMWEBSRV_SCLIENTS_FRAMING_RAW ? "raw" : "chunked")), params->fps);
 
   return ESP_OK;
 }
@@ -7,17 +7,96 @@
 
 #include "camera.h"
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <esp_err.h>
 #include <esp_http_server.h>
 
+// long enough for an IPv6 address and a port
+
+#define CAMWEBSRV_SCLIENTS_ADDR_LEN 54
+
 typedef void *camwebsrv_sclients_t;
 
+typedef enum
+{
+  CAMWEBSRV_SCLIENTS_MODE_LATENCY,
+  CAMWEBSRV_SCLIENTS_MODE_SMOOTH
+} camwebsrv_sclients_mode_t;
+
+typedef enum
+{
+  CAMWEBSRV_SCLIENTS_FRAMING_CHUNKED,
+  CAMWEBSRV_SCLIENTS_FRAMING_RAW,
+  CAMWEBSRV_SCLIENTS_FRAMING_WS,
+  CAMWEBSRV_SCLIENTS_FRAMING_ONESHOT
+} camwebsrv_sclients_framing_t;
+
+typedef struct
+{
+  camwebsrv_sclients_mode_t mode;
+  camwebsrv_sclients_framing_t framing;
+  uint8_t fps;
+  int64_t maxage;
+  int64_t tmin;
+  uint32_t tagid;
+} camwebsrv_sclients_params_t;
+
+typedef struct
+{
+  size_t clients;
+  uint32_t bytes;
+  uint32_t stalls;
+  uint32_t frames;
+  uint32_t fbytes;
+  uint32_t slowest;
+  size_t backlog;
+} camwebsrv_sclients_rate_t;
+
+typedef struct
+{
+  size_t clients;
+  size_t clients_max;
+  size_t fsize;
+  size_t used;
+  size_t budget;
+  size_t heap;
+  size_t reserve;
+} camwebsrv_sclients_limits_t;
+
+typedef struct
+{
+  int sockfd;
+  char addr[CAMWEBSRV_SCLIENTS_ADDR_LEN];
+  uint8_t shard;
+  camwebsrv_sclients_mode_t mode;
+  camwebsrv_sclients_framing_t framing;
+  uint8_t fps;
+  int64_t tconnect;
+  uint64_t bytes;
+  uint32_t frames;
+  uint32_t dropped;
+  uint32_t stalls;
+  size_t buffered;
+} camwebsrv_sclients_info_t;
+
 esp_err_t camwebsrv_sclients_init(camwebsrv_sclients_t *clients);
 esp_err_t camwebsrv_sclients_destroy(camwebsrv_sclients_t *clients, httpd_handle_t handle);
-esp_err_t camwebsrv_sclients_add(camwebsrv_sclients_t clients, int sockfd);
+esp_err_t camwebsrv_sclients_start(camwebsrv_sclients_t clients, camwebsrv_camera_t cam, httpd_handle_t handle);
+esp_err_t camwebsrv_sclients_params_init(camwebsrv_sclients_params_t *params);
+esp_err_t camwebsrv_sclients_limits(camwebsrv_sclients_t clients, camwebsrv_sclients_limits_t *limits);
+esp_err_t camwebsrv_sclients_admit(camwebsrv_sclients_t clients, const camwebsrv_sclients_params_t *params);
+esp_err_t camwebsrv_sclients_add(camwebsrv_sclients_t clients, int sockfd, const camwebsrv_sclients_params_t *params);
+esp_err_t camwebsrv_sclients_close(camwebsrv_sclients_t clients, int sockfd);
+esp_err_t camwebsrv_sclients_ack(camwebsrv_sclients_t clients, int sockfd, uint32_t seq);
+esp_err_t camwebsrv_sclients_ping(camwebsrv_sclients_t clients, int sockfd, const uint8_t *payload, size_t len);
+esp_err_t camwebsrv_sclients_bye(camwebsrv_sclients_t clients, int sockfd, uint16_t code);
 esp_err_t camwebsrv_sclients_purge(camwebsrv_sclients_t clients, httpd_handle_t handle);
-esp_err_t camwebsrv_sclients_process(camwebsrv_sclients_t clients, camwebsrv_camera_t cam, httpd_handle_t handle, uint16_t *nextevent);
+esp_err_t camwebsrv_sclients_sockbuf_stats(camwebsrv_sclients_t clients, size_t *occupancy, size_t *highwater);
+esp_err_t camwebsrv_sclients_quantum_stats(camwebsrv_sclients_t clients, uint32_t *turns, uint32_t *bytehits, uint32_t *timehits);
+esp_err_t camwebsrv_sclients_rate_stats(camwebsrv_sclients_t clients, camwebsrv_sclients_rate_t *rate);
+esp_err_t camwebsrv_sclients_snapshot(camwebsrv_sclients_t clients, camwebsrv_sclients_info_t *info, size_t max, size_t *count);
+esp_err_t camwebsrv_sclients_wake(camwebsrv_sclients_t clients);
 
 #endif
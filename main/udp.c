@@ -0,0 +1,42 @@
+// 2026-10-16 udp.c
+// Copyright (C) 2023 Vino Fernando Crescini  <vfcrescini@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "config.h"
+#include "udp.h"
+
+#include <string.h>
+#include <errno.h>
+
+#include <esp_log.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+esp_err_t camwebsrv_udp_sendto(int sock, const void *buf, size_t len, const struct sockaddr *addr, socklen_t alen, uint8_t retries)
+{
+  uint8_t tries = 0;
+
+  if (buf == NULL || addr == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // lwIP runs out of packet buffers long before the socket is "full", so
+  // give it a moment before giving up on the rest of the frame
+
+  while(sendto(sock, buf, len, 0, addr, alen) < 0)
+  {
+    int e = errno;
+
+    if ((e != EAGAIN && e != EWOULDBLOCK && e != ENOMEM) || tries++ >= retries)
+    {
+      ESP_LOGD(CAMWEBSRV_TAG, "UDP camwebsrv_udp_sendto(%d): sendto() failed: [%d]: %s", sock, e, strerror(e));
+      return ESP_FAIL;
+    }
+
+    vTaskDelay(1);
+  }
+
+  return ESP_OK;
+}
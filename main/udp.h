@@ -0,0 +1,17 @@
+// 2026-10-16 udp.h
+// Copyright (C) 2023 Vino Fernando Crescini  <vfcrescini@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _CAMWEBSRV_UDP_H
+#define _CAMWEBSRV_UDP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <lwip/sockets.h>
+
+#include <esp_err.h>
+
+esp_err_t camwebsrv_udp_sendto(int sock, const void *buf, size_t len, const struct sockaddr *addr, socklen_t alen, uint8_t retries);
+
+#endif
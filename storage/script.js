@@ -28,6 +28,10 @@ function onContentLoaded(event)
 
   let is_streaming = false;
 
+  let changes = {};
+
+  let changes_timer = null;
+
   function id_generate()
   {
     return Date.now().toString(16).padStart(12, "0") + parseInt(Math.random() * 100000000, 10).toString(16).padStart(8, "0");
@@ -64,7 +68,25 @@ function onContentLoaded(event)
         return;
     }
 
-    query_send(`${url_base}/control?var=${el.id}&val=${value}`);
+    // slider drags fire lots of these; gather whatever comes in over a
+    // short while and send it as one request
+
+    changes[el.id] = value;
+
+    if (changes_timer === null)
+    {
+      changes_timer = setTimeout(changes_send, 100);
+    }
+  }
+
+  function changes_send()
+  {
+    let query = Object.keys(changes).map(key => `${key}=${changes[key]}`).join('&');
+
+    changes = {};
+    changes_timer = null;
+
+    query_send(`${url_base}/control?${query}`);
   }
 
   function element_set_visible(el, value)
@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+# 2026-10-16 mcast_recv.py
+# Copyright (C) 2023 Vino Fernando Crescini  <vfcrescini@gmail.com>
+# SPDX-License-Identifier: GPL-3.0-or-later
+
+# Receives the multicast stream sent by main/mcast.c, reassembles the frames,
+# rebuilds lost fragments from parity where it can, and either writes the
+# frames out as JPEG files, writes them to stdout as a raw MJPEG stream, or
+# just reports loss statistics.
+#
+#   $ tools/mcast_recv.py 239.255.0.1
+#   $ tools/mcast_recv.py 239.255.0.1 --out frames/
+#   $ tools/mcast_recv.py 239.255.0.1 --stdout | ffplay -f mjpeg -
+
+import argparse
+import os
+import socket
+import struct
+import sys
+import time
+
+HDR = struct.Struct('>2sBBIHHIBBH')
+HDR_LEN = HDR.size
+VERSION = 1
+FLAG_LAST = 0x01
+FLAG_PARITY = 0x02
+
+# frames still incomplete after this many newer frames have started are
+# given up on
+
+WINDOW = 4
+
+
+class Frame:
+
+  def __init__(self, seq, nfrags, flen, fec):
+    self.seq = seq
+    self.nfrags = nfrags
+    self.flen = flen
+    self.fec = fec
+    self.frags = {}
+    self.parity = {}
+    self.recovered = 0
+
+  def repair(self):
+    # each parity datagram covers fec fragments; one missing fragment in a
+    # group is the XOR of the parity and the rest of the group
+
+    for first, parity in self.parity.items():
+      group = range(first, min(first + self.fec, self.nfrags))
+      missing = [f for f in group if f not in self.frags]
+
+      if len(missing) != 1:
+        continue
+
+      # every fragment but the last is full, so the parity is as long as a
+      # full fragment unless the last fragment is all there is in the group
+
+      frag = missing[0]
+
+      if frag < self.nfrags - 1 or len(group) == 1:
+        flen = len(parity)
+      else:
+        flen = self.flen - (frag * len(parity))
+
+      buf = bytearray(parity)
+
+      for f in group:
+        if f in self.frags:
+          for i, b in enumerate(self.frags[f]):
+            buf[i] ^= b
+
+      self.frags[frag] = bytes(buf[:flen])
+      self.recovered += 1
+
+  def complete(self):
+    return len(self.frags) == self.nfrags
+
+  def data(self):
+    return b''.join(self.frags[f] for f in range(self.nfrags))
+
+
+class Stats:
+
+  def __init__(self):
+    self.datagrams = 0
+    self.frames = 0
+    self.lost = 0
+    self.recovered = 0
+    self.bytes = 0
+    self.tlast = time.monotonic()
+
+  def report(self, force=False):
+    tnow = time.monotonic()
+
+    if not force and tnow - self.tlast < 5:
+      return
+
+    total = self.frames + self.lost
+    loss = (100.0 * self.lost / total) if total > 0 else 0.0
+
+    sys.stderr.write('datagrams %d, frames %d, lost %d (%.1f%%), fragments recovered %d, %.1f kB/s\n' % (self.datagrams, self.frames, self.lost, loss, self.recovered, self.bytes / 1024.0 / (tnow - self.tlast)))
+
+    self.bytes = 0
+    self.tlast = tnow
+
+
+def open_socket(group, port, iface):
+  sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+  sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+
+  if hasattr(socket, 'SO_REUSEPORT'):
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+
+  sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 20)
+  sock.bind(('', port))
+
+  mreq = struct.pack('4s4s', socket.inet_aton(group), socket.inet_aton(iface))
+  sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreq)
+
+  return sock
+
+
+def emit(frame, args, stats):
+  data = frame.data()
+
+  stats.frames += 1
+  stats.recovered += frame.recovered
+
+  if args.out is not None:
+    with open(os.path.join(args.out, '%010u.jpg' % frame.seq), 'wb') as f:
+      f.write(data)
+
+  if args.stdout:
+    sys.stdout.buffer.write(data)
+    sys.stdout.buffer.flush()
+
+
+def main():
+  parser = argparse.ArgumentParser(description='esp32-cam-websrv multicast stream receiver')
+  parser.add_argument('group', help='multicast group, as set by mcast_group')
+  parser.add_argument('--port', type=int, default=5008, help='port, as set by mcast_port (default: 5008)')
+  parser.add_argument('--iface', default='0.0.0.0', help='address of the interface to join the group on')
+  parser.add_argument('--out', help='write each frame to this directory')
+  parser.add_argument('--stdout', action='store_true', help='write frames to stdout as MJPEG')
+  args = parser.parse_args()
+
+  if args.out is not None:
+    os.makedirs(args.out, exist_ok=True)
+
+  sock = open_socket(args.group, args.port, args.iface)
+  frames = {}
+  done = -1
+  stats = Stats()
+
+  try:
+    while True:
+      pkt, _ = sock.recvfrom(65536)
+
+      stats.report()
+
+      if len(pkt) < HDR_LEN:
+        continue
+
+      magic, version, flags, seq, frag, nfrags, flen, fec, _, plen = HDR.unpack_from(pkt)
+
+      if magic != b'CM' or version != VERSION or len(pkt) < HDR_LEN + plen:
+        continue
+
+      stats.datagrams += 1
+      stats.bytes += len(pkt)
+
+      # late datagram for a frame we've already emitted or given up on
+
+      if done >= 0 and (seq == done or ((seq - done) & 0xFFFFFFFF) >= 0x80000000):
+        continue
+
+      frame = frames.get(seq)
+
+      if frame is None:
+        frame = frames[seq] = Frame(seq, nfrags, flen, fec)
+
+      payload = pkt[HDR_LEN:HDR_LEN + plen]
+
+      if flags & FLAG_PARITY:
+        frame.parity[frag] = payload
+      else:
+        frame.frags[frag] = payload
+
+      if not frame.complete() and fec > 0:
+        frame.repair()
+
+      if not frame.complete():
+        # give up on frames that have fallen too far behind
+
+        for old in [s for s in frames if ((seq - s) & 0xFFFFFFFF) > WINDOW and ((seq - s) & 0xFFFFFFFF) < 0x80000000]:
+          del frames[old]
+          stats.lost += 1
+
+        continue
+
+      # frames older than this one that are still incomplete won't be shown
+      # anyway
+
+      for old in [s for s in frames if s != seq and ((seq - s) & 0xFFFFFFFF) < 0x80000000]:
+        del frames[old]
+        stats.lost += 1
+
+      del frames[seq]
+      done = seq
+
+      emit(frame, args, stats)
+
+  except KeyboardInterrupt:
+    stats.report(True)
+
+
+if __name__ == '__main__':
+  main()